@@ -0,0 +1,394 @@
+#include <arch/i386/acpi.h>
+#include <arch/i386/cpu.h>
+#include <arch/i386/delay.h>
+#include <arch/i386/irq.h>
+#include <arch/i386/paging.h>
+#include <early_kprintf.h>
+#include <io.h>
+#include <klog.h>
+#include <lib/string.h>
+#include <mm/vm.h>
+#include <multiboot2_tbl.h>
+
+struct acpi_info acpi_info = {0};
+
+static struct acpi_table tables[ACPI_MAX_TABLES];
+static u8 table_hash[ACPI_HASH_SIZE] = {0}; /* index + 1, 0 is empty */
+
+static u8 _checksum(const void* ptr, size_t len) {
+    const u8* bytes = ptr;
+    u8 sum = 0;
+    for (size_t i = 0; i < len; i++) sum += bytes[i];
+    return sum;
+}
+
+static u32 _sig_hash(u32 sig) {
+    return (sig * 2654435761u) >> (32 - ACPI_HASH_BITS);
+}
+
+static bool _valid_rsdp(const struct acpi_rsdp* rsdp) {
+    if (memcmp(rsdp->sig, ACPI_RSDP_SIG, sizeof(rsdp->sig)) != 0)
+        return false;
+    if (_checksum(rsdp, ACPI_RSDP_V1_LEN) != 0) return false;
+    return rsdp->revision < 2 || _checksum(rsdp, rsdp->length) == 0;
+}
+
+static const struct acpi_rsdp* _scan_rsdp(size_t start, size_t end) {
+    for (size_t addr = start; addr + sizeof(struct acpi_rsdp) <= end;
+         addr += ACPI_RSDP_ALIGN) {
+        const struct acpi_rsdp* rsdp = PHYS_TO_VIRT(addr);
+        if (_valid_rsdp(rsdp)) return rsdp;
+    }
+    return NULL;
+}
+
+// The bootloader's copy, else the first KiB of the EBDA & the BIOS ROM
+static const struct acpi_rsdp* _find_rsdp() {
+    const struct acpi_rsdp* rsdp = get_rsdp();
+    if (rsdp != NULL && _valid_rsdp(rsdp)) return rsdp;
+
+    size_t ebda = (size_t)*(u16*)PHYS_TO_VIRT(ACPI_EBDA_PTR) << 4;
+    if (ebda != 0) {
+        rsdp = _scan_rsdp(ebda, ebda + ACPI_EBDA_SCAN);
+        if (rsdp != NULL) return rsdp;
+    }
+    return _scan_rsdp(ACPI_BIOS_START, ACPI_BIOS_END);
+}
+
+/*
+    Maps the table at phys (header first for its length)
+    Returns NULL if it can't be mapped or its checksum is off
+*/
+static const struct acpi_sdt_header* _map_table(phys_addr_t phys) {
+    const struct acpi_sdt_header* hdr =
+        ioremap(phys, sizeof(struct acpi_sdt_header), MEM_WB);
+    if (hdr == NULL) return NULL;
+
+    u32 length = hdr->length;
+    iounmap((void*)hdr);
+    if (length < sizeof(struct acpi_sdt_header)) return NULL;
+
+    hdr = ioremap(phys, length, MEM_WB);
+    if (hdr == NULL) return NULL;
+    if (_checksum(hdr, length) != 0) {
+        klog(KLOG_WARNING, "ACPI: bad checksum in %.4s at 0x%llx\n",
+             hdr->sig, phys);
+        iounmap((void*)hdr);
+        return NULL;
+    }
+    return hdr;
+}
+
+static void _add_table(phys_addr_t phys) {
+    if (acpi_info.num_tables == ACPI_MAX_TABLES) {
+        klog(KLOG_WARNING, "ACPI: too many tables, 0x%llx skipped\n", phys);
+        return;
+    }
+
+    const struct acpi_sdt_header* hdr = _map_table(phys);
+    if (hdr == NULL) return;
+
+    size_t idx = acpi_info.num_tables++;
+    u32 sig;
+    memcpy(&sig, hdr->sig, sizeof(sig));
+    tables[idx].sig = sig;
+    tables[idx].length = hdr->length;
+    tables[idx].phys = phys;
+    tables[idx].hdr = hdr;
+
+    // Linear probing, a signature already in keeps its first table
+    u32 slot = _sig_hash(sig);
+    while (table_hash[slot] != 0) {
+        if (tables[table_hash[slot] - 1].sig == sig) return;
+        slot = (slot + 1) & (ACPI_HASH_SIZE - 1);
+    }
+    table_hash[slot] = idx + 1;
+}
+
+// Returns NULL if the firmware has no such table
+const struct acpi_sdt_header* acpi_find_table(u32 sig) {
+    u32 slot = _sig_hash(sig);
+    while (table_hash[slot] != 0) {
+        const struct acpi_table* table = &tables[table_hash[slot] - 1];
+        if (table->sig == sig) return table->hdr;
+        slot = (slot + 1) & (ACPI_HASH_SIZE - 1);
+    }
+    return NULL;
+}
+
+static void _parse_madt(const struct acpi_madt* madt) {
+    acpi_info.has_madt = true;
+    acpi_info.lapic_addr = madt->lapic_addr;
+    acpi_info.pcat_compat = madt->flags & MADT_PCAT_COMPAT;
+
+    const u8* ptr = (const u8*)(madt + 1);
+    const u8* end = (const u8*)madt + madt->hdr.length;
+    while (ptr + sizeof(struct madt_entry) <= end) {
+        const struct madt_entry* entry = (const struct madt_entry*)ptr;
+        if (entry->length < sizeof(struct madt_entry) ||
+            ptr + entry->length > end)
+            break;
+
+        switch (entry->type) {
+            case MADT_LAPIC: {
+                const struct madt_lapic* lapic = (const void*)entry;
+                if (!(lapic->flags & MADT_LAPIC_ENABLED)) break;
+                if (acpi_info.num_cpus < MAX_CPUS)
+                    acpi_info.cpu_apic_ids[acpi_info.num_cpus] =
+                        lapic->apic_id;
+                acpi_info.num_cpus++;
+                break;
+            }
+            case MADT_IOAPIC: {
+                const struct madt_ioapic* io = (const void*)entry;
+                if (acpi_info.num_ioapics == ACPI_MAX_IOAPICS) break;
+                struct acpi_ioapic_info* info =
+                    &acpi_info.ioapics[acpi_info.num_ioapics++];
+                info->id = io->ioapic_id;
+                info->addr = io->addr;
+                info->gsi_base = io->gsi_base;
+                break;
+            }
+            case MADT_INT_OVERRIDE: {
+                const struct madt_int_override* iso = (const void*)entry;
+                if (iso->source >= NUM_LEGACY_IRQS) break;
+                acpi_info.isa_irqs[iso->source].gsi = iso->gsi;
+                acpi_info.isa_irqs[iso->source].flags = iso->flags;
+                break;
+            }
+            case MADT_LAPIC_ADDR: {
+                const struct madt_lapic_addr* addr = (const void*)entry;
+                if (addr->addr < LEGACY_PHYS_LIMIT)
+                    acpi_info.lapic_addr = addr->addr;
+                break;
+            }
+        }
+        ptr += entry->length;
+    }
+}
+
+static void _parse_hpet(const struct acpi_hpet* hpet) {
+    if (hpet->base.space_id != ACPI_SPACE_MEMORY) return;
+
+    acpi_info.has_hpet = true;
+    acpi_info.hpet_addr = hpet->base.address;
+    acpi_info.hpet_comparators = HPET_ID_COMPARATORS(hpet->block_id);
+    acpi_info.hpet_min_tick = hpet->min_tick;
+}
+
+static void _parse_mcfg(const struct acpi_mcfg* mcfg) {
+    const struct mcfg_entry* entry = (const struct mcfg_entry*)(mcfg + 1);
+    const u8* end = (const u8*)mcfg + mcfg->hdr.length;
+    while ((const u8*)(entry + 1) <= end &&
+           acpi_info.num_mcfg < ACPI_MAX_MCFG)
+        acpi_info.mcfg[acpi_info.num_mcfg++] = *entry++;
+}
+
+/*
+    Finds the \_S5 package in the DSDT & takes its first two values (the
+    PM1a/PM1b SLP_TYP for soft off) without an AML interpreter:
+    NameOp "_S5_" PackageOp PkgLength NumElements, then each value is a
+    BytePrefix'd byte or a bare Zero/One
+*/
+static void _parse_s5(const struct acpi_sdt_header* dsdt) {
+    const u8* ptr = (const u8*)(dsdt + 1);
+    const u8* end = (const u8*)dsdt + dsdt->length;
+
+    for (; ptr + 4 < end; ptr++) {
+        if (memcmp(ptr, "_S5_", 4) != 0) continue;
+
+        const u8* name = ptr;
+        if (!(name[-1] == AML_NAME_OP ||
+              (name[-2] == AML_NAME_OP && name[-1] == '\\')))
+            continue;
+
+        ptr += 4;
+        if (ptr >= end || *ptr++ != AML_PACKAGE_OP) continue;
+        ptr += ((*ptr >> 6) & 0x3) + 1; /* PkgLength */
+        ptr++;                           /* NumElements */
+
+        u8 values[2];
+        for (int i = 0; i < 2; i++) {
+            if (ptr >= end) return;
+            if (*ptr == AML_BYTE_PREFIX) ptr++;
+            values[i] = (ptr < end) ? *ptr++ : 0;
+        }
+
+        acpi_info.slp_typa = values[0];
+        acpi_info.slp_typb = values[1];
+        acpi_info.has_s5 = true;
+        return;
+    }
+}
+
+static void _parse_fadt(const struct acpi_fadt* fadt) {
+    acpi_info.has_fadt = true;
+    acpi_info.sci_irq = fadt->sci_irq;
+    acpi_info.smi_cmd = fadt->smi_cmd;
+    acpi_info.acpi_enable = fadt->acpi_enable;
+    acpi_info.pm1a_cnt = fadt->pm1a_cnt_blk;
+    acpi_info.pm1b_cnt = fadt->pm1b_cnt_blk;
+    if (fadt->pm_tmr_len == 4) {
+        acpi_info.pm_timer_port = fadt->pm_tmr_blk;
+        acpi_info.pm_timer_32bit = fadt->flags & FADT_TMR_VAL_EXT;
+    }
+
+    // ACPI 1.0 FADTs end before the boot flags & 64-bit addresses
+    size_t len = fadt->hdr.length;
+    if (len >= offsetof(struct acpi_fadt, reserved2))
+        acpi_info.boot_arch = fadt->boot_arch;
+
+    phys_addr_t dsdt = fadt->dsdt;
+    if (len >= offsetof(struct acpi_fadt, x_dsdt) + sizeof(fadt->x_dsdt) &&
+        fadt->x_dsdt != 0 && fadt->x_dsdt < LEGACY_PHYS_LIMIT)
+        dsdt = fadt->x_dsdt;
+
+    // Not in the XSDT, indexed like the rest
+    if (dsdt != 0) _add_table(dsdt);
+    const struct acpi_sdt_header* hdr = acpi_find_table(ACPI_SIG_DSDT);
+    if (hdr != NULL) _parse_s5(hdr);
+}
+
+/*
+    Walks the XSDT (RSDT before ACPI 2.0) & indexes every valid table,
+    then parses the ones the kernel uses
+    Returns false without ACPI (callers keep their legacy defaults)
+    NOTE: after vm_init(), tables stay mapped
+*/
+bool acpi_init() {
+    for (u32 irq = 0; irq < NUM_LEGACY_IRQS; irq++)
+        acpi_info.isa_irqs[irq].gsi = irq;
+
+    const struct acpi_rsdp* rsdp = _find_rsdp();
+    if (rsdp == NULL) {
+        klog(KLOG_WARNING, "ACPI: no RSDP found\n");
+        return false;
+    }
+
+    bool xsdt = rsdp->revision >= 2 && rsdp->xsdt_addr != 0 &&
+                rsdp->xsdt_addr < LEGACY_PHYS_LIMIT;
+    const struct acpi_sdt_header* root =
+        _map_table(xsdt ? rsdp->xsdt_addr : rsdp->rsdt_addr);
+    if (root == NULL) {
+        klog(KLOG_WARNING, "ACPI: no valid %s\n", xsdt ? "XSDT" : "RSDT");
+        return false;
+    }
+
+    acpi_info.present = true;
+    acpi_info.revision = rsdp->revision;
+
+    size_t entry_size = xsdt ? sizeof(u64) : sizeof(u32);
+    size_t count = (root->length - sizeof(*root)) / entry_size;
+    const u8* entries = (const u8*)(root + 1);
+    for (size_t i = 0; i < count; i++) {
+        u64 phys = 0;
+        memcpy(&phys, entries + i * entry_size, entry_size);
+        if (phys != 0 && phys < LEGACY_PHYS_LIMIT) _add_table(phys);
+    }
+
+    const struct acpi_sdt_header* hdr;
+    if ((hdr = acpi_find_table(ACPI_SIG_MADT)) != NULL)
+        _parse_madt((const struct acpi_madt*)hdr);
+    if ((hdr = acpi_find_table(ACPI_SIG_HPET)) != NULL)
+        _parse_hpet((const struct acpi_hpet*)hdr);
+    if ((hdr = acpi_find_table(ACPI_SIG_MCFG)) != NULL)
+        _parse_mcfg((const struct acpi_mcfg*)hdr);
+    if ((hdr = acpi_find_table(ACPI_SIG_FADT)) != NULL)
+        _parse_fadt((const struct acpi_fadt*)hdr);
+
+    klog(KLOG_INFO, "ACPI: rev %u, %u tables, %u CPU(s), %u I/O APIC(s)\n",
+         acpi_info.revision, acpi_info.num_tables, acpi_info.num_cpus,
+         acpi_info.num_ioapics);
+    return true;
+}
+
+// Physical base of bus's ECAM window, 0 if no MCFG entry covers it
+phys_addr_t acpi_pci_ecam(u16 segment, u8 bus) {
+    for (u32 i = 0; i < acpi_info.num_mcfg; i++) {
+        const struct mcfg_entry* entry = &acpi_info.mcfg[i];
+        if (entry->segment != segment || bus < entry->start_bus ||
+            bus > entry->end_bus)
+            continue;
+        return entry->base + ((phys_addr_t)bus << PCI_ECAM_BUS_SHIFT);
+    }
+    return 0;
+}
+
+// ACPI_PM_TIMER_HZ counter, 24 or 32 bits wide, 0 without one
+u32 acpi_pm_timer_read() {
+    if (acpi_info.pm_timer_port == 0) return 0;
+
+    u32 val = inl(acpi_info.pm_timer_port);
+    return acpi_info.pm_timer_32bit ? val : val & 0xFFFFFF;
+}
+
+/*
+    Soft off (S5): switches the chipset to ACPI mode if the firmware left
+    it in legacy mode, then writes SLP_TYP | SLP_EN to PM1a/b
+    Returns false if the machine is still running
+*/
+bool acpi_shutdown() {
+    if (!acpi_info.has_fadt || !acpi_info.has_s5 || acpi_info.pm1a_cnt == 0)
+        return false;
+
+    if (!(inw(acpi_info.pm1a_cnt) & ACPI_PM1_SCI_EN) &&
+        acpi_info.smi_cmd != 0 && acpi_info.acpi_enable != 0) {
+        outb(acpi_info.smi_cmd, acpi_info.acpi_enable);
+        poll_until(acpi_info.pm1a_cnt, ACPI_PM1_SCI_EN, ACPI_PM1_SCI_EN,
+                   ACPI_ENABLE_TIMEOUT_US);
+    }
+
+    u32 flags = local_irq_save();
+    outw(acpi_info.pm1a_cnt, (acpi_info.slp_typa << ACPI_PM1_SLP_TYP_SHIFT) |
+                                 ACPI_PM1_SLP_EN);
+    if (acpi_info.pm1b_cnt != 0)
+        outw(acpi_info.pm1b_cnt,
+             (acpi_info.slp_typb << ACPI_PM1_SLP_TYP_SHIFT) | ACPI_PM1_SLP_EN);
+
+    udelay(ACPI_ENABLE_TIMEOUT_US);
+    local_irq_restore(flags);
+    return false;
+}
+
+void acpi_print_info() {
+    if (!acpi_info.present) {
+        kprintf("ACPI: not present\n");
+        return;
+    }
+
+    kprintf("ACPI: revision %u, %u tables\n", acpi_info.revision,
+            acpi_info.num_tables);
+    for (size_t i = 0; i < acpi_info.num_tables; i++) {
+        const struct acpi_sdt_header* hdr = tables[i].hdr;
+        kprintf("  %.4s 0x%08llx %6u rev %u %.6s\n", hdr->sig,
+                tables[i].phys, tables[i].length, hdr->revision, hdr->oem_id);
+    }
+
+    if (acpi_info.has_madt) {
+        kprintf("MADT: %u CPU(s), local APIC 0x%x, I/O APICs:",
+                acpi_info.num_cpus, acpi_info.lapic_addr);
+        for (u32 i = 0; i < acpi_info.num_ioapics; i++)
+            kprintf(" %u@0x%x (GSI %u)", acpi_info.ioapics[i].id,
+                    acpi_info.ioapics[i].addr, acpi_info.ioapics[i].gsi_base);
+        kputs("\n");
+        for (u32 irq = 0; irq < NUM_LEGACY_IRQS; irq++) {
+            const struct acpi_isa_irq* isa = &acpi_info.isa_irqs[irq];
+            if (isa->gsi != irq || isa->flags != 0)
+                kprintf("  IRQ %u -> GSI %u, flags 0x%x\n", irq, isa->gsi,
+                        isa->flags);
+        }
+    }
+    if (acpi_info.has_hpet)
+        kprintf("HPET: 0x%llx, %u comparators, min tick %u\n",
+                acpi_info.hpet_addr, acpi_info.hpet_comparators,
+                acpi_info.hpet_min_tick);
+    if (acpi_info.has_fadt)
+        kprintf("FADT: SCI IRQ %u, PM timer 0x%x (%u bits), S5 %s\n",
+                acpi_info.sci_irq, acpi_info.pm_timer_port,
+                acpi_info.pm_timer_32bit ? 32 : 24,
+                acpi_info.has_s5 ? "yes" : "no");
+    for (u32 i = 0; i < acpi_info.num_mcfg; i++)
+        kprintf("MCFG: segment %u, buses %u-%u at 0x%llx\n",
+                acpi_info.mcfg[i].segment, acpi_info.mcfg[i].start_bus,
+                acpi_info.mcfg[i].end_bus, acpi_info.mcfg[i].base);
+}
@@ -0,0 +1,253 @@
+#include <arch/i386/acpi.h>
+#include <arch/i386/apic.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/delay.h>
+#include <arch/i386/irq.h>
+#include <arch/i386/msr.h>
+#include <arch/i386/pic.h>
+#include <arch/i386/smp.h>
+#include <early_kprintf.h>
+#include <io.h>
+#include <klog.h>
+#include <mm/vm.h>
+#include <spinlock.h>
+
+volatile u32* lapic_regs = NULL;
+static phys_addr_t lapic_phys = 0;
+
+static volatile u32* ioapic_regs = NULL;
+static phys_addr_t ioapic_phys = IOAPIC_DEFAULT_BASE;
+static u32 ioapic_pins = 0;
+static spinlock_t ioapic_lock = SPINLOCK_INIT;
+
+static bool _ioapic_enable(u8 irq, u32 cpu);
+static void _ioapic_disable(u8 irq);
+static void _ioapic_eoi(u8 irq);
+
+// num_irqs is the pin count, set once the chip is probed
+struct irq_chip ioapic_chip = {"I/O APIC", 0, _ioapic_enable,
+                               _ioapic_disable, _ioapic_eoi, NULL};
+
+static u32 _ioapic_read(u32 reg) {
+    ioapic_regs[IOAPIC_REGSEL >> 2] = reg;
+    return ioapic_regs[IOAPIC_WIN >> 2];
+}
+
+static void _ioapic_write(u32 reg, u32 val) {
+    ioapic_regs[IOAPIC_REGSEL >> 2] = reg;
+    ioapic_regs[IOAPIC_WIN >> 2] = val;
+}
+
+/*
+    Finds the pin & trigger mode of irq: ISA IRQs go through the MADT
+    overrides (identity, edge & active high by default), anything past
+    them is a PCI GSI (level & active low)
+    Returns false if irq isn't wired to this I/O APIC (GSI base 0), or if
+    its GSI is one an override gave to another ISA IRQ (IRQ 0 -> GSI 2
+    leaves IRQ 2 without a pin, it'd unmask the timer's)
+*/
+static bool _ioapic_route(u8 irq, u32* pin, u32* mode) {
+    u32 gsi = irq;
+    u16 mps = MPS_ACTIVE_LOW | MPS_LEVEL;
+    if (irq < NUM_LEGACY_IRQS) {
+        gsi = acpi_info.isa_irqs[irq].gsi;
+        mps = acpi_info.isa_irqs[irq].flags;
+    }
+    if (gsi >= ioapic_pins) return false;
+
+    for (u32 other = 0; other < NUM_LEGACY_IRQS; other++) {
+        u32 other_gsi = acpi_info.isa_irqs[other].gsi;
+        if (other != irq && other_gsi != other && other_gsi == gsi)
+            return false;
+    }
+
+    *pin = gsi;
+    *mode = 0;
+    if ((mps & MPS_POLARITY_MASK) == MPS_ACTIVE_LOW)
+        *mode |= IOAPIC_ACTIVE_LOW;
+    if ((mps & MPS_TRIGGER_MASK) == MPS_LEVEL) *mode |= IOAPIC_LEVEL;
+    return true;
+}
+
+/*
+    Routes irq to IRQ_VECTOR(irq) on cpu: fixed delivery to one APIC id,
+    on the pin & with the trigger mode the firmware reported
+    NOTE: the entry is masked while the destination changes, so it never
+    fires half written
+*/
+static bool _ioapic_enable(u8 irq, u32 cpu) {
+    u32 pin, mode;
+    if (!_ioapic_route(irq, &pin, &mode) || cpu >= smp_num_cpus())
+        return false;
+
+    u32 flags = spin_lock_irqsave(&ioapic_lock);
+    _ioapic_write(IOAPIC_REG_REDIR(pin), IOAPIC_MASKED);
+    _ioapic_write(IOAPIC_REG_REDIR(pin) + 1,
+                  smp_cpu_apic_id(cpu) << IOAPIC_DEST_SHIFT);
+    _ioapic_write(IOAPIC_REG_REDIR(pin),
+                  APIC_DM_FIXED | mode | IRQ_VECTOR(irq));
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    return true;
+}
+
+static void _ioapic_disable(u8 irq) {
+    u32 pin, mode;
+    if (!_ioapic_route(irq, &pin, &mode)) return;
+
+    u32 flags = spin_lock_irqsave(&ioapic_lock);
+    _ioapic_write(IOAPIC_REG_REDIR(pin), IOAPIC_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+static void _ioapic_eoi(u8 irq) {
+    (void)irq;
+    lapic_eoi();
+}
+
+// Returns false if nothing answers at phys
+static bool _ioapic_probe(phys_addr_t phys) {
+    ioapic_regs = ioremap(phys, PAGE_SIZE, MEM_UC);
+    if (ioapic_regs == NULL) return false;
+
+    u32 version = _ioapic_read(IOAPIC_REG_VERSION);
+    if (version == 0xFFFFFFFF) {
+        iounmap((void*)ioapic_regs);
+        ioapic_regs = NULL;
+        return false;
+    }
+
+    ioapic_phys = phys;
+    ioapic_pins = ((version >> IOAPIC_MAX_PINS_SHIFT) & 0xFF) + 1;
+    if (ioapic_pins > MAX_IRQS) ioapic_pins = MAX_IRQS;
+    ioapic_chip.num_irqs = ioapic_pins;
+
+    for (u32 pin = 0; pin < ioapic_pins; pin++)
+        _ioapic_write(IOAPIC_REG_REDIR(pin), IOAPIC_MASKED);
+    return true;
+}
+
+/*
+    Enables this CPU's local APIC: every LVT entry masked but LINT1 (NMI)
+    on the boot CPU, & LINT0 as the 8259 virtual wire when there's no I/O
+    APIC to take over
+    NOTE: runs on every CPU, interrupts off
+*/
+void lapic_setup() {
+    bool bsp = rdmsr(MSR_APIC_BASE) & APIC_BASE_BSP;
+    u32 max_lvt = LAPIC_MAX_LVT(lapic_read(LAPIC_VERSION));
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    if (max_lvt >= LAPIC_LVT_PERF_MIN)
+        lapic_write(LAPIC_LVT_PERF, LAPIC_LVT_MASKED);
+    if (max_lvt >= LAPIC_LVT_THERMAL_MIN)
+        lapic_write(LAPIC_LVT_THERMAL, LAPIC_LVT_MASKED);
+
+    bool virtual_wire = bsp && ioapic_regs == NULL;
+    lapic_write(LAPIC_LVT_LINT0,
+                virtual_wire ? APIC_DM_EXTINT : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, bsp ? APIC_DM_NMI : LAPIC_LVT_MASKED);
+
+    // ESR is latched by a write
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_eoi();
+}
+
+static bool _icr_idle() {
+    return poll_until_mmio(&lapic_regs[LAPIC_ICR_LOW >> 2], ICR_PENDING, 0,
+                           LAPIC_IPI_TIMEOUT_US);
+}
+
+/*
+    Sends icr (delivery mode | vector) to one APIC id
+    Returns false if the previous IPI never left
+    NOTE: interrupts are off across the ICR pair, a handler sending its
+    own IPI can't split it
+*/
+bool lapic_send_ipi(u32 apic_id, u32 icr) {
+    u32 flags = local_irq_save();
+    bool idle = _icr_idle();
+    if (idle) {
+        lapic_write(LAPIC_ICR_HIGH, apic_id << ICR_DEST_SHIFT);
+        lapic_write(LAPIC_ICR_LOW, icr);
+    }
+    local_irq_restore(flags);
+    return idle;
+}
+
+// Sends icr to every CPU but this one
+bool lapic_broadcast_ipi(u32 icr) {
+    u32 flags = local_irq_save();
+    bool idle = _icr_idle();
+    if (idle) lapic_write(LAPIC_ICR_LOW, ICR_ALL_BUT_SELF | icr);
+    local_irq_restore(flags);
+    return idle;
+}
+
+// Old chipsets boot with the 8259 wired straight to the CPU
+static void _imcr_route_apic() {
+    outb(IMCR_SELECT, IMCR_REG);
+    outb(IMCR_DATA, inb(IMCR_DATA) | IMCR_APIC);
+}
+
+/*
+    The MADT's I/O APIC with the ISA IRQs (GSI 0 up), else the default
+    address; any other I/O APIC is only listed by acpi_print_info()
+*/
+static bool _ioapic_find() {
+    for (u32 i = 0; i < acpi_info.num_ioapics; i++) {
+        const struct acpi_ioapic_info* io = &acpi_info.ioapics[i];
+        if (io->gsi_base != 0) continue;
+        return _ioapic_probe(io->addr);
+    }
+    return !acpi_info.has_madt && _ioapic_probe(IOAPIC_DEFAULT_BASE);
+}
+
+/*
+    Maps & enables the boot CPU's local APIC, then moves device IRQs from
+    the 8259 to the I/O APIC if there is one
+    Returns false without a local APIC (everything stays on the 8259)
+    NOTE: interrupts off, before any IRQ is requested
+*/
+bool apic_init() {
+    if (!has_cpu_APIC()) {
+        klog(KLOG_INFO, "APIC: not present, using the 8259\n");
+        return false;
+    }
+
+    u64 base = rdmsr(MSR_APIC_BASE);
+    if (!(base & APIC_BASE_ENABLE))
+        wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+
+    lapic_phys = base & APIC_BASE_ADDR_MASK;
+    lapic_regs = ioremap(lapic_phys, PAGE_SIZE, MEM_UC);
+    if (lapic_regs == NULL) {
+        kerror("APIC: failed to map the local APIC!\n");
+        return false;
+    }
+
+    bool io = _ioapic_find();
+    lapic_setup();
+
+    klog(KLOG_INFO, "APIC: local APIC %u at 0x%llx, version 0x%x\n",
+         lapic_id(), lapic_phys, lapic_read(LAPIC_VERSION) & 0xFF);
+    if (!io) {
+        klog(KLOG_WARNING, "APIC: no I/O APIC, IRQs stay on the 8259\n");
+        return true;
+    }
+
+    _imcr_route_apic();
+    pic_disable();
+    irq_set_chip(&ioapic_chip);
+    klog(KLOG_INFO, "APIC: I/O APIC at 0x%llx, %u pins\n", ioapic_phys,
+         ioapic_pins);
+    return true;
+}
+
+bool lapic_active() { return lapic_regs != NULL; }
+
+bool ioapic_active() { return ioapic_regs != NULL; }
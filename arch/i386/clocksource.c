@@ -0,0 +1,261 @@
+#include <arch/i386/acpi.h>
+#include <arch/i386/clocksource.h>
+#include <arch/i386/cpu.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/irq.h>
+#include <early_kprintf.h>
+#include <io.h>
+#include <klog.h>
+#include <lib/conversion.h>
+#include <mm/vm.h>
+
+#define KTIME_COST_RUNS 64
+
+static volatile u32* hpet_regs = NULL;
+static u64 jiffies = 0;
+
+static u64 _tsc_read() { return rdtsc(); }
+
+static u64 _hpet_read() { return hpet_regs[HPET_REG_COUNTER >> 2]; }
+
+static u64 _acpi_pm_read() { return acpi_pm_timer_read(); }
+
+static u64 _jiffies_read() {
+    return __atomic_load_n(&jiffies, __ATOMIC_RELAXED) * CLOCK_TICK_DIVISOR;
+}
+
+// mult, shift & rating are filled in by clocksource_init() once present
+static struct clocksource cs_tsc = {"TSC", _tsc_read, CLOCK_MASK_64,
+                                    0, 0, 0, false};
+static struct clocksource cs_hpet = {"HPET", _hpet_read, 0xFFFFFFFF,
+                                     0, 0, 0, true};
+static struct clocksource cs_acpi_pm = {"ACPI PM", _acpi_pm_read, 0xFFFFFF,
+                                        0, 0, 0, true};
+static struct clocksource cs_jiffies = {"PIT tick", _jiffies_read,
+                                        CLOCK_MASK_64, 0, 0, 0, true};
+
+static struct clocksource* const clocksources[] = {&cs_tsc, &cs_hpet,
+                                                   &cs_acpi_pm, &cs_jiffies};
+#define NUM_CLOCKSOURCES (sizeof(clocksources) / sizeof(clocksources[0]))
+
+static const struct clocksource* cs_current = NULL;
+static u64 cs_base = 0; /* cycles at ktime cs_offset */
+static u64 cs_offset = 0; /* ns when cs_current was picked */
+static u64 cs_last = 0; /* latest extended cycles, see _read_extended() */
+
+/*
+    Largest shift (<= 32) whose mult still fits 32 bits, for a counter
+    ticking freq times per num ns
+*/
+static void _set_freq(struct clocksource* cs, u32 num, u32 freq) {
+    u32 rem;
+    u64 mult = 0;
+    u32 shift = 32;
+    for (; shift > 0; shift--) {
+        mult = div_u64_rem((u64)num << shift, freq, &rem);
+        if (mult <= 0xFFFFFFFF) break;
+    }
+
+    cs->mult = (u32)mult;
+    cs->shift = shift;
+}
+
+u64 clocksource_cycles_to_ns(const struct clocksource* cs, u64 cycles) {
+    return mul_u64_u32_shr(cycles, cs->mult, cs->shift);
+}
+
+/*
+    Widens a counter that wraps to 64 bits: the high bits come from the
+    last value any CPU read, one wrap is added when the low ones went back
+    NOTE: lock-free, the CAS retries with a fresh read if another CPU got
+    in first, so the result never goes backwards. Correct as long as it's
+    read once per wrap (the tick makes sure)
+*/
+static u64 _read_extended(const struct clocksource* cs) {
+    u64 last = __atomic_load_n(&cs_last, __ATOMIC_ACQUIRE);
+    u64 now;
+    do {
+        now = (last & ~cs->mask) | (cs->read() & cs->mask);
+        if (now < last) now += cs->mask + 1;
+    } while (!__atomic_compare_exchange_n(&cs_last, &last, now, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return now;
+}
+
+static u32 _mask_bits(u64 mask) {
+    u32 bits = 0;
+    for (; mask != 0; mask >>= 1) bits++;
+    return bits;
+}
+
+static u64 _read_cycles(const struct clocksource* cs) {
+    return (cs->mask == CLOCK_MASK_64) ? cs->read() : _read_extended(cs);
+}
+
+// ns since clocksource_init(), 0 before it
+u64 ktime_get_ns() {
+    const struct clocksource* cs = cs_current;
+    if (cs == NULL) return 0;
+
+    u64 cycles = _read_cycles(cs);
+    return cs_offset + mul_u64_u32_shr(cycles - cs_base, cs->mult, cs->shift);
+}
+
+/*
+    Switches ktime_get_ns() to the highest rated source, carrying the time
+    over so it doesn't jump back
+    NOTE: only while no other CPU reads the clock
+*/
+static const struct clocksource* _select() {
+    const struct clocksource* best = &cs_jiffies;
+    for (size_t i = 0; i < NUM_CLOCKSOURCES; i++) {
+        if (clocksources[i]->rating > best->rating) best = clocksources[i];
+    }
+    if (best == cs_current) return best;
+
+    cs_offset = ktime_get_ns();
+    cs_last = best->read() & best->mask;
+    cs_base = cs_last;
+    __atomic_store_n(&cs_current, best, __ATOMIC_RELEASE);
+    return best;
+}
+
+static void _hpet_probe() {
+    if (!acpi_info.has_hpet) return;
+
+    hpet_regs = ioremap(acpi_info.hpet_addr, PAGE_SIZE, MEM_UC);
+    if (hpet_regs == NULL) return;
+
+    u32 period = hpet_regs[HPET_REG_PERIOD >> 2];
+    if (period == 0 || period > HPET_MAX_PERIOD_FS) {
+        klog(KLOG_WARNING, "Clock: HPET period of %u fs is bogus\n", period);
+        iounmap((void*)hpet_regs);
+        hpet_regs = NULL;
+        return;
+    }
+
+    hpet_regs[HPET_REG_CONFIG >> 2] |= HPET_CONFIG_ENABLE;
+
+    // Hz = 10^15 / period
+    u32 rem;
+    u32 hz = (u32)div_u64_rem(1000000000000000ULL, period, &rem);
+    _set_freq(&cs_hpet, NSEC_PER_SEC, hz);
+    cs_hpet.rating = CLOCK_RATING_HPET;
+}
+
+static void _acpi_pm_probe() {
+    if (acpi_info.pm_timer_port == 0) return;
+
+    if (acpi_info.pm_timer_32bit) cs_acpi_pm.mask = 0xFFFFFFFF;
+    _set_freq(&cs_acpi_pm, NSEC_PER_SEC, ACPI_PM_TIMER_HZ);
+    cs_acpi_pm.rating = CLOCK_RATING_ACPI_PM;
+}
+
+/*
+    Finds the counters, measures the TSC against the best fixed rate one
+    (delay_init()) & picks the highest rated source for ktime_get_ns()
+    - The TSC only wins when it's invariant, else its rate follows the
+      P-state & it stops in deep C-states
+    NOTE: interrupts off, after acpi_init() & vm_init(), before smp_init()
+*/
+void clocksource_init() {
+    _hpet_probe();
+    _acpi_pm_probe();
+
+    const struct clocksource* ref = NULL;
+    if (cs_hpet.rating != 0) {
+        ref = &cs_hpet;
+    } else if (cs_acpi_pm.rating != 0) {
+        ref = &cs_acpi_pm;
+    }
+    delay_init(ref);
+
+    u32 khz = tsc_get_khz();
+    if (khz != 0) {
+        _set_freq(&cs_tsc, NSEC_PER_MSEC, khz);
+        cs_tsc.rating = cpu_has(X86_FEATURE_INVARIANT_TSC)
+                            ? CLOCK_RATING_TSC
+                            : CLOCK_RATING_TSC_UNSTABLE;
+    }
+    _set_freq(&cs_jiffies, NSEC_PER_SEC, PIT_HZ);
+    cs_jiffies.rating = CLOCK_RATING_JIFFIES;
+
+    const struct clocksource* best = _select();
+    klog(KLOG_INFO, "Clock: %s, rating %u\n", best->name, best->rating);
+    if (khz != 0 && best != &cs_tsc)
+        klog(KLOG_WARNING, "Clock: TSC isn't invariant, not used\n");
+}
+
+/*
+    The TSCs aren't in step across CPUs (smp_init() saw one go back), so a
+    time read on one CPU may be behind one read before on another: rated
+    below every other source & dropped if it was the current one
+    NOTE: before the APs read the clock & clock_tick_init()
+*/
+void clocksource_mark_tsc_unsynced() {
+    if (cs_tsc.rating == 0) return;
+
+    cs_tsc.rating = CLOCK_RATING_TSC_UNSYNCED;
+    bool was_current = (cs_current == &cs_tsc);
+    const struct clocksource* best = _select();
+    klog(KLOG_WARNING, "Clock: TSCs out of sync between CPUs%s%s\n",
+         was_current ? ", now using " : "", was_current ? best->name : "");
+}
+
+static void _tick_handler(struct int_frame* frame, void* data) {
+    (void)frame;
+    (void)data;
+
+    if (cs_current == &cs_jiffies) {
+        __atomic_fetch_add(&jiffies, 1, __ATOMIC_RELAXED);
+    } else {
+        ktime_get_ns(); /* folds a wrap in */
+    }
+}
+
+/*
+    Starts the PIT at CLOCK_TICK_HZ if the clock needs it: to count at all
+    (PIT tick), or to be read once per wrap (HPET wraps in ~5 min, the
+    24-bit PM timer in ~4.7 s). An invariant TSC runs tickless
+    NOTE: after apic_init() & smp_init(), IRQ 0 goes to any CPU
+*/
+void clock_tick_init() {
+    if (cs_current == NULL || !cs_current->needs_tick) return;
+
+    outb(PIT_CMD, PIT_CH0_PERIODIC);
+    outb(PIT_CH0_DATA, CLOCK_TICK_DIVISOR & 0xFF);
+    outb(PIT_CH0_DATA, CLOCK_TICK_DIVISOR >> 8);
+    if (!request_irq(PIT_IRQ, _tick_handler, "clock tick", NULL))
+        klog(KLOG_WARNING, "Clock: no PIT tick, %s may wrap unseen\n",
+             cs_current->name);
+}
+
+const struct clocksource* clocksource_get() { return cs_current; }
+
+void clocksource_print_info() {
+    if (cs_current == NULL) {
+        kprintf("Clock: not initialized\n");
+        return;
+    }
+
+    u32 rem;
+    u64 now = ktime_get_ns();
+    u64 sec = div_u64_rem(now, NSEC_PER_SEC, &rem);
+    kprintf("Clock: %s, up %llu.%06u s\n", cs_current->name, sec,
+            rem / NSEC_PER_USEC);
+
+    for (size_t i = 0; i < NUM_CLOCKSOURCES; i++) {
+        const struct clocksource* cs = clocksources[i];
+        if (cs->rating == 0) continue;
+        kprintf("  %-9s rating %3u, %2u bits, mult %u >> %u%s\n", cs->name,
+                cs->rating, _mask_bits(cs->mask), cs->mult, cs->shift,
+                (cs == cs_current) ? " (current)" : "");
+    }
+
+    if (!cpu_has(X86_FEATURE_TSC)) return;
+
+    u64 start = rdtsc();
+    for (int i = 0; i < KTIME_COST_RUNS; i++) ktime_get_ns();
+    u32 cycles = (u32)(rdtsc() - start);
+    kprintf("ktime_get_ns(): %u cycles\n", cycles / KTIME_COST_RUNS);
+}
@@ -0,0 +1,293 @@
+#include <arch/i386/acpi.h>
+#include <arch/i386/cpu_topology.h>
+#include <arch/i386/cpuid_info.h>
+#include <early_kprintf.h>
+#include <lib/string.h>
+
+struct cpu_topology cpu_topo = {};
+
+static const char* cache_type_names[] = {"", "d", "i", ""};
+
+/*
+    Leaf 2 descriptor bytes (Intel SDM table 3-12), only the cache ones
+    CPUs without leaf 4 actually report
+*/
+static const struct {
+    u8 desc;
+    u8 level;
+    u8 type;
+    u8 ways;
+    u16 line_size;
+    u16 size_kb;
+} legacy_caches[] = {
+    {0x06, 1, CACHE_INST, 4, 32, 8},
+    {0x08, 1, CACHE_INST, 4, 32, 16},
+    {0x09, 1, CACHE_INST, 4, 64, 32},
+    {0x0A, 1, CACHE_DATA, 2, 32, 8},
+    {0x0C, 1, CACHE_DATA, 4, 32, 16},
+    {0x0D, 1, CACHE_DATA, 4, 64, 16},
+    {0x2C, 1, CACHE_DATA, 8, 64, 32},
+    {0x30, 1, CACHE_INST, 8, 64, 32},
+    {0x41, 2, CACHE_UNIFIED, 4, 32, 128},
+    {0x42, 2, CACHE_UNIFIED, 4, 32, 256},
+    {0x43, 2, CACHE_UNIFIED, 4, 32, 512},
+    {0x44, 2, CACHE_UNIFIED, 4, 32, 1024},
+    {0x45, 2, CACHE_UNIFIED, 4, 32, 2048},
+    {0x48, 2, CACHE_UNIFIED, 12, 64, 3072},
+    {0x4E, 2, CACHE_UNIFIED, 24, 64, 6144},
+    {0x7D, 2, CACHE_UNIFIED, 8, 64, 2048},
+    {0x7F, 2, CACHE_UNIFIED, 2, 64, 512},
+    {0x80, 2, CACHE_UNIFIED, 8, 64, 512},
+    {0x82, 2, CACHE_UNIFIED, 8, 32, 256},
+    {0x83, 2, CACHE_UNIFIED, 8, 32, 512},
+    {0x84, 2, CACHE_UNIFIED, 8, 32, 1024},
+    {0x85, 2, CACHE_UNIFIED, 8, 32, 2048},
+    {0x86, 2, CACHE_UNIFIED, 4, 64, 512},
+    {0x87, 2, CACHE_UNIFIED, 8, 64, 1024},
+    {0x22, 3, CACHE_UNIFIED, 4, 64, 512},
+    {0x23, 3, CACHE_UNIFIED, 8, 64, 1024},
+    {0x25, 3, CACHE_UNIFIED, 8, 64, 2048},
+    {0x29, 3, CACHE_UNIFIED, 8, 64, 4096},
+    {0x46, 3, CACHE_UNIFIED, 4, 64, 4096},
+    {0x47, 3, CACHE_UNIFIED, 8, 64, 8192},
+    {0x4A, 3, CACHE_UNIFIED, 12, 64, 6144},
+    {0x4B, 3, CACHE_UNIFIED, 16, 64, 8192},
+    {0x4C, 3, CACHE_UNIFIED, 12, 64, 12288},
+    {0x4D, 3, CACHE_UNIFIED, 16, 64, 16384},
+    {0xD0, 3, CACHE_UNIFIED, 4, 64, 512},
+    {0xD1, 3, CACHE_UNIFIED, 4, 64, 1024},
+    {0xD2, 3, CACHE_UNIFIED, 4, 64, 2048},
+    {0xD6, 3, CACHE_UNIFIED, 8, 64, 1024},
+    {0xD7, 3, CACHE_UNIFIED, 8, 64, 2048},
+    {0xD8, 3, CACHE_UNIFIED, 8, 64, 4096},
+    {0xDC, 3, CACHE_UNIFIED, 12, 64, 1536},
+    {0xDD, 3, CACHE_UNIFIED, 12, 64, 3072},
+    {0xDE, 3, CACHE_UNIFIED, 12, 64, 6144},
+    {0xE2, 3, CACHE_UNIFIED, 16, 64, 2048},
+    {0xE3, 3, CACHE_UNIFIED, 16, 64, 4096},
+    {0xE4, 3, CACHE_UNIFIED, 16, 64, 8192},
+    {0xEA, 3, CACHE_UNIFIED, 24, 64, 12288},
+    {0xEB, 3, CACHE_UNIFIED, 24, 64, 18432},
+    {0xEC, 3, CACHE_UNIFIED, 24, 64, 24576},
+};
+
+#define NUM_LEGACY_CACHES (sizeof(legacy_caches) / sizeof(legacy_caches[0]))
+
+// 0x80000006 associativity field to ways (0 = disabled)
+static const u16 amd_l2_ways[16] = {
+    0,  1,  2,  3,  4,   6,   8,   0, 16, 0,
+    32, 48, 64, 96, 128, CACHE_FULLY_ASSOC,
+};
+
+static void _add_cache(u8 level, u8 type, u16 ways, u16 line_size,
+                       u32 size, u16 shared_by) {
+    if (size == 0 || cpu_topo.num_caches >= CPU_MAX_CACHES) return;
+
+    struct cpu_cache* cache = &cpu_topo.caches[cpu_topo.num_caches++];
+    cache->level = level;
+    cache->type = type;
+    cache->ways = ways;
+    cache->line_size = line_size;
+    cache->shared_by = shared_by;
+    cache->size = size;
+    cache->sets = (ways == 0 || ways == CACHE_FULLY_ASSOC || line_size == 0)
+                      ? 1
+                      : size / (ways * line_size);
+}
+
+/*
+    Deterministic cache parameters, one subleaf per cache until a null
+    one (same layout in Intel leaf 4 & AMD 0x8000001D)
+*/
+static void _read_cache_params(u32 leaf) {
+    for (u32 i = 0; i < CPU_MAX_CACHES; i++) {
+        u32 eax = 0, ebx = 0, ecx = 0, edx = 0;
+        __cpuid_count(leaf, i, eax, ebx, ecx, edx);
+
+        u8 type = eax & 0x1F;
+        if (type == CACHE_NONE) break;
+        if (type > CACHE_UNIFIED) continue;
+
+        u16 ways = ((ebx >> 22) & 0x3FF) + 1;
+        u16 partitions = ((ebx >> 12) & 0x3FF) + 1;
+        u16 line_size = (ebx & 0xFFF) + 1;
+        u32 sets = ecx + 1;
+        if (eax & (1 << 9)) ways = CACHE_FULLY_ASSOC;
+
+        u32 size = ((ebx >> 22) + 1) * partitions * line_size * sets;
+        _add_cache((eax >> 5) & 0x7, type, ways, line_size, size,
+                   ((eax >> 14) & 0xFFF) + 1);
+    }
+}
+
+// AMD before TOPOEXT: L1 in 0x80000005, L2 & L3 in 0x80000006
+static void _read_amd_caches() {
+    u32 eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (boot_cpu.max_ext_leaf >= CPUID_EXT_L1_CACHE) {
+        __cpuid(CPUID_EXT_L1_CACHE, eax, ebx, ecx, edx);
+        _add_cache(1, CACHE_DATA, (ecx >> 16) & 0xFF, ecx & 0xFF,
+                   (ecx >> 24) << 10, 0);
+        _add_cache(1, CACHE_INST, (edx >> 16) & 0xFF, edx & 0xFF,
+                   (edx >> 24) << 10, 0);
+    }
+
+    if (boot_cpu.max_ext_leaf >= CPUID_EXT_L2_CACHE) {
+        __cpuid(CPUID_EXT_L2_CACHE, eax, ebx, ecx, edx);
+        _add_cache(2, CACHE_UNIFIED, amd_l2_ways[(ecx >> 12) & 0xF],
+                   ecx & 0xFF, (ecx >> 16) << 10, 0);
+        _add_cache(3, CACHE_UNIFIED, amd_l2_ways[(edx >> 12) & 0xF],
+                   edx & 0xFF, (edx >> 18) << 19, 0);
+    }
+}
+
+static void _add_legacy_desc(u8 desc) {
+    for (size_t i = 0; i < NUM_LEGACY_CACHES; i++) {
+        if (legacy_caches[i].desc != desc) continue;
+
+        _add_cache(legacy_caches[i].level, legacy_caches[i].type,
+                   legacy_caches[i].ways, legacy_caches[i].line_size,
+                   legacy_caches[i].size_kb << 10, 0);
+        return;
+    }
+}
+
+// Leaf 2: up to 15 descriptor bytes, a register with bit 31 set is empty
+static void _read_legacy_caches() {
+    u32 regs[4] = {0};
+    __cpuid(CPUID_LEGACY_CACHE, regs[0], regs[1], regs[2], regs[3]);
+
+    regs[0] &= ~0xFFu; /* al is the iteration count, always 1 */
+    for (int i = 0; i < 4; i++) {
+        if (regs[i] & (1u << 31)) continue;
+        for (int byte = 0; byte < 4; byte++)
+            _add_legacy_desc((regs[i] >> (byte * 8)) & 0xFF);
+    }
+}
+
+static void _read_caches() {
+    bool has_leaf4 = boot_cpu.max_leaf >= CPUID_CACHE_PARAMS;
+    if (cpu_has(X86_FEATURE_TOPOEXT) &&
+        boot_cpu.max_ext_leaf >= CPUID_EXT_CACHE_PARAMS) {
+        _read_cache_params(CPUID_EXT_CACHE_PARAMS);
+    } else if (has_leaf4) {
+        _read_cache_params(CPUID_CACHE_PARAMS);
+    }
+
+    if (cpu_topo.num_caches != 0) return;
+
+    if (strcmp(boot_cpu.vendor, CPU_VENDOR_INTEL) != 0) {
+        _read_amd_caches();
+    } else if (boot_cpu.max_leaf >= CPUID_LEGACY_CACHE) {
+        _read_legacy_caches();
+    }
+}
+
+// Leaf 0xB: logical CPUs at the SMT level & at the core level (package)
+static bool _read_ext_topology() {
+    if (boot_cpu.max_leaf < CPUID_EXT_TOPOLOGY) return false;
+
+    u32 threads = 0, logical = 0;
+    for (u32 i = 0; i < TOPO_MAX_LEVELS; i++) {
+        u32 eax = 0, ebx = 0, ecx = 0, edx = 0;
+        __cpuid_count(CPUID_EXT_TOPOLOGY, i, eax, ebx, ecx, edx);
+
+        u8 level = (ecx >> 8) & 0xFF;
+        if (level == TOPO_LEVEL_INVALID || (ebx & 0xFFFF) == 0) break;
+        if (level == TOPO_LEVEL_SMT) threads = ebx & 0xFFFF;
+        if (level == TOPO_LEVEL_CORE) logical = ebx & 0xFFFF;
+        cpu_topo.apic_id = edx;
+    }
+
+    if (threads == 0 || logical == 0) return false;
+    cpu_topo.threads_per_core = threads;
+    cpu_topo.cores_per_package = logical / threads;
+    return true;
+}
+
+/*
+    Older CPUs: leaf 1 gives logical CPUs per package (with HTT), cores
+    per package come from leaf 4 (Intel) or 0x80000008 (AMD)
+*/
+static void _read_legacy_topology() {
+    u32 eax = 0, ebx = 0, ecx = 0, edx = 0;
+    u32 logical = cpu_has(X86_FEATURE_HTT) ? (boot_cpu.misc >> 16) & 0xFF : 1;
+    u32 cores = 1;
+
+    if (boot_cpu.max_leaf >= CPUID_CACHE_PARAMS) {
+        __cpuid_count(CPUID_CACHE_PARAMS, 0, eax, ebx, ecx, edx);
+        if ((eax & 0x1F) != CACHE_NONE) cores = (eax >> 26) + 1;
+    }
+    if (cores == 1 && boot_cpu.max_ext_leaf >= CPUID_EXT_ADDR_SIZE) {
+        __cpuid(CPUID_EXT_ADDR_SIZE, eax, ebx, ecx, edx);
+        cores = (ecx & 0xFF) + 1;
+    }
+
+    if (logical < cores) logical = cores;
+    cpu_topo.cores_per_package = cores;
+    cpu_topo.threads_per_core = logical / cores;
+    cpu_topo.apic_id = boot_cpu.misc >> 24;
+}
+
+// NOTE: after cpuid_init()
+void cpu_topology_init() {
+    cpu_topo.packages = 1;
+    if (!_read_ext_topology()) _read_legacy_topology();
+    _read_caches();
+
+    // CLFLUSH line size (leaf 1 ebx[15:8], in 8 B units) is the fallback
+    const struct cpu_cache* l1d = cpu_find_cache(1, CACHE_DATA);
+    u32 clflush = ((boot_cpu.misc >> 8) & 0xFF) * 8;
+    if (l1d != NULL && l1d->line_size != 0)
+        cpu_topo.cache_line = l1d->line_size;
+    else if (clflush != 0)
+        cpu_topo.cache_line = clflush;
+    else
+        cpu_topo.cache_line = CACHE_DEFAULT_LINE;
+}
+
+/*
+    Enabled CPUs in the MADT over the logical CPUs in one package, rounded
+    up as firmware can disable threads the CPUID counts still include
+    NOTE: after acpi_init()
+*/
+void cpu_topology_count_packages() {
+    u32 per_package = cpu_topo.cores_per_package * cpu_topo.threads_per_core;
+    if (!acpi_info.has_madt || acpi_info.num_cpus == 0 || per_package == 0)
+        return;
+
+    cpu_topo.packages = (acpi_info.num_cpus + per_package - 1) / per_package;
+}
+
+// Unified caches also match a data or instruction lookup
+const struct cpu_cache* cpu_find_cache(u8 level, u8 type) {
+    for (size_t i = 0; i < cpu_topo.num_caches; i++) {
+        const struct cpu_cache* cache = &cpu_topo.caches[i];
+        if (cache->level == level &&
+            (cache->type == type || cache->type == CACHE_UNIFIED))
+            return cache;
+    }
+
+    return NULL;
+}
+
+void cpu_print_topology() {
+    kprintf(
+        "Topology: %u package(s), %u core(s)/package, %u thread(s)/core, "
+        "APIC id %u\nCache line: %u B\n",
+        cpu_topo.packages, cpu_topo.cores_per_package,
+        cpu_topo.threads_per_core, cpu_topo.apic_id, cpu_topo.cache_line);
+
+    for (size_t i = 0; i < cpu_topo.num_caches; i++) {
+        const struct cpu_cache* cache = &cpu_topo.caches[i];
+        kprintf("L%u%s: %u KiB, ", cache->level,
+                cache_type_names[cache->type], cache->size >> 10);
+        if (cache->ways == CACHE_FULLY_ASSOC)
+            kputs("fully associative");
+        else
+            kprintf("%u-way", cache->ways);
+        kprintf(", %u B lines, %u sets", cache->line_size, cache->sets);
+        if (cache->shared_by != 0)
+            kprintf(", shared by %u", cache->shared_by);
+        kputs("\n");
+    }
+}
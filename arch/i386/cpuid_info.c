@@ -1,35 +1,139 @@
 #include <arch/i386/cpuid_info.h>
+#include <early_kprintf.h>
 #include <lib/string.h>
 
-void get_cpu_vendor(char* str) {
-    uint32_t unused = 0, ebx = 0, ecx = 0, edx = 0;
-    bool success = __get_cpuid(CPUID_VENDOR, &unused, &ebx, &ecx, &edx);
-    str[0] = '\0';
-    if (!success) return;
+struct cpu_info boot_cpu = {};
 
-    char* ptr = (char*)&ebx;
-    strncat(str, ptr, 4);
+static const struct {
+    u32 feature;
+    const char* name;
+} feature_names[] = {
+    {X86_FEATURE_FPU, "fpu"},
+    {X86_FEATURE_PSE, "pse"},
+    {X86_FEATURE_TSC, "tsc"},
+    {X86_FEATURE_MSR, "msr"},
+    {X86_FEATURE_PAE, "pae"},
+    {X86_FEATURE_CX8, "cx8"},
+    {X86_FEATURE_APIC, "apic"},
+    {X86_FEATURE_SYSENTER, "sep"},
+    {X86_FEATURE_PGE, "pge"},
+    {X86_FEATURE_CMOV, "cmov"},
+    {X86_FEATURE_PAT, "pat"},
+    {X86_FEATURE_PSE36, "pse36"},
+    {X86_FEATURE_CLFLUSH, "clflush"},
+    {X86_FEATURE_MMX, "mmx"},
+    {X86_FEATURE_FXSR, "fxsr"},
+    {X86_FEATURE_SSE, "sse"},
+    {X86_FEATURE_SSE2, "sse2"},
+    {X86_FEATURE_HTT, "ht"},
+    {X86_FEATURE_SSE3, "sse3"},
+    {X86_FEATURE_PCLMUL, "pclmul"},
+    {X86_FEATURE_MONITOR, "monitor"},
+    {X86_FEATURE_SSSE3, "ssse3"},
+    {X86_FEATURE_FMA, "fma"},
+    {X86_FEATURE_CX16, "cx16"},
+    {X86_FEATURE_SSE4_1, "sse4_1"},
+    {X86_FEATURE_SSE4_2, "sse4_2"},
+    {X86_FEATURE_X2APIC, "x2apic"},
+    {X86_FEATURE_MOVBE, "movbe"},
+    {X86_FEATURE_POPCNT, "popcnt"},
+    {X86_FEATURE_TSC_DEADLINE, "tsc_deadline"},
+    {X86_FEATURE_AES, "aes"},
+    {X86_FEATURE_XSAVE, "xsave"},
+    {X86_FEATURE_OSXSAVE, "osxsave"},
+    {X86_FEATURE_AVX, "avx"},
+    {X86_FEATURE_F16C, "f16c"},
+    {X86_FEATURE_RDRAND, "rdrand"},
+    {X86_FEATURE_HYPERVISOR, "hypervisor"},
+    {X86_FEATURE_FSGSBASE, "fsgsbase"},
+    {X86_FEATURE_BMI1, "bmi1"},
+    {X86_FEATURE_AVX2, "avx2"},
+    {X86_FEATURE_SMEP, "smep"},
+    {X86_FEATURE_BMI2, "bmi2"},
+    {X86_FEATURE_ERMS, "erms"},
+    {X86_FEATURE_INVPCID, "invpcid"},
+    {X86_FEATURE_AVX512F, "avx512f"},
+    {X86_FEATURE_RDSEED, "rdseed"},
+    {X86_FEATURE_SMAP, "smap"},
+    {X86_FEATURE_CLFLUSHOPT, "clflushopt"},
+    {X86_FEATURE_SHA, "sha_ni"},
+    {X86_FEATURE_UMIP, "umip"},
+    {X86_FEATURE_FSRM, "fsrm"},
+    {X86_FEATURE_SYSCALL, "syscall"},
+    {X86_FEATURE_NX, "nx"},
+    {X86_FEATURE_PDPE1GB, "pdpe1gb"},
+    {X86_FEATURE_RDTSCP, "rdtscp"},
+    {X86_FEATURE_LM, "lm"},
+    {X86_FEATURE_LZCNT, "lzcnt"},
+    {X86_FEATURE_TOPOEXT, "topoext"},
+    {X86_FEATURE_INVARIANT_TSC, "invariant_tsc"},
+};
 
-    ptr = (char*)&edx;
-    strncat(str, ptr, 4);
+#define NUM_FEATURE_NAMES (sizeof(feature_names) / sizeof(feature_names[0]))
 
-    ptr = (char*)&ecx;
-    strncat(str, ptr, 4);
-}
+/*
+    Reads the vendor & feature leaves into boot_cpu, leaves past the
+    reported maximum stay zero
+    NOTE: runs first thing in arch_kmain, before anything tests features
+*/
+void cpuid_init() {
+    u32 eax = 0, ebx = 0, ecx = 0, edx = 0;
+    u32* words = boot_cpu.words;
+
+    __cpuid(CPUID_VENDOR, eax, ebx, ecx, edx);
+    boot_cpu.max_leaf = eax;
+    memcpy(&boot_cpu.vendor[0], &ebx, 4);
+    memcpy(&boot_cpu.vendor[4], &edx, 4);
+    memcpy(&boot_cpu.vendor[8], &ecx, 4);
+    boot_cpu.vendor[CPU_VENDOR_LEN] = '\0';
+
+    if (boot_cpu.max_leaf >= CPUID_FEATURES) {
+        __cpuid(CPUID_FEATURES, eax, ebx, ecx, edx);
+        boot_cpu.signature = eax;
+        boot_cpu.misc = ebx;
+        words[CPUID_1_ECX] = ecx;
+        words[CPUID_1_EDX] = edx;
+    }
 
-uint32_t get_cpu_model() {
-    uint32_t unused = 0, eax = 0;
-    bool success = __get_cpuid(CPUID_FEATURES, &eax, &unused, &unused, &unused);
-    if (!success) return 0;
+    if (boot_cpu.max_leaf >= CPUID_STRUCT_FEATURES) {
+        __cpuid_count(CPUID_STRUCT_FEATURES, 0, eax, ebx, ecx, edx);
+        words[CPUID_7_EBX] = ebx;
+        words[CPUID_7_ECX] = ecx;
+        words[CPUID_7_EDX] = edx;
+    }
 
-    return eax;
+    __cpuid(CPUID_EXT_MAX, eax, ebx, ecx, edx);
+    boot_cpu.max_ext_leaf = (eax & CPUID_EXT_MAX) ? eax : 0;
+
+    if (boot_cpu.max_ext_leaf >= CPUID_EXT_FEATURES) {
+        __cpuid(CPUID_EXT_FEATURES, eax, ebx, ecx, edx);
+        words[CPUID_EXT1_ECX] = ecx;
+        words[CPUID_EXT1_EDX] = edx;
+    }
+
+    if (boot_cpu.max_ext_leaf >= CPUID_EXT_POWER) {
+        __cpuid(CPUID_EXT_POWER, eax, ebx, ecx, edx);
+        words[CPUID_EXT7_EDX] = edx;
+    }
 }
 
-CPUID_TEST(PSE);
-CPUID_TEST(MSR);
-CPUID_TEST(PAE);
-CPUID_TEST(APIC);
-CPUID_TEST(SYSENTER);
-CPUID_TEST(PGE);
-CPUID_TEST(PAT);
-CPUID_TEST(PSE36);
+const struct cpu_impl* cpu_select(const struct cpu_impl* impls) {
+    while (!cpu_has(impls->feature)) impls++;
+    return impls;
+}
+
+void get_cpu_vendor(char* str) { strcpy(str, boot_cpu.vendor); }
+
+u32 get_cpu_model() { return boot_cpu.signature; }
+
+void cpu_print_features() {
+    kprintf("CPU: %s, signature 0x%08X, max leaf 0x%X / 0x%X\nFlags:",
+            boot_cpu.vendor, boot_cpu.signature, boot_cpu.max_leaf,
+            boot_cpu.max_ext_leaf);
+
+    for (size_t i = 0; i < NUM_FEATURE_NAMES; i++) {
+        if (cpu_has(feature_names[i].feature))
+            kprintf(" %s", feature_names[i].name);
+    }
+    kputs("\n");
+}
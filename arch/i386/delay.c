@@ -0,0 +1,209 @@
+#include <arch/i386/clocksource.h>
+#include <arch/i386/cpu.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/delay.h>
+#include <io.h>
+#include <klog.h>
+#include <lib/conversion.h>
+
+static u32 tsc_khz = 0; /* 0 until calibrated */
+static u64 cycles_per_us = 0; /* << DELAY_SHIFT */
+static u64 cycles_per_ns = 0; /* << DELAY_SHIFT */
+
+/*
+    TSC cycles for one DELAY_CALIBRATE_MS one-shot of PIT channel 2
+    Returns 0 if the channel output never went high
+    NOTE: interrupts off, port 0x61 is restored
+*/
+static u64 _pit_measure() {
+    u16 ticks = DELAY_CALIBRATE_TICKS;
+    u8 ctrl = inb(SYS_CTRL_PORT);
+
+    // Gate on, speaker off, count starts once the high byte is written
+    outb(SYS_CTRL_PORT, (ctrl & ~SYS_CTRL_SPEAKER) | SYS_CTRL_CH2_GATE);
+    outb(PIT_CMD, PIT_CH2_ONESHOT);
+    outb(PIT_CH2_DATA, ticks & 0xFF);
+    outb(PIT_CH2_DATA, ticks >> 8);
+
+    u64 start = rdtsc();
+    u64 cycles = 0;
+    while (!(inb(SYS_CTRL_PORT) & SYS_CTRL_CH2_OUT)) {
+        if (rdtsc() - start > DELAY_CALIBRATE_MAX_CYCLES) break;
+    }
+    if (inb(SYS_CTRL_PORT) & SYS_CTRL_CH2_OUT) cycles = rdtsc() - start;
+
+    outb(SYS_CTRL_PORT, ctrl);
+    return cycles;
+}
+
+static u32 _calibrate_pit() {
+    u64 best = 0;
+    for (int i = 0; i < DELAY_CALIBRATE_RUNS; i++) {
+        u64 cycles = _pit_measure();
+        if (cycles == 0) return 0;
+        if (best == 0 || cycles < best) best = cycles;
+    }
+
+    // kHz = cycles / (ticks / PIT_HZ) / 1000
+    u32 rem;
+    return (u32)div_u64_rem(best * PIT_HZ, DELAY_CALIBRATE_TICKS * 1000,
+                            &rem);
+}
+
+/*
+    TSC cycles across DELAY_CALIBRATE_MS of ref, each end bracketed by two
+    rdtsc: the run with the tightest brackets (no SMI or VM exit between
+    the reads) wins
+*/
+static u32 _calibrate_ref(const struct clocksource* ref) {
+    u64 best_cycles = 0, best_ns = 0, best_err = 0;
+    for (int i = 0; i < DELAY_CALIBRATE_RUNS; i++) {
+        u64 t0 = rdtsc();
+        u64 start = ref->read();
+        u64 t1 = rdtsc();
+
+        u64 ns = 0, end = start, t2, t3;
+        do {
+            t2 = rdtsc();
+            end = ref->read();
+            t3 = rdtsc();
+            ns = clocksource_cycles_to_ns(ref, (end - start) & ref->mask);
+        } while (ns < DELAY_CALIBRATE_MS * NSEC_PER_MSEC &&
+                 t3 - t0 < DELAY_CALIBRATE_MAX_CYCLES);
+        if (ns < DELAY_CALIBRATE_MS * NSEC_PER_MSEC) return 0;
+
+        u64 err = (t1 - t0) + (t3 - t2);
+        if (best_ns == 0 || err < best_err) {
+            best_cycles = (t2 + t3) / 2 - (t0 + t1) / 2;
+            best_ns = ns;
+            best_err = err;
+        }
+    }
+
+    // kHz = cycles / ns * 10^6, ns fits 32 bits for a few ms
+    u32 rem;
+    return (u32)div_u64_rem(best_cycles * NSEC_PER_MSEC, (u32)best_ns, &rem);
+}
+
+static u32 _calibrate_cpuid() {
+    if (boot_cpu.max_leaf < CPUID_FREQ_INFO) return 0;
+
+    u32 eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __cpuid(CPUID_FREQ_INFO, eax, ebx, ecx, edx);
+    return (eax & 0xFFFF) * 1000;
+}
+
+/*
+    Measures the TSC against ref (NULL for none)
+    NOTE: interrupts off, before any driver waits on hardware
+*/
+void delay_init(const struct clocksource* ref) {
+    if (!cpu_has(X86_FEATURE_TSC)) {
+        klog(KLOG_WARNING, "Delay: no TSC, using io_wait() steps\n");
+        return;
+    }
+
+    const char* source = (ref != NULL) ? ref->name : "PIT";
+    u32 khz = (ref != NULL) ? _calibrate_ref(ref) : 0;
+    if (khz == 0) {
+        source = "PIT";
+        khz = _calibrate_pit();
+    }
+    if (khz == 0) {
+        source = "CPUID";
+        khz = _calibrate_cpuid();
+    }
+    if (khz == 0) {
+        klog(KLOG_WARNING, "Delay: TSC calibration failed\n");
+        return;
+    }
+
+    u32 rem;
+    cycles_per_us = div_u64_rem((u64)khz << DELAY_SHIFT, 1000, &rem);
+    cycles_per_ns = div_u64_rem((u64)khz << DELAY_SHIFT, 1000000, &rem);
+    tsc_khz = khz;
+
+    klog(KLOG_INFO, "Delay: TSC at %u.%03u MHz (%s)%s\n", khz / 1000,
+         khz % 1000, source,
+         cpu_has(X86_FEATURE_INVARIANT_TSC) ? ", invariant" : "");
+}
+
+u32 tsc_get_khz() { return tsc_khz; }
+
+u64 us_to_cycles(u32 us) { return (us * cycles_per_us) >> DELAY_SHIFT; }
+
+// 0 when the TSC isn't calibrated
+u64 tsc_to_us(u64 cycles) {
+    if (tsc_khz == 0) return 0;
+
+    u32 rem;
+    u64 ms = div_u64_rem(cycles, tsc_khz, &rem);
+    return ms * 1000 + div_u64_rem((u64)rem * 1000, tsc_khz, &rem);
+}
+
+static void _spin_cycles(u64 cycles) {
+    u64 start = rdtsc();
+    while (rdtsc() - start < cycles) cpu_relax();
+}
+
+void udelay(u32 us) {
+    if (tsc_khz == 0) {
+        while (us-- > 0) io_wait();
+        return;
+    }
+
+    _spin_cycles(us_to_cycles(us));
+}
+
+void ndelay(u32 ns) {
+    if (tsc_khz == 0) {
+        udelay((ns + 999) / 1000);
+        return;
+    }
+
+    _spin_cycles((ns * cycles_per_ns) >> DELAY_SHIFT);
+}
+
+/*
+    Spins until (inb(port) & mask) == value, for at most timeout_us
+    Returns false on timeout
+    NOTE: the register is read once more after the deadline, so being
+    interrupted past it doesn't turn a ready device into a timeout
+*/
+bool poll_until(u16 port, u8 mask, u8 value, u32 timeout_us) {
+    if (tsc_khz == 0) {
+        for (u32 i = 0; i < timeout_us; i++) {
+            if ((inb(port) & mask) == value) return true;
+            io_wait();
+        }
+        return (inb(port) & mask) == value;
+    }
+
+    u64 deadline = rdtsc() + us_to_cycles(timeout_us);
+    while (rdtsc() < deadline) {
+        if ((inb(port) & mask) == value) return true;
+        cpu_relax();
+    }
+
+    return (inb(port) & mask) == value;
+}
+
+// poll_until() for a memory mapped register
+bool poll_until_mmio(volatile u32* reg, u32 mask, u32 value,
+                     u32 timeout_us) {
+    if (tsc_khz == 0) {
+        for (u32 i = 0; i < timeout_us; i++) {
+            if ((*reg & mask) == value) return true;
+            io_wait();
+        }
+        return (*reg & mask) == value;
+    }
+
+    u64 deadline = rdtsc() + us_to_cycles(timeout_us);
+    while (rdtsc() < deadline) {
+        if ((*reg & mask) == value) return true;
+        cpu_relax();
+    }
+
+    return (*reg & mask) == value;
+}
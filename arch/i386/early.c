@@ -1,13 +1,54 @@
+#include <arch/i386/acpi.h>
+#include <arch/i386/apic.h>
+#include <arch/i386/clocksource.h>
+#include <arch/i386/cpu_topology.h>
 #include <arch/i386/cpuid_info.h>
+#include <arch/i386/delay.h>
+#include <arch/i386/fault.h>
+#include <arch/i386/irq.h>
 #include <arch/i386/isr.h>
+#include <arch/i386/pat.h>
+#include <arch/i386/paging.h>
 #include <arch/i386/pic.h>
 #include <arch/i386/ps2.h>
 #include <arch/i386/ps2_keyboard.h>
+#include <arch/i386/serial.h>
+#include <arch/i386/smp.h>
+#include <arch/i386/string_ops.h>
 #include <early_kprintf.h>
+#include <fbcon.h>
 #include <lib/conversion.h>
 #include <main.h>
+#include <mm/arena.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <mm/vm.h>
+#include <mm/zero_pool.h>
 #include <multiboot2_tbl.h>
 
+static void* fb_base = NULL;
+
+/*
+    Maps a linear (pixel) framebuffer write-combining, so blits go out
+    as bursts instead of one uncached write per pixel
+    NOTE: EGA text mode memory is already in the direct map
+*/
+static void _map_fb() {
+    fb_info_st fb = {0};
+    get_fb_info(&fb);
+    if (fb.addr == 0 || fb.type == MB2_FB_EGA) return;
+
+    fb_base = ioremap(fb.addr, fb.pitch * fb.height, MEM_WC);
+    if (fb_base == NULL) {
+        kerror("FB: failed to map the framebuffer!\n");
+        return;
+    }
+
+    fbcon_init(fb_base, &fb);
+}
+
+void* get_fb_base() { return fb_base; }
+
 void print_mmap() {
     mmap_tbl_st mem_tbl;
     get_mmap(&mem_tbl);
@@ -16,43 +57,63 @@ void print_mmap() {
     mmap_entry_st entry;
     for (size_t i = 0; i < mem_tbl.num_entries; i++) {
         entry = mem_tbl.tbl[i];
-        kprintf("[ ENTRY %d ] addr=0x%p, len=0x%p, type=%d\n", i,
-                (size_t)entry.addr, (size_t)entry.len, entry.type);
+        kprintf("[ ENTRY %d ] addr=0x%016llX, len=0x%016llX, type=%d\n", i,
+                entry.addr, entry.len, entry.type);
     }
 }
 
 void print_fb() {
     fb_info_st fb = {0};
     get_fb_info(&fb);
-    kprintf("FB addr: %p, width=%x,height=%x,pitch=%x\n", fb.addr, fb.width,
-            fb.height, fb.pitch);
+
+    kprintf("FB addr: 0x%llX, width=%x,height=%x,pitch=%x\n", fb.addr,
+            fb.width, fb.height, fb.pitch);
+    if (fb_base != NULL)
+        kprintf("FB mapped at %p (%s)\n", fb_base,
+                mem_type_name(pat_enabled() ? MEM_WC : MEM_UC_MINUS));
+    fbcon_print_info();
 }
 
 void print_kernel_info() {
     kprintf("Biosdev: %x, partition: %x\n", get_biosdev(), get_partition());
     kprintf(
-        "Loadaddr: %p\nMem size: 0x%x KB\nBootloader: %s\nKrnl Args: %s\n\n",
+        "Loadaddr: %p\nMem size: %llu KB\nBootloader: %s\nKrnl Args: %s\n\n",
         get_loadaddr(), get_total_mem_kb(), get_bootloader_name(),
         get_cmd_arg());
 }
 
 // Tasks: memory setup, device setup, setup for init task
 void arch_kmain(const void* mb_tbl) {
+    cpuid_init();
+    cpu_topology_init();
     tty_init();
+    string_init();
     mb2_tbl_init(mb_tbl);
+    boot_arena_init();
+    mb2_mods_init();
+    pmm_init();
+    paging_init();
+    pat_init();
+    slab_init();
+    vm_init();
+    zero_pool_init();
+    _map_fb();
+    acpi_init();
+    cpu_topology_count_packages();
 
+    clocksource_init();
+    idt_init();
+    request_vector(VEC_PAGE_FAULT, page_fault_handler, "page fault", NULL);
     pic_init();
+    apic_init();
+    smp_init();
+    clock_tick_init();
     ps2_initiate();
     ps2_keyboard_config();
+    serial_init();
 
-    register_idt_entry(0x2, (u32)&isr_gen_prot_handler, 0, INT_32);
-    register_idt_entry(0xD, (u32)&isr_gen_prot_handler, 0, INT_32);
-    register_idt_entry(0x8, (u32)&isr_gen_prot_handler, 0, INT_32);
-    register_idt_entry(0xE, (u32)&isr_gen_prot_handler, 0, INT_32);
-
-    load_idt();
     enable_int();
-    pic_enable_irq(1);
 
+    boot_arena_release();
     kmain();
 }
\ No newline at end of file
@@ -1,145 +1,48 @@
+#include <console.h>
 #include <early_kprintf.h>
+#include <lib/printf.h>
 
 int kputchar(char c) {
     char str[] = {c, '\0'};
-    return tty_print_string(str);
+    return console_write(str, tty_get_fg());
 }
 
-int kputs(const char* str) { return tty_print_string(str); }
+int kputs(const char* str) { return console_write(str, tty_get_fg()); }
 
-int kprintf(const char* format, ...) {
-    int num_chars = 0;
-    char buff[100] = {'\0'};
-    va_list args;
-    va_start(args, format);
+static void _console_flush(struct fmt_out* out) {
+    console_write(out->buf, tty_get_fg());
+}
 
-    size_t i = 0;
-    char c = format[i];
-    while (c != '\0') {
-        if (c != '%') {
-            num_chars += kputchar(c);
-            c = format[++i];
-            continue;
-        }
+static void _console_error_flush(struct fmt_out* out) {
+    console_write(out->buf, RED);
+}
 
-        i++;
-        c = format[i];
-        if (c == '\0') break;
+// Formats on the stack, consoles get one write per KPRINTF_BUF chars
+static int _kvprintf(void (*flush)(struct fmt_out*), const char* format,
+                     va_list args) {
+    char buf[KPRINTF_BUF];
+    struct fmt_out out = {buf, sizeof(buf), 0, 0, flush, NULL};
+    return vformat(&out, format, args);
+}
 
-        // Format option
-        switch (c) {
-            case 'D':
-            case 'd':
-            case 'I':
-            case 'i':
-                int int_val = va_arg(args, int);
-                num_chars += tty_print_string(itoa(int_val, buff, 10));
-                break;
-            case 'U':
-            case 'u':
-                unsigned int ui_val = va_arg(args, unsigned int);
-                num_chars += tty_print_string(utoa(ui_val, buff, 10));
-                break;
-            case 'X':
-            case 'x':
-                unsigned int hex_val = va_arg(args, unsigned int);
-                num_chars += tty_print_string(utoa(hex_val, buff, 16));
-                break;
-            case 'C':
-            case 'c':
-                char arg_c = va_arg(args, int);
-                num_chars += kputchar(arg_c);
-                break;
-            case 'S':
-            case 's':
-                char* str = va_arg(args, char*);
-                num_chars += tty_print_string(str);
-                break;
-            case 'P':
-            case 'p':
-                void* ptrVal = va_arg(args, void*);
-                num_chars += tty_print_string(to_hex((size_t)ptrVal, buff));
-                break;
-            default:
-                num_chars += kputchar('%');
-                break;
-        }
+int vkprintf(const char* format, va_list args) {
+    return _kvprintf(_console_flush, format, args);
+}
 
-        i++;
-        c = format[i];
-    }
+int kprintf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int num_chars = _kvprintf(_console_flush, format, args);
+    va_end(args);
 
     return num_chars;
 }
 
 int kerror(const char* format, ...) {
-    int num_chars = 0;
-    char buff[100] = {'\0'};
-
     va_list args;
     va_start(args, format);
-
-    COLORS prev_fg = tty_get_fg();
-    tty_set_fg(RED);
-
-    size_t i = 0;
-    char c = format[i];
-    num_chars = 1;
-    while (c != '\0') {
-        if (c != '%') {
-            num_chars += kputchar(c);
-            c = format[++i];
-            continue;
-        }
-
-        i++;
-        c = format[i];
-        if (c == '\0') break;
-
-        // Format option
-        switch (c) {
-            case 'D':
-            case 'd':
-            case 'I':
-            case 'i':
-                int int_val = va_arg(args, int);
-                num_chars += tty_print_string(itoa(int_val, buff, 10));
-                break;
-            case 'U':
-            case 'u':
-                unsigned int ui_val = va_arg(args, unsigned int);
-                num_chars += tty_print_string(utoa(ui_val, buff, 10));
-                break;
-            case 'X':
-            case 'x':
-                unsigned int hex_val = va_arg(args, unsigned int);
-                num_chars += tty_print_string(utoa(hex_val, buff, 16));
-                break;
-            case 'C':
-            case 'c':
-                char arg_c = va_arg(args, int);
-                num_chars += kputchar(arg_c);
-                break;
-            case 'S':
-            case 's':
-                char* str = va_arg(args, char*);
-                num_chars += tty_print_string(str);
-                break;
-            case 'P':
-            case 'p':
-                void* ptrVal = va_arg(args, void*);
-                num_chars += tty_print_string(to_hex((size_t)ptrVal, buff));
-                break;
-            default:
-                num_chars += kputchar('%');
-                break;
-        }
-
-        i++;
-        c = format[i];
-    }
-
-    tty_get_fg(prev_fg);
+    int num_chars = _kvprintf(_console_error_flush, format, args);
+    va_end(args);
 
     return num_chars;
 }
@@ -1,18 +1,67 @@
 #include <early_print.h>
 #include <io.h>
+#include <lib/string.h>
+
+static struct vga_cell shadow[VGA_BUF_ROWS * VGA_MAX_COLS];
+static u32 dirty_rows[(VGA_BUF_ROWS + 31) / 32];
 
 static struct vga_info vga = {};
 
-void disable_cursor() {
-    outb(0x3D4, 0xA);
-    outb(0x3D5, 0x20);
+static void _crtc_write(u8 reg, u8 val) {
+    outb(VGA_CRTC_INDEX, reg);
+    outb(VGA_CRTC_DATA, val);
 }
 
+void disable_cursor() { _crtc_write(CRTC_CURSOR_START, 0x20); }
+
 static inline int _get_offset(int x, int y) {
     int pos = y + x * vga.cols;
     return (pos >= vga.rows * vga.cols) ? vga.rows * vga.cols - 1 : pos;
 }
 
+// Shadow cell at screen offset pos
+static inline struct vga_cell* _cell(int pos) {
+    return &vga.shadow[vga.top * vga.cols + pos];
+}
+
+static inline void _mark_dirty(int row) {
+    int buf_row = vga.top + row;
+    dirty_rows[buf_row / 32] |= 1u << (buf_row % 32);
+}
+
+static void _clear_row(int row) {
+    struct vga_cell blank = {'\0', VGA_COLOR(vga.fg, vga.bg)};
+    struct vga_cell* cell = _cell(row * vga.cols);
+    for (int col = 0; col < vga.cols; col++) cell[col] = blank;
+
+    _mark_dirty(row);
+}
+
+/*
+    Copies dirty rows on screen to text memory, then moves the CRTC start
+    address if the window moved
+    - Dirty rows that scrolled out of view are dropped, they're cleared
+      or rewritten before they can come back
+*/
+static void _sync() {
+    for (int row = 0; row < vga.rows; row++) {
+        int buf_row = vga.top + row;
+        if (!(dirty_rows[buf_row / 32] & (1u << (buf_row % 32)))) continue;
+
+        size_t offset = buf_row * vga.cols;
+        memcpy(&vga.fb[offset], &vga.shadow[offset],
+               vga.cols * sizeof(struct vga_cell));
+    }
+    memset(dirty_rows, 0, sizeof(dirty_rows));
+
+    if (vga.top != vga.shown_top) {
+        u16 start = vga.top * vga.cols;
+        _crtc_write(CRTC_START_HIGH, start >> 8);
+        _crtc_write(CRTC_START_LOW, start & 0xFF);
+        vga.shown_top = vga.top;
+    }
+}
+
 int get_x_pos() { return vga.x; }
 
 int get_y_pos() { return vga.y; }
@@ -25,9 +74,12 @@ void set_pos(int x, int y) {
 void tty_init() {
     disable_cursor();
     vga.fb = (struct vga_cell*)VGA_TEXT_MEM;
+    vga.shadow = shadow;
     vga.x = vga.y = 0;
     vga.rows = 25;
-    vga.cols = 80;
+    vga.cols = VGA_MAX_COLS;
+    vga.top = 0;
+    vga.shown_top = -1;
     vga.fg = WHITE;
     vga.bg = BLACK;
 
@@ -38,97 +90,70 @@ COLORS tty_get_bg() { return vga.bg; }
 COLORS tty_get_fg() { return vga.fg; }
 
 void tty_clear_screen() {
-    for (int i = 0; i < vga.rows * vga.cols; i++) {
-        vga.fb[i].c = '\0';
-        vga.fb[i].color = VGA_COLOR(vga.fg, vga.bg);
-        vga.x = vga.y = 0;
-    }
+    vga.top = 0;
+    for (int row = 0; row < vga.rows; row++) _clear_row(row);
+    vga.x = vga.y = 0;
+
+    _sync();
 }
 
 void tty_scroll_down() {
-    // Shift all contents up a row
-    int pos = vga.cols;
-    while (pos < vga.rows * vga.cols) {
-        vga.fb[pos - vga.cols] = vga.fb[pos];
-        pos++;
+    if (vga.top + vga.rows >= VGA_BUF_ROWS) {
+        // Out of text memory, restart the window at the top
+        memmove(vga.shadow, _cell(vga.cols),
+                (vga.rows - 1) * vga.cols * sizeof(struct vga_cell));
+        vga.top = 0;
+        for (int row = 0; row < vga.rows - 1; row++) _mark_dirty(row);
+    } else {
+        vga.top++;
     }
 
     vga.x = (vga.x > 0) ? vga.x - 1 : 0;
-
-    // Clear last row
-    pos = (vga.rows - 1) * vga.cols;
-    for (int col = 0; col < vga.cols; col++) {
-        vga.fb[pos].c = '\0';
-        vga.fb[pos++].color = VGA_COLOR(vga.fg, vga.bg);
-    }
+    _clear_row(vga.rows - 1);
 }
 
-int tty_put_char(char c) {
-    int pos = _get_offset(vga.x, vga.y);
-    vga.fb[pos].color = VGA_COLOR(vga.fg, vga.bg);
-    vga.fb[pos].c = c;
-    return 1;
-}
+int tty_put_char(char c) { return tty_put_color_char(c, vga.fg); }
 
 int tty_put_color_char(char c, COLORS fg) {
     int pos = _get_offset(vga.x, vga.y);
-    vga.fb[pos].c = c;
-    vga.fb[pos].color = VGA_COLOR(fg, vga.bg);
+    _cell(pos)->c = c;
+    _cell(pos)->color = VGA_COLOR(fg, vga.bg);
+    _mark_dirty(pos / vga.cols);
     return 1;
 }
 
+void tty_flush() { _sync(); }
+
 void tty_set_fg(COLORS fg) { vga.fg = fg; }
 
 void tty_set_bg(COLORS bg) { vga.bg = bg; }
 
 int tty_print_string(const char* str) {
-    size_t i = 0;
-    int pos = _get_offset(vga.x, vga.y);
-    while (str[i] != '\0') {
-        char c = str[i];
-        vga.fb[pos].color = VGA_COLOR(vga.fg, vga.bg);
-        switch (c) {
-            case '\r':
-            case '\n':
-                pos = (pos - pos % vga.cols) + vga.cols;
-                break;
-            case '\t':
-                pos = (pos + 4);
-                break;
-
-            default:
-                vga.fb[pos].c = c;
-                pos++;
-        }
-
-        i++;
-        if (pos >= vga.rows * vga.cols) {
-            tty_scroll_down();
-            pos -= vga.cols;
-        }
-    };
-
-    set_pos(pos / vga.cols, pos % vga.cols);
-    return i;
+    return tty_print_color_string(str, vga.fg);
 }
 
 int tty_print_color_string(const char* str, COLORS fg) {
+    u8 color = VGA_COLOR(fg, vga.bg);
     size_t i = 0;
     int pos = _get_offset(vga.x, vga.y);
     while (str[i] != '\0') {
         char c = str[i];
-        vga.fb[pos].color = VGA_COLOR(fg, vga.bg);
+        _mark_dirty(pos / vga.cols);
+        _cell(pos)->color = color;
         switch (c) {
             case '\r':
             case '\n':
                 pos = (pos - pos % vga.cols) + vga.cols;
                 break;
             case '\t':
-                pos = (pos + 3) & (~3);
+                pos = (pos + 4) & (~3);
+                break;
+            case '\b':
+                if (pos > 0) pos--;
                 break;
 
             default:
-                vga.fb[pos].c = c;
+                _cell(pos)->c = c;
                 pos++;
         }
 
@@ -140,5 +165,6 @@ int tty_print_color_string(const char* str, COLORS fg) {
     };
 
     set_pos(pos / vga.cols, pos % vga.cols);
+    _sync();
     return i;
 }
@@ -0,0 +1,27 @@
+#include <arch/i386/cpu.h>
+#include <arch/i386/fault.h>
+#include <early_kprintf.h>
+#include <mm/vm.h>
+
+/*
+    #PF entry: faults on not-present pages inside lazily reserved regions
+    are resolved by mapping a zeroed frame, anything else is fatal
+*/
+void page_fault_handler(struct int_frame* frame, void* data) {
+    (void)data;
+    size_t addr = read_cr2();
+    u32 err = frame->err_code;
+
+    bool not_present = !(err & (PF_PRESENT | PF_RSVD));
+    if (not_present && vm_handle_fault(addr)) return;
+
+    kerror("PAGE FAULT at %p, eip=%p, err=%x (%s, %s%s)\n", (void*)addr,
+           (void*)frame->eip, err,
+           (err & PF_PRESENT) ? "protection" : "not present",
+           (err & PF_WRITE) ? "write" : "read",
+           (err & PF_FETCH) ? ", fetch" : "");
+
+    // Nothing to return to
+    asm volatile("cli");
+    while (true) asm volatile("hlt");
+}
@@ -0,0 +1,36 @@
+#include <arch/i386/cpu.h>
+#include <arch/i386/idle.h>
+#include <arch/i386/smp.h>
+#include <klog.h>
+#include <mm/zero_pool.h>
+
+static volatile bool halted[MAX_CPUS] = {0};
+
+/*
+    One round of the idle loop: does a bit of background work (printing
+    new log records, zeroing frames), or halts until the next interrupt
+    if there is none
+    - wake (may be NULL) is checked with interrupts off right before hlt,
+      sti only takes effect after the next instruction so an IRQ setting
+      it can't slip in between
+    - An IRQ taken on another CPU can't wake this one by itself, a handler
+      that left it work checks halted & sends a wake IPI (smp_wake_cpu)
+*/
+void cpu_idle(volatile bool* wake) {
+    if (klog_flush() || zero_pool_refill()) return;
+
+    u32 cpu = smp_cpu_id();
+    asm volatile("cli");
+    halted[cpu] = true;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (wake != NULL && *wake) {
+        halted[cpu] = false;
+        asm volatile("sti");
+        return;
+    }
+
+    asm volatile("sti; hlt" ::: "memory");
+    halted[cpu] = false;
+}
+
+bool cpu_halted(u32 cpu) { return halted[cpu]; }
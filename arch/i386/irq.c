@@ -0,0 +1,278 @@
+#include <arch/i386/apic.h>
+#include <arch/i386/cpu.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/delay.h>
+#include <arch/i386/irq.h>
+#include <arch/i386/smp.h>
+#include <early_kprintf.h>
+#include <klog.h>
+#include <lib/conversion.h>
+#include <lib/printf.h>
+
+struct irq_desc {
+    irq_handler_t handler;
+    void* data;
+    const char* name;
+};
+
+struct irq_stat {
+    u64 count;
+    u64 cycles; /* TSC cycles spent in the handler */
+};
+
+static struct irq_desc irq_descs[NUM_VECTORS] = {0};
+static struct irq_stat irq_stats[MAX_CPUS][NUM_VECTORS] = {0};
+static u32 spurious_irqs = 0;
+
+static const struct irq_chip* irq_chip = &pic_chip;
+static u8 irq_affinity[MAX_IRQS] = {0};
+static u32 next_irq_cpu = 0;
+
+static bool stats_tsc = false;
+static u64 stats_start = 0;
+
+static const char* exception_names[NUM_EXCEPTIONS] = {
+    "divide error",
+    "debug",
+    "NMI",
+    "breakpoint",
+    "overflow",
+    "bound range",
+    "invalid opcode",
+    "no FPU",
+    "double fault",
+    "FPU segment overrun",
+    "invalid TSS",
+    "segment not present",
+    "stack fault",
+    "general protection",
+    "page fault",
+    NULL,
+    "x87 FP",
+    "alignment check",
+    "machine check",
+    "SIMD FP",
+    "virtualization",
+    "control protection",
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    "hypervisor injection",
+    "VMM communication",
+    "security",
+    NULL,
+};
+
+static bool _is_irq(u32 vector) {
+    return vector >= IRQ_VECTOR(0) && vector < IRQ_VECTOR(irq_chip->num_irqs);
+}
+
+// Phantom requests, they must not get an EOI
+static bool _is_spurious(u32 vector) {
+    if (_is_irq(vector))
+        return irq_chip->spurious != NULL &&
+               irq_chip->spurious(vector - IRQ_VECTOR(0));
+    return vector == LAPIC_SPURIOUS_VECTOR && lapic_active();
+}
+
+static const char* _vector_name(u32 vector) {
+    if (irq_descs[vector].name != NULL) return irq_descs[vector].name;
+    if (vector < NUM_EXCEPTIONS && exception_names[vector] != NULL)
+        return exception_names[vector];
+    return "-";
+}
+
+/*
+    No handler: exceptions other than NMI are fatal, stray IRQs are only
+    logged (the stats still count them)
+*/
+static void _unhandled(struct int_frame* frame) {
+    u32 vector = frame->vector;
+
+    if (vector >= NUM_EXCEPTIONS || vector == VEC_NMI) {
+        klog(KLOG_WARNING, "IRQ: unhandled vector 0x%x\n", vector);
+        return;
+    }
+
+    kerror("EXCEPTION %u (%s), eip=%p, err=%x, eflags=%x\n", vector,
+           _vector_name(vector), (void*)frame->eip, frame->err_code,
+           frame->eflags);
+
+    // Nothing to return to
+    asm volatile("cli");
+    while (true) asm volatile("hlt");
+}
+
+/*
+    Called by isr_common for every vector
+    NOTE: runs with interrupts off, so the cycles are the handler's own
+*/
+void interrupt_dispatch(struct int_frame* frame) {
+    u32 vector = frame->vector;
+    u64 start = stats_tsc ? rdtsc() : 0;
+    u32 cpu = smp_cpu_id();
+    bool irq = _is_irq(vector);
+
+    if (_is_spurious(vector)) {
+        __atomic_fetch_add(&spurious_irqs, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct irq_desc* desc = &irq_descs[vector];
+    if (desc->handler != NULL)
+        desc->handler(frame, desc->data);
+    else
+        _unhandled(frame);
+
+    if (irq)
+        irq_chip->eoi(vector - IRQ_VECTOR(0));
+    else if (vector >= NUM_EXCEPTIONS && lapic_active())
+        lapic_eoi();
+
+    struct irq_stat* stat = &irq_stats[cpu][vector];
+    stat->count++;
+    if (stats_tsc) stat->cycles += rdtsc() - start;
+}
+
+// Returns false if the vector already has a handler
+bool request_vector(u8 vector, irq_handler_t handler, const char* name,
+                    void* data) {
+    u32 flags = local_irq_save();
+    struct irq_desc* desc = &irq_descs[vector];
+    if (desc->handler != NULL) {
+        local_irq_restore(flags);
+        klog(KLOG_WARNING, "IRQ: vector 0x%x already taken by %s\n", vector,
+             desc->name);
+        return false;
+    }
+
+    desc->data = data;
+    desc->name = name;
+    desc->handler = handler;
+    if (!stats_tsc && cpu_has(X86_FEATURE_TSC)) {
+        stats_tsc = true;
+        stats_start = rdtsc();
+    }
+    local_irq_restore(flags);
+
+    klog(KLOG_DEBUG, "IRQ: vector 0x%x -> %s\n", vector, name);
+    return true;
+}
+
+void free_vector(u8 vector) {
+    u32 flags = local_irq_save();
+    irq_descs[vector].handler = NULL;
+    irq_descs[vector].data = NULL;
+    irq_descs[vector].name = NULL;
+    local_irq_restore(flags);
+}
+
+/*
+    Installs the handler for IRQ irq & unmasks it on cpu (CPU 0 if the
+    controller can't reach it)
+    NOTE: for devices whose input is consumed on one CPU, so the handler
+    doesn't need to wake it
+*/
+bool request_irq_on(u8 irq, u32 cpu, irq_handler_t handler, const char* name,
+                    void* data) {
+    if (irq >= irq_chip->num_irqs) return false;
+    if (!request_vector(IRQ_VECTOR(irq), handler, name, data)) return false;
+
+    if (cpu >= smp_num_cpus() || !irq_chip->enable(irq, cpu)) {
+        cpu = 0;
+        irq_chip->enable(irq, cpu);
+    }
+    irq_affinity[irq] = cpu;
+
+    klog(KLOG_INFO, "IRQ: %u (%s) on CPU %u\n", irq, name, cpu);
+    return true;
+}
+
+// request_irq_on() the next CPU in turn
+bool request_irq(u8 irq, irq_handler_t handler, const char* name, void* data) {
+    return request_irq_on(irq, next_irq_cpu++ % smp_num_cpus(), handler,
+                          name, data);
+}
+
+void free_irq(u8 irq) {
+    if (irq >= irq_chip->num_irqs) return;
+
+    irq_chip->disable(irq);
+    free_vector(IRQ_VECTOR(irq));
+}
+
+// Returns false if irq isn't requested or can't be sent to cpu
+bool irq_set_affinity(u8 irq, u32 cpu) {
+    if (irq >= irq_chip->num_irqs || cpu >= smp_num_cpus()) return false;
+    if (irq_descs[IRQ_VECTOR(irq)].handler == NULL) return false;
+    if (!irq_chip->enable(irq, cpu)) return false;
+
+    irq_affinity[irq] = cpu;
+    return true;
+}
+
+// NOTE: only before the first request_irq(), the old chip keeps its routes
+void irq_set_chip(const struct irq_chip* chip) { irq_chip = chip; }
+
+// part / whole in 0.1% units, the divisor is scaled down to 32 bits
+static u32 _permille(u64 part, u64 whole) {
+    while (whole >> 32) {
+        whole >>= 1;
+        part >>= 1;
+    }
+    if (whole == 0) return 0;
+
+    u32 rem;
+    return (u32)div_u64_rem(part * 1000, (u32)whole, &rem);
+}
+
+void irq_print_stats() {
+    u64 elapsed = stats_tsc ? rdtsc() - stats_start : 0;
+
+    kprintf("IRQs through the %s, %u CPU(s)\n", irq_chip->name,
+            smp_num_cpus());
+    kprintf("%-6s %-20s %3s %10s %12s %8s %6s\n", "Vector", "Name", "CPU",
+            "Count", "Cycles", "Avg", "Time");
+    for (u32 vector = 0; vector < NUM_VECTORS; vector++) {
+        u64 count = 0;
+        u64 cycles = 0;
+        for (u32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+            count += irq_stats[cpu][vector].count;
+            cycles += irq_stats[cpu][vector].cycles;
+        }
+        if (count == 0) continue;
+
+        // Routed IRQs show their target, the rest may hit any CPU
+        char target[4] = "-";
+        if (_is_irq(vector) && irq_descs[vector].handler != NULL)
+            snprintf(target, sizeof(target), "%u",
+                     irq_affinity[vector - IRQ_VECTOR(0)]);
+
+        u32 rem;
+        u32 share = _permille(cycles, elapsed);
+        kprintf("0x%02x   %-20s %3s %10llu %12llu %8llu %3u.%u%%\n", vector,
+                _vector_name(vector), target, count, cycles,
+                div_u64_rem(cycles, (u32)count, &rem), share / 10, share % 10);
+
+        // Per CPU split, only once more than one CPU took the vector
+        u32 cpus = 0;
+        for (u32 cpu = 0; cpu < MAX_CPUS; cpu++)
+            if (irq_stats[cpu][vector].count != 0) cpus++;
+        if (cpus < 2) continue;
+
+        kprintf("      ");
+        for (u32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (irq_stats[cpu][vector].count == 0) continue;
+            kprintf(" cpu%u=%llu/%llu", cpu, irq_stats[cpu][vector].count,
+                    irq_stats[cpu][vector].cycles);
+        }
+        kputs("\n");
+    }
+
+    kprintf("Spurious: %u", spurious_irqs);
+    if (stats_tsc) kprintf(", time share of %llu us", tsc_to_us(elapsed));
+    kputs("\n");
+}
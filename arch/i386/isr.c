@@ -1,11 +1,11 @@
 #include <arch/i386/idt.h>
 #include <arch/i386/isr.h>
+#include <klog.h>
 #include <stddef.h>
 
 struct idt_entry _idt_table[256] = {0};
 
-void register_idt_entry(u8 num, u32 addr, int priv_mode, GATE_TYPE type) {
-    kprintf("Registering int #%x\n", num);
+static void _set_gate(u8 num, u32 addr, int priv_mode, GATE_TYPE type) {
     _idt_table[num].offsetLow = (addr & 0x0000ffff);
     _idt_table[num].selector = 0x08;
     _idt_table[num].reserved = 0;
@@ -13,7 +13,22 @@ void register_idt_entry(u8 num, u32 addr, int priv_mode, GATE_TYPE type) {
     _idt_table[num].flags = IDT_INIT_FLAG | IDT_PRIVILEGE_LVL(priv_mode) | type;
 }
 
-void gen_prot_handler() { kerror("GEN PROT FAULT!"); }
+void register_idt_entry(u8 num, u32 addr, int priv_mode, GATE_TYPE type) {
+    klog(KLOG_DEBUG, "Registering int #%x\n", num);
+    _set_gate(num, addr, priv_mode, type);
+}
+
+/*
+    Points every vector at its stub & loads the IDT, handlers are added
+    later with request_vector() / request_irq()
+    NOTE: interrupt gates, so handlers run with interrupts off & never nest
+*/
+void idt_init() {
+    for (size_t i = 0; i < NUM_VECTORS; i++)
+        _set_gate(i, isr_stub_table[i], 0, INT_32);
+
+    load_idt();
+}
 
 struct idt_entry get_idt_entry(u8 num) { return _idt_table[num]; }
 
@@ -1,24 +1,31 @@
+#include <mm/arena.h>
 #include <multiboot2_tbl.h>
 
 static void* mb2_tbl[NUM_MB2_ENTRIES + 1] = {NULL};
-static mod_info_st* mb2_mods[NUM_MB2_MODS] = {0};
+static const struct mb2_tbl_hdr* mb2_hdr = NULL;
+
+// NULL terminated, sized from the boot arena once the count is known
+static mod_info_st* no_mods[1] = {NULL};
+static mod_info_st** mb2_mods = no_mods;
+static size_t num_mb2_mods = 0;
+static size_t mb2_mods_end = 0;
 
 void mb2_tbl_init(const void* ptr) {
     struct mb2_tbl_hdr* tbl = (struct mb2_tbl_hdr*)ptr;
+    mb2_hdr = tbl;
     size_t offset = sizeof(struct mb2_tbl_hdr);
     size_t size = tbl->size;
-    size_t num_mods = 0;
 
     struct mb2_tag_hdr* entry = (struct mb2_tag_hdr*)(tbl + 1);
     while (offset < size) {
         if (entry->type == MB2_MOD_TYPE) {
-            if (num_mods < NUM_MB2_MODS) {
-                struct mb2_modules* mod = (struct mb2_modules*)entry;
-                mb2_mods[num_mods] = &mod->info;
-            }
-            num_mods++;
+            struct mb2_modules* mod = (struct mb2_modules*)entry;
+            if (mod->info.mod_end > mb2_mods_end)
+                mb2_mods_end = mod->info.mod_end;
+            num_mb2_mods++;
 
-            mb2_tbl[entry->type] = &mb2_mods;
+            // Keeps the first module tag, see mb2_mods_init()
+            if (mb2_tbl[entry->type] == NULL) mb2_tbl[entry->type] = entry;
             offset += entry->size;
             entry = (struct mb2_tag_hdr*)((u8*)entry + entry->size);
         } else if (entry->type >= 1 && entry->type <= NUM_MB2_ENTRIES) {
@@ -35,13 +42,57 @@ void mb2_tbl_init(const void* ptr) {
     }
 }
 
-size_t get_total_mem_kb() {
+/*
+    Collects the module tags into a NULL terminated array
+    NOTE: needs the boot arena, mb2_tbl_init() only counts them
+*/
+void mb2_mods_init() {
+    if (num_mb2_mods == 0) return;
+
+    mod_info_st** mods = boot_alloc((num_mb2_mods + 1) * sizeof(void*),
+                                    sizeof(void*));
+    if (mods == NULL) return;
+
+    size_t i = 0;
+    size_t offset = (size_t)mb2_tbl[MB2_MOD_TYPE] - (size_t)mb2_hdr;
+    struct mb2_tag_hdr* entry = (struct mb2_tag_hdr*)mb2_tbl[MB2_MOD_TYPE];
+    while (offset < mb2_hdr->size && entry->type != MB2_TAG_END_TYPE &&
+           i < num_mb2_mods) {
+        if (entry->type == MB2_MOD_TYPE)
+            mods[i++] = &((struct mb2_modules*)entry)->info;
+
+        offset = TAG_ALIGN(offset + entry->size);
+        entry = (struct mb2_tag_hdr*)((size_t)mb2_hdr + offset);
+    }
+
+    mods[i] = NULL;
+    mb2_mods = mods;
+}
+
+void get_mb2_tbl_range(size_t* start, size_t* end) {
+    *start = (size_t)mb2_hdr;
+    *end = (mb2_hdr == NULL) ? *start : *start + mb2_hdr->size;
+}
+
+/*
+    Available RAM in KB, summed from the memory map when there is one
+    (the basic meminfo tag stops at the first memory hole)
+*/
+u64 get_total_mem_kb() {
+    mmap_tbl_st map;
+    get_mmap(&map);
+
+    u64 total = 0;
+    for (size_t i = 0; i < map.num_entries; i++)
+        if (map.tbl[i].type == MEM_AVAIL_TYPE) total += map.tbl[i].len;
+    if (total != 0) return total >> 10;
+
     struct mb2_mem_info* mem_info =
         (struct mb2_mem_info*)mb2_tbl[MB2_MEM_INFO_TYPE];
 
     if (mem_info == NULL) return 0;
 
-    return (size_t)(mem_info->mem_lower_kb) + (size_t)(mem_info->mem_upper_kb);
+    return (u64)(mem_info->mem_lower_kb) + (u64)(mem_info->mem_upper_kb);
 }
 
 void get_mmap(mmap_tbl_st* map) {
@@ -126,6 +177,10 @@ void get_apm_info(apm_info_st* ptr) {
 
 mod_info_st** get_modules() { return mb2_mods; }
 
+size_t get_num_modules() { return num_mb2_mods; }
+
+size_t get_modules_end() { return mb2_mods_end; }
+
 u32 get_partition() {
     struct mb2_boot_dev* dev = (struct mb2_boot_dev*)mb2_tbl[MB2_BOOT_DEV];
     if (dev == NULL) return 0;
@@ -144,5 +199,13 @@ void get_fb_info(fb_info_st* info) {
     struct mb2_fb_info* dev = (struct mb2_fb_info*)mb2_tbl[MB2_FB_INFO_TYPE];
     if (dev == NULL) return;
 
-    *info = *((fb_info_st*)((u8*)dev + sizeof(struct mb2_tag_hdr)));
+    // Field by field, the tag layout isn't the same as fb_info_st
+    info->addr = dev->addr;
+    info->pitch = dev->pitch;
+    info->width = dev->width;
+    info->height = dev->height;
+    info->bpp = dev->bpp;
+    info->type = dev->type;
+    if (dev->type == MB2_FB_RGB_CLR)
+        info->rgb = *(struct mb2_fb_rgb_clr*)(dev + 1);
 }
\ No newline at end of file
@@ -0,0 +1,372 @@
+#include <arch/i386/cpu.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/msr.h>
+#include <arch/i386/paging.h>
+#include <early_kprintf.h>
+#include <klog.h>
+#include <mm/pmm.h>
+#include <multiboot2_tbl.h>
+
+static u32 kernel_pd[PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+
+// PAE: all 4 directories are static so the PDPT never changes after boot
+static u64 kernel_pdpt[PAE_PDPT_ENTRIES] __attribute__((aligned(32)));
+static u64 kernel_pae_pd[PAE_PDPT_ENTRIES][PAE_PT_ENTRIES]
+    __attribute__((aligned(PAGE_SIZE)));
+
+static bool use_pae = false;
+static bool use_large_pages = false;
+static size_t large_page_size = LARGE_PAGE_SIZE;
+static u32 global_flag = 0;
+static u64 nx_flag = 0;
+static size_t direct_map_end = 0;
+
+// Kernel (supervisor) mappings are global so CR3 reloads keep them cached
+static inline u32 _entry_flags(u32 flags) {
+    flags &= ~PTE_NX;
+    return (flags & PTE_USER) ? flags : flags | global_flag;
+}
+
+static inline u64 _pae_entry_flags(u32 flags) {
+    u64 entry = _entry_flags(flags);
+    return (flags & PTE_NX) ? entry | nx_flag : entry;
+}
+
+// Returns a zeroed frame for a page table, 0 if out of frames
+static phys_addr_t _alloc_table() {
+    phys_addr_t table = pmm_alloc_frame();
+    if (table == 0) return 0;
+
+    u32* entries = (u32*)PHYS_TO_VIRT(table);
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(u32); i++) entries[i] = 0;
+
+    return table;
+}
+
+/*
+    =====================
+      32-bit (2-level)
+    =====================
+*/
+static inline u32* _get_table(u32 pde) {
+    return (u32*)PHYS_TO_VIRT(pde & PTE_ADDR_MASK);
+}
+
+/*
+    Returns the page table covering virt, allocating an empty one if needed
+    Returns NULL if out of frames or virt is covered by a large page
+*/
+static u32* _get_or_alloc_table(size_t virt) {
+    u32* pde = &kernel_pd[PDE_INDEX(virt)];
+    if (*pde & PTE_PRESENT) {
+        if (*pde & PDE_LARGE) return NULL;
+        return _get_table(*pde);
+    }
+
+    phys_addr_t table = _alloc_table();
+    if (table == 0) return NULL;
+
+    // Permissions are enforced per PTE
+    *pde = (u32)table | PTE_PRESENT | PTE_RW;
+    return _get_table(*pde);
+}
+
+static bool _map_page(size_t virt, phys_addr_t phys, u32 flags) {
+    if (phys >= LEGACY_PHYS_LIMIT) return false;
+
+    u32* table = _get_or_alloc_table(virt);
+    if (table == NULL) return false;
+
+    table[PTE_INDEX(virt)] = ((u32)phys & PTE_ADDR_MASK) | _entry_flags(flags);
+    return true;
+}
+
+static bool _map_large_page(size_t virt, phys_addr_t phys, u32 flags) {
+    if (phys >= LEGACY_PHYS_LIMIT) return false;
+
+    u32* pde = &kernel_pd[PDE_INDEX(virt)];
+    if ((*pde & PTE_PRESENT) && !(*pde & PDE_LARGE)) return false;
+
+    *pde = ((u32)phys & PDE_LARGE_ADDR_MASK) | PDE_LARGE | _entry_flags(flags);
+    return true;
+}
+
+/*
+    Returns the entry mapping virt (the PDE for large pages), NULL if none
+    NOTE: bit 7 of a PTE is PAT, not PDE_LARGE, hence the large flag
+*/
+static u32* _walk(size_t virt, bool* large) {
+    u32* pde = &kernel_pd[PDE_INDEX(virt)];
+    *large = (*pde & PDE_LARGE) != 0;
+    if (!(*pde & PTE_PRESENT)) return NULL;
+    if (*large) return pde;
+
+    u32* pte = &_get_table(*pde)[PTE_INDEX(virt)];
+    return (*pte & PTE_PRESENT) ? pte : NULL;
+}
+
+/*
+    =====================
+        PAE (3-level)
+    =====================
+*/
+static inline u64* _pae_get_table(u64 pde) {
+    return (u64*)PHYS_TO_VIRT(pde & PAE_ADDR_MASK);
+}
+
+static inline u64* _pae_get_pde(size_t virt) {
+    return &kernel_pae_pd[PAE_PDPT_INDEX(virt)][PAE_PDE_INDEX(virt)];
+}
+
+/*
+    Entries are written as two 32-bit halves & the CPU may walk the tables
+    in between: the low half (present bit) goes last when setting an entry
+    and first when clearing it
+*/
+static inline void _pae_set_entry(u64* entry, u64 val) {
+    volatile u32* half = (volatile u32*)entry;
+    half[1] = (u32)(val >> 32);
+    asm volatile("" ::: "memory");
+    half[0] = (u32)val;
+}
+
+static inline void _pae_clear_entry(u64* entry) {
+    volatile u32* half = (volatile u32*)entry;
+    half[0] = 0;
+    asm volatile("" ::: "memory");
+    half[1] = 0;
+}
+
+static u64* _pae_get_or_alloc_table(size_t virt) {
+    u64* pde = _pae_get_pde(virt);
+    if (*pde & PTE_PRESENT) {
+        if (*pde & PDE_LARGE) return NULL;
+        return _pae_get_table(*pde);
+    }
+
+    phys_addr_t table = _alloc_table();
+    if (table == 0) return NULL;
+
+    _pae_set_entry(pde, table | PTE_PRESENT | PTE_RW);
+    return _pae_get_table(*pde);
+}
+
+static bool _pae_map_page(size_t virt, phys_addr_t phys, u32 flags) {
+    u64* table = _pae_get_or_alloc_table(virt);
+    if (table == NULL) return false;
+
+    _pae_set_entry(&table[PAE_PTE_INDEX(virt)],
+                   (phys & PAE_ADDR_MASK) | _pae_entry_flags(flags));
+    return true;
+}
+
+static bool _pae_map_large_page(size_t virt, phys_addr_t phys, u32 flags) {
+    u64* pde = _pae_get_pde(virt);
+    if ((*pde & PTE_PRESENT) && !(*pde & PDE_LARGE)) return false;
+
+    _pae_set_entry(pde, (phys & PAE_LARGE_ADDR_MASK) | PDE_LARGE |
+                            _pae_entry_flags(flags));
+    return true;
+}
+
+static u64* _pae_walk(size_t virt, bool* large) {
+    u64* pde = _pae_get_pde(virt);
+    *large = (*pde & PDE_LARGE) != 0;
+    if (!(*pde & PTE_PRESENT)) return NULL;
+    if (*large) return pde;
+
+    u64* pte = &_pae_get_table(*pde)[PAE_PTE_INDEX(virt)];
+    return (*pte & PTE_PRESENT) ? pte : NULL;
+}
+
+/*
+    =====================
+        Common API
+    =====================
+*/
+bool map_page(size_t virt, phys_addr_t phys, u32 flags) {
+    bool mapped = use_pae ? _pae_map_page(virt, phys, flags)
+                          : _map_page(virt, phys, flags);
+    if (mapped) flush_tlb_page(virt);
+
+    return mapped;
+}
+
+bool map_large_page(size_t virt, phys_addr_t phys, u32 flags) {
+    if (!use_large_pages) return false;
+    if ((virt | phys) & (large_page_size - 1)) return false;
+
+    // Bit 7 is the page size bit in a PDE, PAT moves to bit 12
+    if (flags & PTE_PAT) flags = (flags & ~PTE_PAT) | PDE_PAT;
+
+    bool mapped = use_pae ? _pae_map_large_page(virt, phys, flags)
+                          : _map_large_page(virt, phys, flags);
+    if (mapped) flush_tlb_page(virt);
+
+    return mapped;
+}
+
+/*
+    Clears the mapping of virt without invalidating the TLB
+    Returns the size it covered, 0 if virt wasn't mapped
+    NOTE: stale TLB entries survive until flush_tlb_all(), which has to
+    happen before virt or the frame is reused
+*/
+size_t unmap_page_noflush(size_t virt) {
+    bool large;
+    if (use_pae) {
+        u64* entry = _pae_walk(virt, &large);
+        if (entry == NULL) return 0;
+        _pae_clear_entry(entry);
+    } else {
+        u32* entry = _walk(virt, &large);
+        if (entry == NULL) return 0;
+        *entry = 0;
+    }
+
+    return large ? large_page_size : PAGE_SIZE;
+}
+
+void unmap_page(size_t virt) {
+    if (unmap_page_noflush(virt) != 0) flush_tlb_page(virt);
+}
+
+/*
+    Walks the page tables for virt
+    Returns 0 if it is not mapped
+*/
+phys_addr_t virt_to_phys(size_t virt) {
+    bool large;
+    if (use_pae) {
+        u64* entry = _pae_walk(virt, &large);
+        if (entry == NULL) return 0;
+
+        if (large)
+            return (*entry & PAE_LARGE_ADDR_MASK) |
+                   (virt & (PAE_LARGE_PAGE_SIZE - 1));
+        return (*entry & PAE_ADDR_MASK) | (virt & (PAGE_SIZE - 1));
+    }
+
+    u32* entry = _walk(virt, &large);
+    if (entry == NULL) return 0;
+
+    if (large)
+        return (*entry & PDE_LARGE_ADDR_MASK) | (virt & (LARGE_PAGE_SIZE - 1));
+    return (*entry & PTE_ADDR_MASK) | (virt & (PAGE_SIZE - 1));
+}
+
+bool is_mapped(size_t virt) {
+    bool large;
+    return use_pae ? _pae_walk(virt, &large) != NULL
+                   : _walk(virt, &large) != NULL;
+}
+
+void flush_tlb_page(size_t virt) { invlpg(virt); }
+
+// Also drops global entries, a plain CR3 reload keeps those
+void flush_tlb_all() {
+    u32 cr4 = read_cr4();
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+bool paging_has_large_pages() { return use_large_pages; }
+
+bool paging_has_global_pages() { return global_flag != 0; }
+
+bool paging_has_pae() { return use_pae; }
+
+bool paging_has_nx() { return nx_flag != 0; }
+
+size_t paging_large_page_size() { return large_page_size; }
+
+/*
+    Highest physical address (exclusive) that can be mapped
+    NOTE: only depends on CPUID, so the PMM may ask before paging_init()
+*/
+phys_addr_t paging_phys_limit() {
+    return has_cpu_PAE() ? PAE_PHYS_LIMIT : LEGACY_PHYS_LIMIT;
+}
+
+size_t get_direct_map_end() { return direct_map_end; }
+
+// Only the kernel image is executable
+static u32 _direct_map_flags(size_t addr, size_t size) {
+    bool kernel = addr < KRNL_END && addr + size > KRNL_START;
+    return kernel ? PTE_KERNEL : PTE_KERNEL | PTE_NX;
+}
+
+/*
+    Builds the kernel page tables & turns paging on
+    - PAE (3-level, 2 MiB large pages, NX) is used when the CPU has it,
+      else 32-bit paging with 4 MiB PSE pages if available
+    - Physical memory up to the last mmap entry (capped at DIRECT_MAP_LIMIT)
+      is identity mapped, using large pages where possible
+    - The first 4 MiB always uses 4 KiB pages so page 0 can stay unmapped
+      and catch NULL dereferences
+*/
+void paging_init() {
+    use_pae = has_cpu_PAE();
+    use_large_pages = use_pae || has_cpu_PSE();
+    large_page_size = use_pae ? PAE_LARGE_PAGE_SIZE : LARGE_PAGE_SIZE;
+    global_flag = has_cpu_PGE() ? PTE_GLOBAL : 0;
+
+    // NXE has to be on before any entry carries the NX bit
+    if (use_pae && has_cpu_NX()) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+        nx_flag = PAE_NX;
+    }
+
+    // PDPTEs only take the present bit (RW/USER are reserved)
+    for (size_t i = 0; i < PAE_PDPT_ENTRIES && use_pae; i++)
+        kernel_pdpt[i] = VIRT_TO_PHYS(kernel_pae_pd[i]) | PTE_PRESENT;
+
+    mmap_tbl_st map;
+    get_mmap(&map);
+
+    u64 top = KRNL_END;
+    for (size_t i = 0; i < map.num_entries; i++) {
+        u64 end = map.tbl[i].addr + map.tbl[i].len;
+        if (end > top) top = end;
+    }
+
+    top = (top + LARGE_PAGE_SIZE - 1) & ~(u64)(LARGE_PAGE_SIZE - 1);
+    direct_map_end = (top > DIRECT_MAP_LIMIT) ? DIRECT_MAP_LIMIT : (size_t)top;
+
+    for (size_t addr = PAGE_SIZE; addr < LARGE_PAGE_SIZE; addr += PAGE_SIZE)
+        map_page((size_t)PHYS_TO_VIRT(addr), addr,
+                 _direct_map_flags(addr, PAGE_SIZE));
+
+    for (size_t addr = LARGE_PAGE_SIZE; addr < direct_map_end;
+         addr += large_page_size) {
+        size_t virt = (size_t)PHYS_TO_VIRT(addr);
+        u32 flags = _direct_map_flags(addr, large_page_size);
+        if (map_large_page(virt, addr, flags)) continue;
+
+        for (size_t off = 0; off < large_page_size; off += PAGE_SIZE)
+            map_page(virt + off, addr + off, flags);
+    }
+
+    if (use_pae) {
+        write_cr4(read_cr4() | CR4_PAE);
+        write_cr3(VIRT_TO_PHYS(kernel_pdpt));
+    } else {
+        if (use_large_pages) write_cr4(read_cr4() | CR4_PSE);
+        write_cr3(VIRT_TO_PHYS(kernel_pd));
+    }
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+
+    // Only enable global pages once paging is on (Intel SDM 4.10.2.4)
+    if (global_flag) write_cr4(read_cr4() | CR4_PGE);
+
+    klog(KLOG_INFO,
+         "Paging: %s, direct map up to %p, large pages: %u KiB, "
+         "global: %d, NX: %d\n",
+         use_pae ? "PAE" : "32-bit", (void*)direct_map_end,
+         use_large_pages ? large_page_size / 1024 : 0, global_flag != 0,
+         nx_flag != 0);
+}
@@ -0,0 +1,54 @@
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/msr.h>
+#include <arch/i386/pat.h>
+#include <arch/i386/paging.h>
+#include <early_kprintf.h>
+#include <klog.h>
+
+static bool use_pat = false;
+
+static const char* type_names[] = {"WB", "WT", "UC-", "UC", "WC", "WP"};
+
+/*
+    Programs the PAT MSR, entries 6 & 7 keep their defaults too
+    NOTE: must run on every CPU, they all need the same table
+*/
+void pat_init() {
+    if (!has_cpu_PAT()) {
+        klog(KLOG_WARNING, "PAT: not supported, WC falls back to UC-\n");
+        return;
+    }
+
+    u64 pat = PAT_ENTRY(MEM_WB, PAT_WB) | PAT_ENTRY(MEM_WT, PAT_WT) |
+              PAT_ENTRY(MEM_UC_MINUS, PAT_UC_MINUS) |
+              PAT_ENTRY(MEM_UC, PAT_UC) | PAT_ENTRY(MEM_WC, PAT_WC) |
+              PAT_ENTRY(MEM_WP, PAT_WP) | PAT_ENTRY(6, PAT_UC_MINUS) |
+              PAT_ENTRY(7, PAT_UC);
+
+    wrmsr(MSR_PAT, pat);
+    use_pat = true;
+}
+
+bool pat_enabled() { return use_pat; }
+
+/*
+    PTE bits selecting type for a 4 KiB page
+    Without PAT the upper entries don't exist: WC degrades to UC- (still
+    WC if an MTRR covers the range) & WP to UC
+*/
+u32 mem_type_flags(enum mem_type type) {
+    u32 idx = type;
+    if (!use_pat && type == MEM_WC) idx = MEM_UC_MINUS;
+    if (!use_pat && type == MEM_WP) idx = MEM_UC;
+
+    u32 flags = 0;
+    if (idx & 1) flags |= PTE_PWT;
+    if (idx & 2) flags |= PTE_PCD;
+    if (idx & 4) flags |= PTE_PAT;
+
+    return flags;
+}
+
+const char* mem_type_name(enum mem_type type) {
+    return (type <= MEM_WP) ? type_names[type] : "??";
+}
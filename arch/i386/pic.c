@@ -1,3 +1,5 @@
+#include <arch/i386/delay.h>
+#include <arch/i386/irq.h>
 #include <arch/i386/pic.h>
 
 static inline u8 _get_master_imr() { return inb(PIC_MASTER_DATA); }
@@ -6,7 +8,6 @@ static inline u8 _get_slave_imr() { return inb(PIC_SLAVE_DATA); }
 
 static inline u16 _get_pic_imr() {
     u16 mask = _get_slave_imr();
-    io_wait();
     return (mask << 8) | _get_master_imr();
 }
 
@@ -14,35 +15,37 @@ static void _set_pic_imr(u16 mask) {
     u8 master_mask = mask;
     u8 slave_mask = (mask >> 8);
     outb(PIC_MASTER_DATA, master_mask);
-    io_wait();
     outb(PIC_SLAVE_DATA, slave_mask);
-    io_wait();
 }
 
+/*
+    Old 8259s want a moment between initialization words, the mask & EOI
+    writes after that don't (chipset PICs never needed any)
+*/
 void pic_init() {
     // Send ICW1s
     outb(PIC_MASTER_COMMAND, ICW1_INIT | ICW1_NEED_ICW4);
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
     outb(PIC_SLAVE_COMMAND, ICW1_INIT | ICW1_NEED_ICW4);
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
 
     // Send ICW2s
     outb(PIC_MASTER_DATA, PIC_MASTER_OFFSET);
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
     outb(PIC_SLAVE_DATA, PIC_SLAVE_OFFSET);
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
 
     // Send ICW3s
     outb(PIC_MASTER_DATA, PIC_CONNECT_IR(2));
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
     outb(PIC_SLAVE_DATA, 2);
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
 
     // Send ICW4s
     outb(PIC_MASTER_DATA, ICW4_PM_86);
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
     outb(PIC_SLAVE_DATA, ICW4_PM_86);
-    io_wait();
+    udelay(PIC_ICW_DELAY_US);
 
     pic_disable();
 }
@@ -50,13 +53,9 @@ void pic_init() {
 void pic_disable() { _set_pic_imr(0xFFFF); }
 
 void pic_eoi(u8 irq_num) {
-    if (irq_num >= 8) {
-        outb(PIC_SLAVE_COMMAND, PIC_EOI);
-        io_wait();
-    }
+    if (irq_num >= 8) outb(PIC_SLAVE_COMMAND, PIC_EOI);
 
     outb(PIC_MASTER_COMMAND, PIC_EOI);
-    io_wait();
 }
 
 void pic_disable_irq(u8 irq_num) {
@@ -71,3 +70,42 @@ void pic_enable_irq(u8 irq_num) {
 
     _set_pic_imr(mask & ~(1 << irq_num));
 }
+
+// In-service bits, master in the low byte
+static u16 _get_pic_isr() {
+    outb(PIC_MASTER_COMMAND, PIC_READ_ISR);
+    outb(PIC_SLAVE_COMMAND, PIC_READ_ISR);
+    u16 isr = inb(PIC_SLAVE_COMMAND);
+    return (isr << 8) | inb(PIC_MASTER_COMMAND);
+}
+
+/*
+    A request withdrawn before the CPU acknowledged it shows up as IRQ 7
+    (or 15) with its in-service bit clear, it must not get an EOI from
+    the PIC that raised it
+*/
+bool pic_is_spurious(u8 irq_num) {
+    if (irq_num != 7 && irq_num != 15) return false;
+
+    return !(_get_pic_isr() & (1 << irq_num));
+}
+
+// Both PICs only talk to the boot CPU
+static bool _pic_enable(u8 irq_num, u32 cpu) {
+    if (cpu != 0) return false;
+
+    pic_enable_irq(irq_num);
+    return true;
+}
+
+static bool _pic_spurious(u8 irq_num) {
+    if (!pic_is_spurious(irq_num)) return false;
+
+    // The master did raise a slave's spurious request
+    if (irq_num >= 8) pic_eoi(2);
+    return true;
+}
+
+const struct irq_chip pic_chip = {
+    "8259", NUM_LEGACY_IRQS, _pic_enable, pic_disable_irq, pic_eoi,
+    _pic_spurious};
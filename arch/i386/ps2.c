@@ -1,8 +1,9 @@
+#include <arch/i386/delay.h>
 #include <arch/i386/ps2.h>
 #include <early_kprintf.h>
+#include <klog.h>
 
 static bool ps2DeviceActive[2] = {false, false};
-static const int MAX_ATTEMPTS = 5000;
 
 /*
     Get byte from PS2 status register
@@ -18,75 +19,26 @@ static const int MAX_ATTEMPTS = 5000;
 static uint8_t _read_status_register() { return inb(PS2_CMD_PORT); }
 
 /*
-    Stall until input buffer is empty
-    If it takes too long, returns false
+    Status waits, false if the controller didn't get there within
+    PS2_TIMEOUT_US
 */
 static bool _wait_input_buf_clear() {
-    bool input_clear = false;
-    int attempts = 0;
-
-    do {
-        uint8_t status = _read_status_register();
-        input_clear = (status == (status & 0xfd));
-        attempts++;
-        io_wait();
-    } while (attempts < MAX_ATTEMPTS && !input_clear);
-
-    return input_clear;
+    return poll_until(PS2_CMD_PORT, PS2_STATUS_INPUT_FULL, 0, PS2_TIMEOUT_US);
 }
 
-/*
-    Stall until input buffer is set
-    If it takes too long, returns false
-*/
 static bool _wait_input_buf_set() {
-    bool input_set = false;
-    int attempts = 0;
-
-    do {
-        uint8_t status = _read_status_register();
-        input_set = (status == (status | 0x02));
-        attempts++;
-        io_wait();
-    } while (attempts < MAX_ATTEMPTS && !input_set);
-
-    return input_set;
+    return poll_until(PS2_CMD_PORT, PS2_STATUS_INPUT_FULL,
+                      PS2_STATUS_INPUT_FULL, PS2_TIMEOUT_US);
 }
 
-/*
-    Stall until output buffer is empty
-    If it takes too long, returns false
-*/
 static bool _wait_output_buf_clear() {
-    bool output_clear = false;
-    int attempts = 0;
-
-    do {
-        uint8_t status = _read_status_register();
-        output_clear = (status % 2 == 0);
-        attempts++;
-        io_wait();
-    } while (attempts < MAX_ATTEMPTS && !output_clear);
-
-    return output_clear;
+    return poll_until(PS2_CMD_PORT, PS2_STATUS_OUTPUT_FULL, 0,
+                      PS2_TIMEOUT_US);
 }
 
-/*
-    Stall until output buffer is set
-    If it takes too long, returns false
-*/
 static bool _wait_output_buf_set() {
-    bool output_set = false;
-    int attempts = 0;
-
-    do {
-        uint8_t status = _read_status_register();
-        output_set = (status % 2 == 1);
-        attempts++;
-        io_wait();
-    } while (attempts < MAX_ATTEMPTS && !output_set);
-
-    return output_set;
+    return poll_until(PS2_CMD_PORT, PS2_STATUS_OUTPUT_FULL,
+                      PS2_STATUS_OUTPUT_FULL, PS2_TIMEOUT_US);
 }
 
 /*
@@ -94,7 +46,7 @@ static bool _wait_output_buf_set() {
     If unable to, return 0xff, which is invalid (bit 3,7 should be 0)
 */
 static uint8_t _read_config_byte() {
-    outb(PS2_CMD_PORT, PS2_READ_CONFIG_BYTE);
+    ps2_send_command(PS2_READ_CONFIG_BYTE);
     if (!_wait_output_buf_set()) return 0xff;  // return a garbage config byte
 
     return inb(PS2_DATA_PORT);
@@ -106,11 +58,10 @@ static uint8_t _read_config_byte() {
     - Try to check if it is set.
 */
 static void _write_config_byte(uint8_t config) {
-    outb(PS2_CMD_PORT, PS2_WRITE_CONFIG_BYTE);
+    ps2_send_command(PS2_WRITE_CONFIG_BYTE);
     if (!_wait_input_buf_clear()) return;
 
     outb(PS2_DATA_PORT, config);
-    io_wait();
 }
 
 /*
@@ -119,7 +70,7 @@ static void _write_config_byte(uint8_t config) {
     NOTE: check this before using it (bit 0 should be 1!)
 */
 static uint8_t _read_output_port() {
-    outb(PS2_CMD_PORT, PS2_READ_OUTPUT_PORT);
+    ps2_send_command(PS2_READ_OUTPUT_PORT);
     if (!_wait_output_buf_set()) return 0xff;
 
     return inb(PS2_DATA_PORT);
@@ -132,11 +83,10 @@ static uint8_t _read_output_port() {
     - No check is done on data, it is up to you to check its validity
 */
 static void _write_output_port(uint8_t data) {
-    outb(PS2_CMD_PORT, PS2_WRITE_OUTPUT_PORT);
+    ps2_send_command(PS2_WRITE_OUTPUT_PORT);
     if (!_wait_input_buf_clear()) return;
 
     outb(PS2_DATA_PORT, data);
-    io_wait();
 }
 
 /*
@@ -161,11 +111,9 @@ void ps2_toggle_port(int portNum, bool enable) {
     if (portNum < 1 || portNum > 2) return;
 
     if (portNum == 1) {
-        outb(PS2_CMD_PORT, PS2_DISABLE_PORT_1 + enable);
-        io_wait();
+        ps2_send_command(PS2_DISABLE_PORT_1 + enable);
     } else {
-        outb(PS2_CMD_PORT, PS2_DISABLE_PORT_2 + enable);
-        io_wait();
+        ps2_send_command(PS2_DISABLE_PORT_2 + enable);
     }
 }
 
@@ -179,15 +127,14 @@ bool ps2_test_port(int portNum) {
     if (portNum < 1 || portNum > 2) return false;
 
     if (portNum == 1) {
-        outb(PS2_CMD_PORT, PS2_TEST_PORT_1);
+        ps2_send_command(PS2_TEST_PORT_1);
     } else {
-        outb(PS2_CMD_PORT, PS2_TEST_PORT_2);
+        ps2_send_command(PS2_TEST_PORT_2);
     }
 
     if (!_wait_output_buf_set()) return false;
 
     uint8_t resp = inb(PS2_DATA_PORT);
-    io_wait();
 
     return (resp == 0x00);
 }
@@ -198,25 +145,24 @@ bool ps2_test_port(int portNum) {
         success byte
 */
 bool ps2_test_controller() {
-    outb(PS2_CMD_PORT, PS2_TEST_CONTROLLER);
+    ps2_send_command(PS2_TEST_CONTROLLER);
     if (!_wait_output_buf_set()) return false;
 
     uint8_t resp = inb(PS2_DATA_PORT);
-    io_wait();
 
     return (resp == 0x55);
 }
 
+// The controller takes a command once it has consumed the last byte
 void ps2_send_command(uint8_t cmd) {
+    _wait_input_buf_clear();
     outb(PS2_CMD_PORT, cmd);
-    io_wait();
 }
 
 uint8_t ps2_get_data() {
     if (!_wait_output_buf_set()) return 0x00;
 
     uint8_t resp = inb(PS2_DATA_PORT);
-    io_wait();
     return resp;
 }
 
@@ -235,7 +181,7 @@ bool ps2_send_port1_data_ack(uint8_t data) {
 }
 
 bool ps2_send_port2_data_ack(uint8_t data) {
-    outb(PS2_CMD_PORT, PS2_WRITE_PORT_2_INPUT_BUFFER);
+    ps2_send_command(PS2_WRITE_PORT_2_INPUT_BUFFER);
 
     if (!_wait_input_buf_clear()) {
         kerror("PS2 Port 2 failed to clear input buffer.\n");
@@ -243,7 +189,6 @@ bool ps2_send_port2_data_ack(uint8_t data) {
     }
 
     outb(PS2_DATA_PORT, data);
-    io_wait();
 
     if (!_wait_output_buf_set()) {
         kerror("PS2 Port 2 failed to clear input buffer.\n");
@@ -263,7 +208,7 @@ bool ps2_send_port1_data(uint8_t data) {
 }
 
 bool ps2_send_port2_data(uint8_t data) {
-    outb(PS2_CMD_PORT, PS2_WRITE_PORT_2_INPUT_BUFFER);
+    ps2_send_command(PS2_WRITE_PORT_2_INPUT_BUFFER);
 
     if (!_wait_input_buf_clear()) {
         kerror("PS2 Port 2 failed to clear input buffer.\n");
@@ -271,7 +216,6 @@ bool ps2_send_port2_data(uint8_t data) {
     }
 
     outb(PS2_DATA_PORT, data);
-    io_wait();
 
     if (!_wait_output_buf_set()) {
         kerror("PS2 Port 2 failed to clear input buffer.\n");
@@ -314,17 +258,18 @@ bool ps2_reset_port(int portNum) {
 
     // Check 1st response
     uint8_t resp = inb(PS2_DATA_PORT);
-    io_wait();
     if (resp != 0xAA && resp != 0xFA) {
         kerror("Reset failed for PS2 Port %d: resp=%x!\n", portNum, resp);
         return false;
     }
 
-    if (!_wait_output_buf_set()) return false;
+    // The self test (BAT) result can take hundreds of ms
+    if (!poll_until(PS2_CMD_PORT, PS2_STATUS_OUTPUT_FULL,
+                    PS2_STATUS_OUTPUT_FULL, PS2_RESET_TIMEOUT_US))
+        return false;
 
     // Check 2nd response
     resp = inb(PS2_DATA_PORT);
-    io_wait();
     if (resp != 0xAA && resp != 0xFA) {
         kerror("Reset failed for PS2 Port %d: resp=%x!\n", portNum, resp);
         return false;
@@ -335,14 +280,13 @@ bool ps2_reset_port(int portNum) {
         if (!_wait_output_buf_set()) return false;
 
         resp = inb(PS2_DATA_PORT);
-        io_wait();
     }
 
     return true;
 }
 
 bool ps2_initiate() {
-    kprintf("Initiating PS2 config...\n");
+    klog(KLOG_INFO, "Initiating PS2 config...\n");
 
     // disable devices (don't send data)
     ps2_toggle_port(1, false);
@@ -350,7 +294,6 @@ bool ps2_initiate() {
 
     // flush output buffer
     inb(PS2_DATA_PORT);
-    io_wait();
 
     // set config byte
     uint8_t oldConfig = _read_config_byte();
@@ -435,8 +378,8 @@ bool ps2_initiate() {
         return false;
     }
 
-    kprintf("PS2 config done!\n");
-    kprintf("PS2 devices? Dev1: %d, Dev2: %d\n", ps2DeviceActive[0],
-            ps2DeviceActive[1]);
+    klog(KLOG_INFO, "PS2 config done!\n");
+    klog(KLOG_INFO, "PS2 devices? Dev1: %d, Dev2: %d\n", ps2DeviceActive[0],
+         ps2DeviceActive[1]);
     return true;
 }
\ No newline at end of file
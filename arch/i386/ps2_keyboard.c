@@ -1,17 +1,23 @@
-#include <arch/i386/isr.h>
-#include <arch/i386/pic.h>
+#include <arch/i386/irq.h>
 #include <arch/i386/ps2.h>
 #include <arch/i386/ps2_keyboard.h>
 #include <early_kprintf.h>
+#include <klog.h>
 #include <lib/conversion.h>
+#include <mm/arena.h>
 
 static int _current_scancode_set = 0;
 static bool _caps_lock = false;
 static bool _shift_press = false;
 static bool _number_lock = false;
 
-static key_handler_t key_handlers[10] = {NULL};
-static size_t num_key_handlers = 0;
+struct key_handler_node {
+    key_handler_t handler;
+    struct key_handler_node* next;
+};
+
+static struct key_handler_node* key_handlers = NULL;
+static struct key_handler_node** key_handlers_tail = &key_handlers;
 
 void flush_key_buffer() { while (ps2_get_data() != 0); }
 
@@ -424,7 +430,7 @@ key_st ps2_get_keyboard_char() {
 
 // Assumes PS2 config done including this keyboard
 bool ps2_keyboard_config() {
-    kprintf("Configuring PS/2 keyboard...\n");
+    klog(KLOG_INFO, "Configuring PS/2 keyboard...\n");
     while (ps2_get_data() != 0x0);
 
     // small detection test
@@ -452,26 +458,40 @@ bool ps2_keyboard_config() {
         return false;
     }
 
-    register_idt_entry(PIC_MASTER_OFFSET + 1, (u32)&isr_keyboard_handler, 0,
-                       INT_32);
+    if (!request_irq_on(PS2_KEYBOARD_IRQ, 0, keyboard_handler, "keyboard",
+                        NULL)) {
+        kerror("Keyboard config: IRQ %u is taken!\n", PS2_KEYBOARD_IRQ);
+        return false;
+    }
 
-    kprintf("PS/2 Keyboard configuration complete!\n");
+    klog(KLOG_INFO, "PS/2 Keyboard configuration complete!\n");
     return true;
 }
 
-void keyboard_handler() {
+void keyboard_handler(struct int_frame* frame, void* data) {
+    (void)frame;
+    (void)data;
+
     key_st key = ps2_get_keyboard_char();
-    if (key.cmd == NOT_CMD && key.data == 0) goto finish;
+    if (key.cmd != NOT_CMD || key.data != 0) dispatch_key(key);
+}
 
-    for (size_t i = 0; i < num_key_handlers; i++) key_handlers[i](key);
-finish:
-    pic_eoi(1);
+// Hands a key to every handler, other input sources (serial) use it too
+void dispatch_key(key_st key) {
+    for (struct key_handler_node* node = key_handlers; node != NULL;
+         node = node->next)
+        node->handler(key);
 }
 
+// Handlers are called in registration order, they are never removed
 bool register_key_handler(void (*handler)(key_st)) {
-    if (num_key_handlers == 10) return false;
-
-    key_handlers[num_key_handlers] = handler;
-    num_key_handlers++;
+    struct key_handler_node* node =
+        boot_alloc(sizeof(struct key_handler_node), sizeof(void*));
+    if (node == NULL) return false;
+
+    node->handler = handler;
+    node->next = NULL;
+    *key_handlers_tail = node;
+    key_handlers_tail = &node->next;
     return true;
 }
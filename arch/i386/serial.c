@@ -0,0 +1,220 @@
+#include <arch/i386/cpu.h>
+#include <arch/i386/delay.h>
+#include <arch/i386/irq.h>
+#include <arch/i386/ps2_keyboard.h>
+#include <arch/i386/serial.h>
+#include <console.h>
+#include <early_kprintf.h>
+#include <io.h>
+#include <klog.h>
+#include <lib/conversion.h>
+#include <lib/string.h>
+#include <spinlock.h>
+
+static bool present = false;
+
+static char tx_ring[SERIAL_TX_RING];
+static u32 tx_head = 0; /* next byte in */
+static u32 tx_tail = 0; /* next byte out */
+static bool tx_running = false;
+static spinlock_t tx_lock = SPINLOCK_INIT;
+
+static u32 tx_bytes = 0;
+static u32 tx_dropped = 0;
+static u32 rx_bytes = 0;
+static u32 rx_overruns = 0;
+static u64 tx_busy_cycles = 0; /* transmitter running, for the rate */
+static u64 tx_started = 0;
+
+// ANSI colours for the VGA ones, kerror() red shows on the host too
+static const u8 ansi_colors[] = {30, 34, 32, 36, 31, 35, 33, 37,
+                                 90, 94, 92, 96, 91, 95, 93, 97};
+
+static inline void _uart_write(u16 reg, u8 val) { outb(COM1_PORT + reg, val); }
+
+static inline u8 _uart_read(u16 reg) { return inb(COM1_PORT + reg); }
+
+// Loopback test, also rules out a missing port (reads back 0xFF)
+static bool _probe() {
+    _uart_write(UART_MCR, MCR_LOOPBACK | MCR_RTS | MCR_OUT1 | MCR_OUT2);
+    _uart_write(UART_DATA, 0xAE);
+    return _uart_read(UART_DATA) == 0xAE;
+}
+
+/*
+    Moves up to a FIFO's worth of bytes from the ring to the UART, stops
+    the TX interrupt once the ring is empty
+    NOTE: tx_lock held, THR is empty
+*/
+static void _tx_fill() {
+    size_t count = 0;
+    while (count < SERIAL_FIFO_SIZE && tx_tail != tx_head) {
+        _uart_write(UART_DATA, tx_ring[tx_tail % SERIAL_TX_RING]);
+        tx_tail++;
+        count++;
+    }
+    tx_bytes += count;
+
+    if (count > 0 && !tx_running) {
+        tx_running = true;
+        tx_started = rdtsc();
+        _uart_write(UART_IER, IER_RX_AVAIL | IER_TX_EMPTY);
+    } else if (count == 0 && tx_running) {
+        tx_running = false;
+        tx_busy_cycles += rdtsc() - tx_started;
+        _uart_write(UART_IER, IER_RX_AVAIL);
+    }
+}
+
+// Returns false if the ring was full & c dropped
+static bool _tx_put(char c) {
+    if (tx_head - tx_tail >= SERIAL_TX_RING) {
+        tx_dropped++;
+        return false;
+    }
+
+    tx_ring[tx_head % SERIAL_TX_RING] = c;
+    tx_head++;
+    return true;
+}
+
+/*
+    Queues len bytes, '\n' goes out as "\r\n" for terminals
+    Returns the number of bytes of str queued (the added '\r's don't
+    count), the rest was dropped
+*/
+size_t serial_write(const char* str, size_t len) {
+    if (!present) return 0;
+
+    u32 flags = spin_lock_irqsave(&tx_lock);
+    size_t queued = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '\n') _tx_put('\r');
+        if (_tx_put(str[i])) queued++;
+    }
+
+    // Idle transmitter: prime the FIFO, the IRQ keeps it going
+    if (!tx_running && (_uart_read(UART_LSR) & LSR_TX_EMPTY)) _tx_fill();
+    spin_unlock_irqrestore(&tx_lock, flags);
+
+    return queued;
+}
+
+static void _console_write(const char* str, COLORS fg) {
+    char color[8];
+    bool colored = fg != WHITE && fg < sizeof(ansi_colors);
+    if (colored) {
+        size_t len = 0;
+        color[len++] = '\033';
+        color[len++] = '[';
+        utoa(ansi_colors[fg], color + len, 10);
+        len += 2;
+        color[len++] = 'm';
+        serial_write(color, len);
+    }
+
+    serial_write(str, strlen(str));
+    if (colored) serial_write("\033[0m", 4);
+}
+
+static struct console serial_console = {"ttyS0", _console_write, NULL, NULL};
+
+// Received bytes go to the key handlers like keyboard input
+static void _rx_drain() {
+    u8 status;
+    while ((status = _uart_read(UART_LSR)) & LSR_DATA_READY) {
+        if (status & LSR_OVERRUN) rx_overruns++;
+
+        char c = _uart_read(UART_DATA);
+        rx_bytes++;
+
+        // Terminals send CR for enter & DEL for backspace
+        if (c == '\r') c = '\n';
+        if (c == 0x7F) c = '\b';
+
+        key_st key = {true, (u8)c, NOT_CMD};
+        dispatch_key(key);
+    }
+}
+
+void serial_handler(struct int_frame* frame, void* data) {
+    (void)frame;
+    (void)data;
+
+    u8 iir;
+    while (!((iir = _uart_read(UART_IIR)) & IIR_NO_INT)) {
+        switch (iir & IIR_ID_MASK) {
+            case IIR_RX_AVAIL:
+            case IIR_RX_TIMEOUT:
+                _rx_drain();
+                break;
+            case IIR_TX_EMPTY:
+                spin_lock(&tx_lock);
+                _tx_fill();
+                spin_unlock(&tx_lock);
+                break;
+            case IIR_LINE_STATUS:
+                if (_uart_read(UART_LSR) & LSR_OVERRUN) rx_overruns++;
+                break;
+            case IIR_MODEM:
+                _uart_read(UART_MSR);
+                break;
+        }
+    }
+}
+
+/*
+    Sets COM1 to SERIAL_BAUD 8N1 with FIFOs & interrupts
+    Returns false if there's no UART (nothing gets registered)
+*/
+bool serial_init() {
+    _uart_write(UART_IER, 0);
+    _uart_write(UART_LCR, LCR_DLAB);
+    _uart_write(UART_DATA, (115200 / SERIAL_BAUD) & 0xFF);
+    _uart_write(UART_IER, (115200 / SERIAL_BAUD) >> 8);
+    _uart_write(UART_LCR, LCR_8N1);
+    _uart_write(UART_FCR,
+                FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX | FCR_TRIGGER_14);
+
+    if (!_probe()) {
+        klog(KLOG_WARNING, "Serial: no UART on COM1\n");
+        return false;
+    }
+
+    _uart_write(UART_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+    _uart_read(UART_DATA);
+
+    if (!request_irq_on(COM1_IRQ, 0, serial_handler, "serial", NULL))
+        return false;
+    _uart_write(UART_IER, IER_RX_AVAIL);
+
+    present = true;
+    console_register(&serial_console);
+    klog(KLOG_INFO, "Serial: COM1 at %u baud\n", SERIAL_BAUD);
+    return true;
+}
+
+bool serial_present() { return present; }
+
+void serial_print_stats() {
+    if (!present) {
+        kputs("Serial: no UART\n");
+        return;
+    }
+
+    u32 flags = spin_lock_irqsave(&tx_lock);
+    u64 busy = tx_busy_cycles;
+    if (tx_running) busy += rdtsc() - tx_started;
+    u32 sent = tx_bytes;
+    u32 queued = tx_head - tx_tail;
+    spin_unlock_irqrestore(&tx_lock, flags);
+
+    u32 rem;
+    u32 busy_ms = (u32)div_u64_rem(tsc_to_us(busy), 1000, &rem);
+    u32 rate =
+        (busy_ms == 0) ? 0 : (u32)div_u64_rem((u64)sent * 1000, busy_ms, &rem);
+    kprintf("Serial: TX %u B (%u queued, %u dropped), RX %u B (%u overruns)\n",
+            sent, queued, tx_dropped, rx_bytes, rx_overruns);
+    kprintf("  TX rate: %u B/s while busy (line max %u B/s)\n", rate,
+            SERIAL_BAUD / 10);
+}
@@ -0,0 +1,283 @@
+#include <arch/i386/acpi.h>
+#include <arch/i386/clocksource.h>
+#include <arch/i386/cpu.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/delay.h>
+#include <arch/i386/idle.h>
+#include <arch/i386/idt.h>
+#include <arch/i386/irq.h>
+#include <arch/i386/msr.h>
+#include <arch/i386/pat.h>
+#include <arch/i386/paging.h>
+#include <arch/i386/smp.h>
+#include <early_kprintf.h>
+#include <klog.h>
+#include <lib/string.h>
+#include <mm/pmm.h>
+#include <spinlock.h>
+
+#define AP_STACK_ORDER 1 /* KRNL_STACK_SIZE in frames */
+
+u8 apic_to_cpu[MAX_APIC_IDS] = {0};
+static u8 cpu_apic_ids[MAX_CPUS] = {0};
+static volatile u32 cpus_online = 1;
+static u32 num_cpus = 1;
+
+static volatile u32 tlb_pending[MAX_CPUS] = {0};
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+
+// TSC warp check, see _tsc_warp_check()
+static volatile u32 tsc_check_go = 0;
+static volatile u32 tsc_check_done = 0;
+static spinlock_t tsc_check_lock = SPINLOCK_INIT;
+static u64 tsc_check_last = 0;
+static u64 tsc_max_warp = 0;
+
+// Read by ap_entry (trampoline.S) before paging is on
+u32 ap_cr0 = 0;
+u32 ap_cr3 = 0;
+u32 ap_cr4 = 0; /* without PGE, set once paging is on */
+u32 ap_efer = 0;
+u32 ap_stacks[MAX_CPUS] = {0};
+u32 ap_next = 1;
+static u32 bsp_cr4 = 0;
+
+extern char trampoline_start[];
+extern char trampoline_gdt[];
+extern char trampoline_end[];
+
+void ap_main(u32 cpu);
+
+static void _wake_ipi(struct int_frame* frame, void* data) {
+    (void)frame;
+    (void)data;
+}
+
+// Flushes this CPU's TLB if a shootdown is waiting on it
+static void _tlb_ack() {
+    u32 cpu = smp_cpu_id();
+    if (!__atomic_load_n(&tlb_pending[cpu], __ATOMIC_ACQUIRE)) return;
+
+    flush_tlb_all();
+    __atomic_store_n(&tlb_pending[cpu], 0, __ATOMIC_RELEASE);
+}
+
+static void _tlb_flush_ipi(struct int_frame* frame, void* data) {
+    (void)frame;
+    (void)data;
+    _tlb_ack();
+}
+
+/*
+    Every CPU in the check reads the TSC in turn under a lock for
+    TSC_WARP_CHECK_MS, a read below the one before it (taken on another
+    CPU, or the lock would be pointless) means the TSCs aren't in step
+    NOTE: interrupts off, same time budget on every CPU
+*/
+static void _tsc_warp_check() {
+    u32 khz = tsc_get_khz();
+    if (khz == 0) return;
+
+    u64 end = rdtsc() + (u64)khz * TSC_WARP_CHECK_MS;
+    while (true) {
+        spin_lock(&tsc_check_lock);
+        u64 prev = tsc_check_last;
+        u64 now = rdtsc();
+        tsc_check_last = now;
+        if (now < prev && prev - now > tsc_max_warp)
+            tsc_max_warp = prev - now;
+        spin_unlock(&tsc_check_lock);
+
+        if (now > end) break;
+        cpu_relax();
+    }
+}
+
+/*
+    First C code of an AP, on the stack ap_entry picked for it: finishes
+    the CPU setup the boot CPU did in arch_kmain, then only takes
+    interrupts
+*/
+void ap_main(u32 cpu) {
+    write_cr4(bsp_cr4);
+    if (cpu_has(X86_FEATURE_FPU)) asm volatile("fninit");
+    load_idt();
+    pat_init();
+    lapic_setup();
+
+    u32 apic_id = lapic_id();
+    cpu_apic_ids[cpu] = apic_id;
+    apic_to_cpu[apic_id] = cpu;
+    __atomic_fetch_add(&cpus_online, 1, __ATOMIC_RELEASE);
+
+    while (!__atomic_load_n(&tsc_check_go, __ATOMIC_ACQUIRE)) cpu_relax();
+    _tsc_warp_check();
+    __atomic_fetch_add(&tsc_check_done, 1, __ATOMIC_RELEASE);
+
+    while (true) asm volatile("sti; hlt" ::: "memory");
+}
+
+/*
+    Runs the warp check on all CPUs at once & takes the TSC out of
+    ktime_get_ns() if it saw time go back, before any AP reads the clock
+    NOTE: APs that came up after the boot window shut still run it but
+    aren't waited for
+*/
+static void _tsc_sync_check() {
+    __atomic_store_n(&tsc_check_go, 1, __ATOMIC_RELEASE);
+    _tsc_warp_check();
+
+    for (u32 waited = 0; waited < SMP_BOOT_TIMEOUT_US; waited += 100) {
+        if (__atomic_load_n(&tsc_check_done, __ATOMIC_ACQUIRE) >= num_cpus - 1)
+            break;
+        udelay(100);
+    }
+
+    spin_lock(&tsc_check_lock);
+    u64 warp = tsc_max_warp;
+    spin_unlock(&tsc_check_lock);
+    if (warp == 0) return;
+
+    klog(KLOG_WARNING, "SMP: TSC went back %llu cycles between CPUs\n", warp);
+    clocksource_mark_tsc_unsynced();
+}
+
+static void _copy_trampoline() {
+    u8* base = PHYS_TO_VIRT(TRAMPOLINE_BASE);
+    memcpy(base, trampoline_start, trampoline_end - trampoline_start);
+    asm volatile("sgdt (%0)" ::"r"(base + (trampoline_gdt - trampoline_start))
+                 : "memory");
+}
+
+/*
+    Starts every other CPU (INIT, then 2 SIPIs per the MP spec) & waits
+    for the ones the MADT lists to check in, SMP_BOOT_TIMEOUT_US at most
+    (the whole time without a MADT), CPUs past MAX_CPUS park in the
+    trampoline
+    NOTE: after apic_init(), before any IRQ is requested so they can be
+    spread over all CPUs
+*/
+void smp_init() {
+    cpu_apic_ids[0] = lapic_id();
+    apic_to_cpu[cpu_apic_ids[0]] = 0;
+    if (!lapic_active()) return;
+
+    request_vector(IPI_WAKE_VECTOR, _wake_ipi, "wake IPI", NULL);
+    request_vector(IPI_TLB_FLUSH_VECTOR, _tlb_flush_ipi, "TLB shootdown",
+                   NULL);
+
+    for (u32 cpu = 1; cpu < MAX_CPUS; cpu++) {
+        phys_addr_t stack = pmm_alloc_frames(AP_STACK_ORDER);
+        if (stack == 0) break;
+        ap_stacks[cpu] = (u32)PHYS_TO_VIRT(stack) + KRNL_STACK_SIZE;
+    }
+
+    _copy_trampoline();
+    bsp_cr4 = read_cr4();
+    ap_cr0 = read_cr0();
+    ap_cr3 = read_cr3();
+    ap_cr4 = bsp_cr4 & ~CR4_PGE;
+    ap_efer = paging_has_nx() ? EFER_NXE : 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    lapic_broadcast_ipi(APIC_DM_INIT | ICR_ASSERT);
+    udelay(SMP_INIT_DELAY_US);
+    for (int i = 0; i < 2; i++) {
+        lapic_broadcast_ipi(APIC_DM_STARTUP | (TRAMPOLINE_BASE >> PAGE_SHIFT));
+        udelay(SMP_SIPI_DELAY_US);
+    }
+
+    u32 expected = MAX_CPUS;
+    if (acpi_info.has_madt && acpi_info.num_cpus < MAX_CPUS)
+        expected = acpi_info.num_cpus;
+    for (u32 waited = 0; waited < SMP_BOOT_TIMEOUT_US; waited += 100) {
+        if (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) >= expected)
+            break;
+        udelay(100);
+    }
+
+    // Shuts the boot window: the exchange & the APs' xadd hit the same
+    // word, an AP either got its number before (it keeps its stack & is
+    // waited for) or gets one past SMP_AP_CLOSED & parks
+    u32 taken = __atomic_exchange_n(&ap_next, SMP_AP_CLOSED, __ATOMIC_ACQ_REL);
+    u32 claimed = (taken < MAX_CPUS) ? taken : MAX_CPUS;
+    for (u32 waited = 0; waited < SMP_BOOT_TIMEOUT_US; waited += 100) {
+        if (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) >= claimed)
+            break;
+        udelay(100);
+    }
+    num_cpus = __atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE);
+    if (num_cpus < claimed)
+        klog(KLOG_WARNING, "SMP: %u CPU(s) took a stack but never came up\n",
+             claimed - num_cpus);
+
+    for (u32 cpu = claimed; cpu < MAX_CPUS; cpu++) {
+        u32 stack = ap_stacks[cpu];
+        ap_stacks[cpu] = 0;
+        if (stack != 0)
+            pmm_free_frames(VIRT_TO_PHYS((void*)(stack - KRNL_STACK_SIZE)),
+                            AP_STACK_ORDER);
+    }
+
+    _tsc_sync_check();
+
+    klog(KLOG_INFO, "SMP: %u CPU(s) online\n", num_cpus);
+    if (taken > MAX_CPUS)
+        klog(KLOG_WARNING, "SMP: %u CPU(s) past MAX_CPUS parked\n",
+             taken - MAX_CPUS);
+}
+
+u32 smp_num_cpus() { return num_cpus; }
+
+u32 smp_cpu_apic_id(u32 cpu) { return cpu_apic_ids[cpu]; }
+
+/*
+    Makes cpu leave hlt if it's idle, for work left to it by an interrupt
+    taken elsewhere
+    NOTE: the fence pairs with the one in cpu_idle(), either it sees the
+    work before halting or this sees it halted
+*/
+void smp_wake_cpu(u32 cpu) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (cpu_halted(cpu))
+        lapic_send_ipi(cpu_apic_ids[cpu], APIC_DM_FIXED | IPI_WAKE_VECTOR);
+}
+
+/*
+    flush_tlb_all() on every online CPU, returns once all of them did:
+    only then may unmapped frames or addresses be reused
+    - Shootdowns are serialized, a CPU waiting for tlb_lock still answers
+      the holder's request so two of them never wait on each other
+    NOTE: the caller must not hold a lock other CPUs may spin on with
+    interrupts off, they couldn't take the IPI
+*/
+void smp_flush_tlb_all() {
+    flush_tlb_all();
+    if (num_cpus == 1) return;
+
+    u32 flags = local_irq_save();
+    while (!spin_trylock(&tlb_lock)) {
+        _tlb_ack();
+        cpu_relax();
+    }
+
+    u32 self = smp_cpu_id();
+    for (u32 cpu = 0; cpu < num_cpus; cpu++)
+        if (cpu != self) tlb_pending[cpu] = 1;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    lapic_broadcast_ipi(APIC_DM_FIXED | IPI_TLB_FLUSH_VECTOR);
+
+    for (u32 cpu = 0; cpu < num_cpus; cpu++)
+        while (__atomic_load_n(&tlb_pending[cpu], __ATOMIC_ACQUIRE))
+            cpu_relax();
+
+    spin_unlock(&tlb_lock);
+    local_irq_restore(flags);
+}
+
+void smp_print_info() {
+    kprintf("SMP: %u CPU(s) online, APIC ids:", num_cpus);
+    for (u32 cpu = 0; cpu < num_cpus; cpu++)
+        kprintf(" %u", cpu_apic_ids[cpu]);
+    kputs("\n");
+}
@@ -0,0 +1,501 @@
+#include <arch/i386/cpu.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/string_ops.h>
+#include <lib/printf.h>
+
+#define BYTE_PATTERN(c) ((u8)(c) * 0x01010101u)
+
+static bool has_sse2 = false;
+static bool has_erms = false;
+
+// Fastest of each op on this CPU, filled by string_init()
+static struct string_ops best_ops;
+static char best_name[16];
+
+/*
+    =================
+        rep / erms
+    =================
+*/
+static void* _rep_memcpy(void* dest, const void* src, size_t count) {
+    void* d = dest;
+    size_t words = count >> 2;
+    asm volatile(
+        "rep movsl\n\t"
+        "movl %3, %%ecx\n\t"
+        "rep movsb"
+        : "+D"(d), "+S"(src), "+c"(words)
+        : "r"(count & 3)
+        : "memory");
+
+    return dest;
+}
+
+static void* _rep_memmove(void* dest, const void* src, size_t count) {
+    if ((u8*)dest <= (const u8*)src || (u8*)dest >= (const u8*)src + count)
+        return _rep_memcpy(dest, src, count);
+
+    // dest overlaps the end of src: copy down from the last byte
+    u8* d = (u8*)dest + count - 1;
+    const u8* s = (const u8*)src + count - 1;
+    size_t bytes = count & 3;
+    asm volatile(
+        "std\n\t"
+        "rep movsb\n\t"
+        "subl $3, %%esi\n\t"
+        "subl $3, %%edi\n\t"
+        "movl %3, %%ecx\n\t"
+        "rep movsl\n\t"
+        "cld"
+        : "+D"(d), "+S"(s), "+c"(bytes)
+        : "r"(count >> 2)
+        : "memory");
+
+    return dest;
+}
+
+static void* _rep_memset(void* dest, int c, size_t count) {
+    void* d = dest;
+    size_t words = count >> 2;
+    asm volatile(
+        "rep stosl\n\t"
+        "movl %3, %%ecx\n\t"
+        "rep stosb"
+        : "+D"(d), "+c"(words)
+        : "a"(BYTE_PATTERN(c)), "r"(count & 3)
+        : "memory");
+
+    return dest;
+}
+
+static int _rep_memcmp(const void* ptr1, const void* ptr2, size_t count) {
+    if (count == 0) return 0;
+
+    const u8* a = (const u8*)ptr1;
+    const u8* b = (const u8*)ptr2;
+    asm volatile("repe cmpsb"
+                 : "+S"(a), "+D"(b), "+c"(count)
+                 :
+                 : "memory", "cc");
+
+    // Both stop one past the last pair compared
+    if (a[-1] == b[-1]) return 0;
+    return (a[-1] < b[-1]) ? -1 : 1;
+}
+
+static size_t _rep_strlen(const char* str) {
+    size_t count = (size_t)-1;
+    asm volatile("repne scasb"
+                 : "+D"(str), "+c"(count)
+                 : "a"(0)
+                 : "memory", "cc");
+
+    return ~count - 1;
+}
+
+static char* _rep_strchr(const char* str, int c) {
+    size_t count = _rep_strlen(str) + 1;
+    asm volatile("repne scasb"
+                 : "+D"(str), "+c"(count)
+                 : "a"(c)
+                 : "memory", "cc");
+
+    return (str[-1] == (char)c) ? (char*)str - 1 : NULL;
+}
+
+static void* _erms_memcpy(void* dest, const void* src, size_t count) {
+    void* d = dest;
+    asm volatile("rep movsb"
+                 : "+D"(d), "+S"(src), "+c"(count)
+                 :
+                 : "memory");
+
+    return dest;
+}
+
+// Backward copies run with DF set, which turns off fast strings anyway
+static void* _erms_memmove(void* dest, const void* src, size_t count) {
+    if ((u8*)dest <= (const u8*)src || (u8*)dest >= (const u8*)src + count)
+        return _erms_memcpy(dest, src, count);
+
+    return _rep_memmove(dest, src, count);
+}
+
+static void* _erms_memset(void* dest, int c, size_t count) {
+    void* d = dest;
+    asm volatile("rep stosb" : "+D"(d), "+c"(count) : "a"(c) : "memory");
+
+    return dest;
+}
+
+/*
+    ============
+        SSE2
+    ============
+*/
+#define SSE2_COPY_BLOCKS(load, store)  \
+    "1:\n\t"                           \
+    load " (%1), %%xmm0\n\t"           \
+    load " 16(%1), %%xmm1\n\t"         \
+    load " 32(%1), %%xmm2\n\t"         \
+    load " 48(%1), %%xmm3\n\t"         \
+    store " %%xmm0, (%0)\n\t"          \
+    store " %%xmm1, 16(%0)\n\t"        \
+    store " %%xmm2, 32(%0)\n\t"        \
+    store " %%xmm3, 48(%0)\n\t"        \
+    "addl $64, %0\n\t"                 \
+    "addl $64, %1\n\t"                 \
+    "decl %2\n\t"                      \
+    "jnz 1b"
+
+// 64 B blocks up from 16 B aligned dest
+static void _sse2_copy_up(void* dest, const void* src, size_t blocks,
+                          bool nt) {
+    u32 flags = local_irq_save();
+    if (nt) {
+        asm volatile(SSE2_COPY_BLOCKS("movdqu", "movntdq")
+                     : "+r"(dest), "+r"(src), "+r"(blocks)
+                     :
+                     : "memory", "cc");
+    } else {
+        asm volatile(SSE2_COPY_BLOCKS("movdqu", "movdqa")
+                     : "+r"(dest), "+r"(src), "+r"(blocks)
+                     :
+                     : "memory", "cc");
+    }
+    local_irq_restore(flags);
+}
+
+// 64 B blocks down from 16 B aligned dest_end, each loaded before stored
+static void _sse2_copy_down(void* dest_end, const void* src_end,
+                            size_t blocks) {
+    u32 flags = local_irq_save();
+    asm volatile(
+        "1:\n\t"
+        "subl $64, %0\n\t"
+        "subl $64, %1\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu 32(%1), %%xmm2\n\t"
+        "movdqu 48(%1), %%xmm3\n\t"
+        "movdqa %%xmm0, (%0)\n\t"
+        "movdqa %%xmm1, 16(%0)\n\t"
+        "movdqa %%xmm2, 32(%0)\n\t"
+        "movdqa %%xmm3, 48(%0)\n\t"
+        "decl %2\n\t"
+        "jnz 1b"
+        : "+r"(dest_end), "+r"(src_end), "+r"(blocks)
+        :
+        : "memory", "cc");
+    local_irq_restore(flags);
+}
+
+static void* _sse2_memcpy(void* dest, const void* src, size_t count) {
+    if (count < STRING_SSE2_MIN) return _rep_memcpy(dest, src, count);
+
+    // Align the stores, loads take whatever src gives
+    u8* d = (u8*)dest;
+    const u8* s = (const u8*)src;
+    size_t head = -(size_t)d & 15;
+    _rep_memcpy(d, s, head);
+    d += head;
+    s += head;
+    count -= head;
+
+    // Copies bigger than the caches would only evict useful lines
+    bool nt = count >= STRING_SSE2_NT_MIN;
+    while (count >= 64) {
+        size_t chunk = count & ~(size_t)63;
+        if (chunk > STRING_SSE2_CHUNK) chunk = STRING_SSE2_CHUNK;
+
+        _sse2_copy_up(d, s, chunk / 64, nt);
+        d += chunk;
+        s += chunk;
+        count -= chunk;
+    }
+    if (nt) asm volatile("sfence" ::: "memory");
+
+    _rep_memcpy(d, s, count);
+    return dest;
+}
+
+static void* _sse2_memmove(void* dest, const void* src, size_t count) {
+    if ((u8*)dest <= (const u8*)src || (u8*)dest >= (const u8*)src + count)
+        return _sse2_memcpy(dest, src, count);
+    if (count < STRING_SSE2_MIN) return _rep_memmove(dest, src, count);
+
+    u8* d = (u8*)dest + count;
+    const u8* s = (const u8*)src + count;
+    size_t tail = (size_t)d & 15;
+    d -= tail;
+    s -= tail;
+    count -= tail;
+    _rep_memmove(d, s, tail);
+
+    while (count >= 64) {
+        size_t chunk = count & ~(size_t)63;
+        if (chunk > STRING_SSE2_CHUNK) chunk = STRING_SSE2_CHUNK;
+
+        _sse2_copy_down(d, s, chunk / 64);
+        d -= chunk;
+        s -= chunk;
+        count -= chunk;
+    }
+
+    _rep_memmove(dest, src, count);
+    return dest;
+}
+
+static void* _sse2_memset(void* dest, int c, size_t count) {
+    if (count < STRING_SSE2_MIN) return _rep_memset(dest, c, count);
+
+    u8* d = (u8*)dest;
+    size_t head = -(size_t)d & 15;
+    _rep_memset(d, c, head);
+    d += head;
+    count -= head;
+
+    u32 pattern[4];
+    for (int i = 0; i < 4; i++) pattern[i] = BYTE_PATTERN(c);
+
+    bool nt = count >= STRING_SSE2_NT_MIN;
+    while (count >= 64) {
+        size_t chunk = count & ~(size_t)63;
+        if (chunk > STRING_SSE2_CHUNK) chunk = STRING_SSE2_CHUNK;
+        size_t blocks = chunk / 64;
+
+        u32 flags = local_irq_save();
+        if (nt) {
+            asm volatile(
+                "movdqu (%2), %%xmm0\n\t"
+                "1:\n\t"
+                "movntdq %%xmm0, (%0)\n\t"
+                "movntdq %%xmm0, 16(%0)\n\t"
+                "movntdq %%xmm0, 32(%0)\n\t"
+                "movntdq %%xmm0, 48(%0)\n\t"
+                "addl $64, %0\n\t"
+                "decl %1\n\t"
+                "jnz 1b"
+                : "+r"(d), "+r"(blocks)
+                : "r"(pattern)
+                : "memory", "cc");
+        } else {
+            asm volatile(
+                "movdqu (%2), %%xmm0\n\t"
+                "1:\n\t"
+                "movdqa %%xmm0, (%0)\n\t"
+                "movdqa %%xmm0, 16(%0)\n\t"
+                "movdqa %%xmm0, 32(%0)\n\t"
+                "movdqa %%xmm0, 48(%0)\n\t"
+                "addl $64, %0\n\t"
+                "decl %1\n\t"
+                "jnz 1b"
+                : "+r"(d), "+r"(blocks)
+                : "r"(pattern)
+                : "memory", "cc");
+        }
+        local_irq_restore(flags);
+        count -= chunk;
+    }
+    if (nt) asm volatile("sfence" ::: "memory");
+
+    _rep_memset(d, c, count);
+    return dest;
+}
+
+static int _sse2_memcmp(const void* ptr1, const void* ptr2, size_t count) {
+    if (count < STRING_SSE2_MIN)
+        return string_word_ops.memcmp(ptr1, ptr2, count);
+
+    const u8* a = (const u8*)ptr1;
+    const u8* b = (const u8*)ptr2;
+
+    while (count >= 16) {
+        size_t chunk = count & ~(size_t)15;
+        if (chunk > STRING_SSE2_CHUNK) chunk = STRING_SSE2_CHUNK;
+
+        // Stops at the first 16 B with a differing byte (mask != 0xFFFF)
+        size_t off = 0;
+        u32 mask;
+        u32 flags = local_irq_save();
+        asm volatile(
+            "1:\n\t"
+            "movdqu (%2,%1), %%xmm0\n\t"
+            "movdqu (%3,%1), %%xmm1\n\t"
+            "pcmpeqb %%xmm1, %%xmm0\n\t"
+            "pmovmskb %%xmm0, %0\n\t"
+            "cmpl $0xFFFF, %0\n\t"
+            "jne 2f\n\t"
+            "addl $16, %1\n\t"
+            "cmpl %4, %1\n\t"
+            "jb 1b\n"
+            "2:"
+            : "=&r"(mask), "+r"(off)
+            : "r"(a), "r"(b), "r"(chunk)
+            : "memory", "cc");
+        local_irq_restore(flags);
+
+        if (mask != 0xFFFF) {
+            off += __builtin_ctz(~mask);
+            return (a[off] < b[off]) ? -1 : 1;
+        }
+        a += chunk;
+        b += chunk;
+        count -= chunk;
+    }
+
+    return _rep_memcmp(a, b, count);
+}
+
+/*
+    Scans str for c or the terminator
+    - Loads are 16 B aligned so they never cross into the next (possibly
+      unmapped) page, bytes before str are masked off
+    Returns the match mask of the first block with a match, *str is set to
+    that block
+*/
+static u32 _sse2_scan(const char** str, int c) {
+    const char* block = (const char*)((size_t)*str & ~(size_t)15);
+    u32 keep = ~0u << ((size_t)*str & 15);
+
+    u32 pattern[4];
+    for (int i = 0; i < 4; i++) pattern[i] = BYTE_PATTERN(c);
+
+    u32 mask = 0;
+    while (mask == 0) {
+        size_t blocks = STRING_SSE2_CHUNK / 16;
+
+        u32 flags = local_irq_save();
+        asm volatile(
+            "movdqu (%4), %%xmm2\n\t"
+            "pxor %%xmm3, %%xmm3\n\t"
+            "1:\n\t"
+            "movdqa (%1), %%xmm0\n\t"
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "pcmpeqb %%xmm2, %%xmm0\n\t"
+            "pcmpeqb %%xmm3, %%xmm1\n\t"
+            "por %%xmm1, %%xmm0\n\t"
+            "pmovmskb %%xmm0, %0\n\t"
+            "andl %3, %0\n\t"
+            "jnz 2f\n\t"
+            "movl $-1, %3\n\t"
+            "addl $16, %1\n\t"
+            "decl %2\n\t"
+            "jnz 1b\n"
+            "2:"
+            : "=&r"(mask), "+r"(block), "+r"(blocks), "+r"(keep)
+            : "r"(pattern)
+            : "memory", "cc");
+        local_irq_restore(flags);
+    }
+
+    *str = block;
+    return mask;
+}
+
+/*
+    First STRING_SSE2_MIN bytes of a scan, one at a time: most strings end
+    in them, before an interrupts off window would pay off
+    Returns the first c or terminator, NULL if there's neither
+*/
+static const char* _scan_head(const char* str, int c) {
+    for (size_t i = 0; i < STRING_SSE2_MIN; i++, str++) {
+        if (*str == (char)c || *str == '\0') return str;
+    }
+
+    return NULL;
+}
+
+static size_t _sse2_strlen(const char* str) {
+    const char* block = _scan_head(str, 0);
+    if (block != NULL) return block - str;
+
+    block = str + STRING_SSE2_MIN;
+    u32 mask = _sse2_scan(&block, 0);
+
+    return block + __builtin_ctz(mask) - str;
+}
+
+static char* _sse2_strchr(const char* str, int c) {
+    const char* head = _scan_head(str, c);
+    if (head != NULL) return (*head == (char)c) ? (char*)head : NULL;
+
+    str += STRING_SSE2_MIN;
+    u32 mask = _sse2_scan(&str, c);
+    str += __builtin_ctz(mask);
+
+    return (*str == (char)c) ? (char*)str : NULL;
+}
+
+const struct string_ops string_rep_ops = {
+    "rep",        _rep_memcpy, _rep_memmove, _rep_memset,
+    _rep_memcmp,  _rep_strlen, _rep_strchr,
+};
+
+// Scans have no fast string form, they stay rep
+const struct string_ops string_erms_ops = {
+    "erms",       _erms_memcpy, _erms_memmove, _erms_memset,
+    _rep_memcmp,  _rep_strlen,  _rep_strchr,
+};
+
+const struct string_ops string_sse2_ops = {
+    "sse2",        _sse2_memcpy, _sse2_memmove, _sse2_memset,
+    _sse2_memcmp,  _sse2_strlen, _sse2_strchr,
+};
+
+/*
+    Copies & fills: ERMS matches SSE2 without touching xmm registers (or
+    turning interrupts off), then SSE2, then rep movsd
+*/
+static const struct cpu_impl bulk_impls[] = {
+    {X86_FEATURE_ERMS, "erms", {.string_ops = &string_erms_ops}},
+    {X86_FEATURE_SSE2, "sse2", {.string_ops = &string_sse2_ops}},
+    {CPU_FEATURE_NONE, "rep", {.string_ops = &string_rep_ops}},
+};
+
+// Compares & scans: SSE2 checks 16 B per step, the word versions beat
+// the byte at a time rep forms
+static const struct cpu_impl scan_impls[] = {
+    {X86_FEATURE_SSE2, "sse2", {.string_ops = &string_sse2_ops}},
+    {CPU_FEATURE_NONE, "word", {.string_ops = &string_word_ops}},
+};
+
+// Picks the fastest implementation of each op once, from cached CPUID
+void string_init() {
+    has_sse2 = has_cpu_SSE2();
+    has_erms = has_cpu_ERMS();
+
+    if (has_sse2) {
+        // No x87 emulation, SSE on & its exceptions raised as #XM
+        write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    }
+
+    const struct cpu_impl* bulk = cpu_select(bulk_impls);
+    const struct cpu_impl* scan = cpu_select(scan_impls);
+    const struct string_ops* scan_ops = scan->fn.string_ops;
+
+    best_ops = *bulk->fn.string_ops;
+    if (bulk->fn.string_ops == scan_ops)
+        snprintf(best_name, sizeof(best_name), "%s", bulk->name);
+    else
+        snprintf(best_name, sizeof(best_name), "%s+%s", bulk->name,
+                 scan->name);
+    best_ops.name = best_name;
+    best_ops.memcmp = scan_ops->memcmp;
+    best_ops.strlen = scan_ops->strlen;
+    best_ops.strchr = scan_ops->strchr;
+
+    string_set_ops(&best_ops);
+}
+
+// Implementations this CPU can run, impls needs STRING_MAX_IMPLS slots
+size_t string_get_impls(const struct string_ops** impls) {
+    size_t count = 0;
+    impls[count++] = &string_word_ops;
+    impls[count++] = &string_rep_ops;
+    if (has_erms) impls[count++] = &string_erms_ops;
+    if (has_sse2) impls[count++] = &string_sse2_ops;
+
+    return count;
+}
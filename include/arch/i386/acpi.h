@@ -0,0 +1,295 @@
+#pragma once
+
+#include <arch/i386/memlayout.h>
+#include <arch/i386/smp.h>
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    https://wiki.osdev.org/RSDP, ACPI 6.5 chapter 5.2
+    Firmware tables are found once at boot: the RSDP (from multiboot2, else
+    the BIOS areas) leads to the XSDT/RSDT, every table is mapped & its
+    checksum checked once, then indexed by signature in a small hash
+    - The tables the kernel uses (MADT, HPET, FADT, MCFG) are parsed into
+      acpi_info at the same time, lookups never touch firmware memory
+    - Only the first table of a signature is indexed (SSDTs repeat)
+*/
+#define ACPI_SIG(a, b, c, d) \
+    ((u32)(a) | ((u32)(b) << 8) | ((u32)(c) << 16) | ((u32)(d) << 24))
+#define ACPI_SIG_MADT ACPI_SIG('A', 'P', 'I', 'C')
+#define ACPI_SIG_HPET ACPI_SIG('H', 'P', 'E', 'T')
+#define ACPI_SIG_FADT ACPI_SIG('F', 'A', 'C', 'P')
+#define ACPI_SIG_MCFG ACPI_SIG('M', 'C', 'F', 'G')
+#define ACPI_SIG_DSDT ACPI_SIG('D', 'S', 'D', 'T')
+
+#define ACPI_RSDP_SIG "RSD PTR "
+#define ACPI_RSDP_V1_LEN 20
+#define ACPI_EBDA_PTR 0x40E /* real mode segment of the EBDA */
+#define ACPI_EBDA_SCAN 1024
+#define ACPI_BIOS_START 0xE0000
+#define ACPI_BIOS_END 0x100000
+#define ACPI_RSDP_ALIGN 16
+
+#define ACPI_MAX_TABLES 32
+#define ACPI_HASH_BITS 6 /* 64 slots, at most half full */
+#define ACPI_HASH_SIZE (1 << ACPI_HASH_BITS)
+#define ACPI_MAX_IOAPICS 4
+#define ACPI_MAX_MCFG 4
+
+struct acpi_rsdp {
+    char sig[8];
+    u8 checksum;
+    char oem_id[6];
+    u8 revision;
+    u32 rsdt_addr;
+    // ACPI 2.0+
+    u32 length;
+    u64 xsdt_addr;
+    u8 ext_checksum;
+    u8 reserved[3];
+} __attribute__((packed));
+
+struct acpi_sdt_header {
+    char sig[4];
+    u32 length;
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    u32 creator_id;
+    u32 creator_revision;
+} __attribute__((packed));
+
+// Generic address structure
+struct acpi_gas {
+    u8 space_id;
+    u8 bit_width;
+    u8 bit_offset;
+    u8 access_size;
+    u64 address;
+} __attribute__((packed));
+
+#define ACPI_SPACE_MEMORY 0
+#define ACPI_SPACE_IO 1
+
+// MADT
+struct acpi_madt {
+    struct acpi_sdt_header hdr;
+    u32 lapic_addr;
+    u32 flags;
+} __attribute__((packed));
+
+#define MADT_PCAT_COMPAT (1 << 0) /* dual 8259s present */
+
+enum madt_entry_type {
+    MADT_LAPIC = 0,
+    MADT_IOAPIC = 1,
+    MADT_INT_OVERRIDE = 2,
+    MADT_LAPIC_NMI = 4,
+    MADT_LAPIC_ADDR = 5,
+};
+
+struct madt_entry {
+    u8 type;
+    u8 length;
+} __attribute__((packed));
+
+struct madt_lapic {
+    struct madt_entry hdr;
+    u8 processor_id;
+    u8 apic_id;
+    u32 flags;
+} __attribute__((packed));
+
+#define MADT_LAPIC_ENABLED (1 << 0)
+
+struct madt_ioapic {
+    struct madt_entry hdr;
+    u8 ioapic_id;
+    u8 reserved;
+    u32 addr;
+    u32 gsi_base;
+} __attribute__((packed));
+
+struct madt_int_override {
+    struct madt_entry hdr;
+    u8 bus;
+    u8 source; /* ISA IRQ */
+    u32 gsi;
+    u16 flags;
+} __attribute__((packed));
+
+struct madt_lapic_addr {
+    struct madt_entry hdr;
+    u16 reserved;
+    u64 addr;
+} __attribute__((packed));
+
+// MPS INTI flags (interrupt overrides), 0 = what the bus does
+#define MPS_POLARITY_MASK 0x3
+#define MPS_ACTIVE_LOW 0x3
+#define MPS_TRIGGER_MASK 0xC
+#define MPS_LEVEL 0xC
+
+// HPET
+struct acpi_hpet {
+    struct acpi_sdt_header hdr;
+    u32 block_id;
+    struct acpi_gas base;
+    u8 number;
+    u16 min_tick;
+    u8 page_protection;
+} __attribute__((packed));
+
+#define HPET_ID_COMPARATORS(id) ((((id) >> 8) & 0x1F) + 1)
+#define HPET_ID_64BIT (1 << 13)
+
+// FADT, up to the fields used (older tables end earlier, see length)
+struct acpi_fadt {
+    struct acpi_sdt_header hdr;
+    u32 firmware_ctrl;
+    u32 dsdt;
+    u8 reserved;
+    u8 pm_profile;
+    u16 sci_irq;
+    u32 smi_cmd;
+    u8 acpi_enable;
+    u8 acpi_disable;
+    u8 s4bios_req;
+    u8 pstate_cnt;
+    u32 pm1a_evt_blk;
+    u32 pm1b_evt_blk;
+    u32 pm1a_cnt_blk;
+    u32 pm1b_cnt_blk;
+    u32 pm2_cnt_blk;
+    u32 pm_tmr_blk;
+    u32 gpe0_blk;
+    u32 gpe1_blk;
+    u8 pm1_evt_len;
+    u8 pm1_cnt_len;
+    u8 pm2_cnt_len;
+    u8 pm_tmr_len;
+    u8 gpe0_blk_len;
+    u8 gpe1_blk_len;
+    u8 gpe1_base;
+    u8 cst_cnt;
+    u16 p_lvl2_lat;
+    u16 p_lvl3_lat;
+    u16 flush_size;
+    u16 flush_stride;
+    u8 duty_offset;
+    u8 duty_width;
+    u8 day_alarm;
+    u8 mon_alarm;
+    u8 century;
+    u16 boot_arch;
+    u8 reserved2;
+    u32 flags;
+    struct acpi_gas reset_reg;
+    u8 reset_value;
+    u16 arm_boot_arch;
+    u8 minor_version;
+    u64 x_firmware_ctrl;
+    u64 x_dsdt;
+} __attribute__((packed));
+
+#define FADT_TMR_VAL_EXT (1 << 8) /* 32-bit PM timer, else 24 */
+#define FADT_RESET_REG_SUP (1 << 10)
+#define FADT_BOOT_8042 (1 << 1)
+
+#define ACPI_PM1_SCI_EN (1 << 0)
+#define ACPI_PM1_SLP_TYP_SHIFT 10
+#define ACPI_PM1_SLP_EN (1 << 13)
+#define ACPI_PM_TIMER_HZ 3579545
+#define ACPI_ENABLE_TIMEOUT_US 3000000
+
+// AML bytes around \_S5 (sleep type values for soft off)
+#define AML_NAME_OP 0x08
+#define AML_PACKAGE_OP 0x12
+#define AML_BYTE_PREFIX 0x0A
+#define AML_ONE_OP 0x01
+
+// MCFG
+struct acpi_mcfg {
+    struct acpi_sdt_header hdr;
+    u64 reserved;
+} __attribute__((packed));
+
+struct mcfg_entry {
+    u64 base;
+    u16 segment;
+    u8 start_bus;
+    u8 end_bus;
+    u32 reserved;
+} __attribute__((packed));
+
+#define PCI_ECAM_BUS_SHIFT 20
+
+struct acpi_table {
+    u32 sig;
+    u32 length;
+    phys_addr_t phys;
+    const struct acpi_sdt_header* hdr;
+};
+
+struct acpi_ioapic_info {
+    u8 id;
+    u32 addr;
+    u32 gsi_base;
+};
+
+struct acpi_isa_irq {
+    u32 gsi;
+    u16 flags; /* MPS INTI */
+};
+
+struct acpi_info {
+    bool present;
+    u8 revision;
+    size_t num_tables;
+
+    // MADT
+    bool has_madt;
+    u32 lapic_addr;
+    bool pcat_compat;
+    u32 num_cpus; /* enabled ones, can be past MAX_CPUS */
+    u8 cpu_apic_ids[MAX_CPUS];
+    u32 num_ioapics;
+    struct acpi_ioapic_info ioapics[ACPI_MAX_IOAPICS];
+    struct acpi_isa_irq isa_irqs[16]; /* identity unless overridden */
+
+    // HPET
+    bool has_hpet;
+    phys_addr_t hpet_addr;
+    u32 hpet_comparators;
+    u16 hpet_min_tick;
+
+    // FADT
+    bool has_fadt;
+    u16 sci_irq;
+    u16 pm_timer_port; /* 0 if none */
+    bool pm_timer_32bit;
+    u16 pm1a_cnt;
+    u16 pm1b_cnt;
+    u32 smi_cmd;
+    u8 acpi_enable;
+    u16 boot_arch;
+    bool has_s5;
+    u8 slp_typa;
+    u8 slp_typb;
+
+    // MCFG
+    u32 num_mcfg;
+    struct mcfg_entry mcfg[ACPI_MAX_MCFG];
+};
+
+extern struct acpi_info acpi_info;
+
+bool acpi_init();
+const struct acpi_sdt_header* acpi_find_table(u32 sig);
+phys_addr_t acpi_pci_ecam(u16 segment, u8 bus);
+u32 acpi_pm_timer_read();
+bool acpi_shutdown();
+void acpi_print_info();
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    https://wiki.osdev.org/APIC
+    Local APIC (xAPIC, MMIO), one per CPU: interrupt acceptance, EOI &
+    inter-processor interrupts
+    - Registers are 32 bits on 16 byte boundaries, mapped UC
+    - EOI is one MMIO write, no port I/O on the interrupt path
+*/
+#define MSR_APIC_BASE 0x1B
+#define APIC_BASE_BSP (1 << 8)
+#define APIC_BASE_ENABLE (1 << 11)
+#define APIC_BASE_ADDR_MASK 0xFFFFF000
+
+// Register offsets
+#define LAPIC_ID 0x20
+#define LAPIC_VERSION 0x30
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_THERMAL 0x330
+#define LAPIC_LVT_PERF 0x340
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+
+#define LAPIC_SVR_ENABLE (1 << 8)
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_ID_SHIFT 24
+#define LAPIC_MAX_LVT(ver) (((ver) >> 16) & 0xFF)
+#define LAPIC_LVT_PERF_MIN 4 /* max LVT index once it has the entry */
+#define LAPIC_LVT_THERMAL_MIN 5
+
+// Delivery modes, same bits in the ICR & LVT entries
+#define APIC_DM_FIXED (0 << 8)
+#define APIC_DM_NMI (4 << 8)
+#define APIC_DM_INIT (5 << 8)
+#define APIC_DM_STARTUP (6 << 8)
+#define APIC_DM_EXTINT (7 << 8)
+
+// ICR (low dword) fields
+#define ICR_PENDING (1 << 12) /* delivery status */
+#define ICR_ASSERT (1 << 14)
+#define ICR_ALL_BUT_SELF (3 << 18)
+#define ICR_DEST_SHIFT 24 /* high dword */
+
+#define LAPIC_IPI_TIMEOUT_US 1000
+
+/*
+    Vectors the local APIC delivers itself, above every device IRQ
+    NOTE: the spurious vector's low 4 bits must be set on old APICs
+*/
+#define IPI_WAKE_VECTOR 0xF0
+#define IPI_TLB_FLUSH_VECTOR 0xF1
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/*
+    I/O APIC: routes each global system interrupt (GSI, one per input pin)
+    to a vector on a chosen CPU, replacing the 8259 pair
+    - Indirect registers: select in IOREGSEL, access through IOWIN
+    - The MADT gives its address & the ISA IRQs it moved (IRQ 0 is often
+      on pin 2), without one it's assumed at the default with IRQ n on
+      pin n
+*/
+#define IOAPIC_DEFAULT_BASE 0xFEC00000
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WIN 0x10
+
+#define IOAPIC_REG_ID 0x00
+#define IOAPIC_REG_VERSION 0x01
+#define IOAPIC_REG_REDIR(pin) (0x10 + 2 * (pin))
+#define IOAPIC_MAX_PINS_SHIFT 16
+
+#define IOAPIC_LEVEL (1 << 15)
+#define IOAPIC_ACTIVE_LOW (1 << 13)
+#define IOAPIC_MASKED (1 << 16)
+#define IOAPIC_DEST_SHIFT 24 /* high dword */
+
+// IMCR: switches old chipsets from PIC mode to symmetric I/O mode
+#define IMCR_SELECT 0x22
+#define IMCR_DATA 0x23
+#define IMCR_REG 0x70
+#define IMCR_APIC (1 << 0)
+
+extern volatile u32* lapic_regs; /* NULL without a local APIC */
+
+static inline u32 lapic_read(u32 reg) { return lapic_regs[reg >> 2]; }
+
+static inline void lapic_write(u32 reg, u32 val) {
+    lapic_regs[reg >> 2] = val;
+}
+
+static inline u32 lapic_id() {
+    if (lapic_regs == NULL) return 0;
+    return lapic_read(LAPIC_ID) >> LAPIC_ID_SHIFT;
+}
+
+static inline void lapic_eoi() { lapic_write(LAPIC_EOI, 0); }
+
+bool apic_init();
+void lapic_setup();
+bool lapic_active();
+bool ioapic_active();
+bool lapic_send_ipi(u32 apic_id, u32 icr);
+bool lapic_broadcast_ipi(u32 icr);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <arch/i386/delay.h>
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Monotonic time since boot, ktime_get_ns(), from the best counter found
+    - TSC when it's invariant (constant rate, keeps counting in C-states):
+      one rdtsc & a multiply, nothing shared is written
+    - Else the HPET main counter, else the ACPI PM timer: narrower counters
+      extended to 64 bits by whoever reads them, lock-free
+    - Else PIT ticks (CLOCK_TICK_HZ resolution)
+    - The source is picked once at boot, before the other CPUs start. It's
+      only switched (keeping the time) if smp_init() finds the TSCs out
+      of sync, before the other CPUs read it, never afterwards
+    NOTE: cycles to ns is (cycles * mult) >> shift, no division
+*/
+#define NSEC_PER_USEC 1000u
+#define NSEC_PER_MSEC 1000000u
+#define NSEC_PER_SEC 1000000000u
+#define CLOCK_MASK_64 (~0ULL)
+
+// HPET registers (64 bits, the low half is enough here)
+#define HPET_REG_CAP 0x000
+#define HPET_REG_PERIOD 0x004 /* high half of CAP: fs per tick */
+#define HPET_REG_CONFIG 0x010
+#define HPET_REG_COUNTER 0x0F0
+#define HPET_CONFIG_ENABLE (1 << 0)
+#define HPET_MAX_PERIOD_FS 100000000u /* 10 MHz at least, per the spec */
+#define FS_PER_NSEC 1000000u
+
+// PIT channel 0 as the periodic tick (IRQ 0)
+#define PIT_CH0_DATA 0x40
+#define PIT_CH0_PERIODIC 0x34 /* channel 0, lo/hi byte, mode 2, binary */
+#define CLOCK_TICK_HZ 100
+#define CLOCK_TICK_DIVISOR ((PIT_HZ + CLOCK_TICK_HZ / 2) / CLOCK_TICK_HZ)
+#define PIT_IRQ 0
+
+// Preference, higher wins
+#define CLOCK_RATING_TSC 300 /* invariant */
+#define CLOCK_RATING_HPET 250
+#define CLOCK_RATING_ACPI_PM 200
+#define CLOCK_RATING_TSC_UNSTABLE 100
+#define CLOCK_RATING_JIFFIES 10
+#define CLOCK_RATING_TSC_UNSYNCED 5 /* goes back between CPUs */
+
+struct clocksource {
+    const char* name;
+    u64 (*read)();
+    u64 mask; /* counter width, CLOCK_MASK_64 if it never wraps */
+    u32 mult;
+    u32 shift;
+    u32 rating; /* 0 if not present */
+    bool needs_tick; /* wraps (or only counts) between ticks */
+};
+
+void clocksource_init();
+void clock_tick_init();
+void clocksource_mark_tsc_unsynced();
+const struct clocksource* clocksource_get();
+u64 clocksource_cycles_to_ns(const struct clocksource* cs, u64 cycles);
+u64 ktime_get_ns();
+void clocksource_print_info();
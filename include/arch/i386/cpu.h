@@ -0,0 +1,76 @@
+#pragma once
+
+#include <common.h>
+#include <stddef.h>
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_WP (1 << 16)
+#define CR0_PG (1u << 31)
+
+#define CR4_PSE (1 << 4)
+#define CR4_PAE (1 << 5)
+#define CR4_PGE (1 << 7)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+static inline u32 read_cr0() {
+    u32 val;
+    asm volatile("movl %%cr0, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr0(u32 val) {
+    asm volatile("movl %0, %%cr0" ::"r"(val) : "memory");
+}
+
+static inline u32 read_cr2() {
+    u32 val;
+    asm volatile("movl %%cr2, %0" : "=r"(val));
+    return val;
+}
+
+static inline u32 read_cr3() {
+    u32 val;
+    asm volatile("movl %%cr3, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr3(u32 val) {
+    asm volatile("movl %0, %%cr3" ::"r"(val) : "memory");
+}
+
+static inline u32 read_cr4() {
+    u32 val;
+    asm volatile("movl %%cr4, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr4(u32 val) {
+    asm volatile("movl %0, %%cr4" ::"r"(val) : "memory");
+}
+
+static inline void invlpg(size_t addr) {
+    asm volatile("invlpg (%0)" ::"r"(addr) : "memory");
+}
+
+#define EFLAGS_IF (1 << 9)
+
+// Disables interrupts, returns the previous EFLAGS for local_irq_restore
+static inline u32 local_irq_save() {
+    u32 flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags)::"memory");
+    return flags;
+}
+
+static inline void local_irq_restore(u32 flags) {
+    if (flags & EFLAGS_IF) asm volatile("sti" ::: "memory");
+}
+
+static inline u64 rdtsc() {
+    u32 lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+static inline void cpu_relax() { asm volatile("pause" ::: "memory"); }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Cache hierarchy & thread topology of the boot CPU, from CPUID
+    - Caches: leaf 4 (Intel), 0x8000001D (AMD with TOPOEXT), else leaf 2
+      descriptor bytes on Intel & the older 0x80000005/6 on the others
+      (AMD's layout, which Intel leaves mostly reserved)
+    - Topology: leaf 0xB, else leaf 1 logical count & the core counts in
+      leaf 4 / 0x80000008
+    - Packages: the MADT's CPU count over the logical CPUs per package,
+      1 until cpu_topology_count_packages() (or without a MADT)
+*/
+#define CPUID_LEGACY_CACHE 2
+#define CPUID_CACHE_PARAMS 4
+#define CPUID_EXT_TOPOLOGY 0xB
+#define CPUID_EXT_L1_CACHE 0x80000005
+#define CPUID_EXT_L2_CACHE 0x80000006
+#define CPUID_EXT_ADDR_SIZE 0x80000008
+#define CPUID_EXT_CACHE_PARAMS 0x8000001D
+
+// Leaf 0xB level types (ecx[15:8])
+#define TOPO_LEVEL_INVALID 0
+#define TOPO_LEVEL_SMT 1
+#define TOPO_LEVEL_CORE 2
+#define TOPO_MAX_LEVELS 8
+
+#define CPU_MAX_CACHES 8
+#define CACHE_FULLY_ASSOC 0xFFFF
+#define CACHE_DEFAULT_LINE 64
+
+enum cache_type {
+    CACHE_NONE = 0,
+    CACHE_DATA,
+    CACHE_INST,
+    CACHE_UNIFIED,
+};
+
+struct cpu_cache {
+    u8 level;
+    u8 type;
+    u16 ways; /* CACHE_FULLY_ASSOC if fully associative */
+    u16 line_size;
+    u16 shared_by; /* logical CPUs sharing it, 0 if unknown */
+    u32 sets;
+    u32 size;
+};
+
+struct cpu_topology {
+    u32 packages;
+    u32 cores_per_package;
+    u32 threads_per_core;
+    u32 apic_id;
+    u32 cache_line; /* smallest data line, what false sharing is about */
+    size_t num_caches;
+    struct cpu_cache caches[CPU_MAX_CACHES];
+};
+
+extern struct cpu_topology cpu_topo;
+
+void cpu_topology_init();
+void cpu_topology_count_packages();
+const struct cpu_cache* cpu_find_cache(u8 level, u8 type);
+void cpu_print_topology();
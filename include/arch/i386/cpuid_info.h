@@ -9,32 +9,158 @@
 #define CPUID_FEATURES 1
 #define CPUID_CACHE_INFO 1
 #define CPUID_SERIAL 3
+#define CPUID_STRUCT_FEATURES 7
+#define CPUID_EXT_MAX 0x80000000
+#define CPUID_EXT_FEATURES 0x80000001
+#define CPUID_EXT_POWER 0x80000007
 
-#define CPUID_PSE_FLAG (1 << 3)
-#define CPUID_MSR_FLAG (1 << 5)
-#define CPUID_PAE_FLAG (1 << 6)
-#define CPUID_APIC_FLAG (1 << 9)
-#define CPUID_SYSENTER_FLAG (1 << 11)
-#define CPUID_PGE_FLAG (1 << 13)
-#define CPUID_PAT_FLAG (1 << 16)
-#define CPUID_PSE36_FLAG (1 << 17)
-
-#define CPUID_TEST_HEAD(flag) bool has_cpu_##flag();
-#define CPUID_TEST(flag)                                              \
-    bool has_cpu_##flag() {                                           \
-        u32 unused = 0, edx = 0;                                      \
-        __get_cpuid(CPUID_FEATURES, &unused, &unused, &unused, &edx); \
-        return (edx & (CPUID_##flag##_FLAG)) != 0;                    \
-    }
+/*
+    CPUID is read once at boot (cpuid_init) into boot_cpu, feature tests
+    are a bit test on the cached registers (CPUID is serializing & traps
+    under a hypervisor, too slow to run per test)
+    - A feature is (register word << 5) | bit, see CPU_FEATURE
+*/
+enum cpuid_word {
+    CPUID_1_EDX = 0,
+    CPUID_1_ECX,
+    CPUID_7_EBX,
+    CPUID_7_ECX,
+    CPUID_7_EDX,
+    CPUID_EXT1_EDX,
+    CPUID_EXT1_ECX,
+    CPUID_EXT7_EDX,
+    CPUID_NUM_WORDS
+};
 
+#define CPU_FEATURE(word, bit) (((word) << 5) | (bit))
+#define CPU_FEATURE_NONE 0xFFFFFFFF /* always present */
+
+// Leaf 1 (edx)
+#define X86_FEATURE_FPU CPU_FEATURE(CPUID_1_EDX, 0)
+#define X86_FEATURE_PSE CPU_FEATURE(CPUID_1_EDX, 3)
+#define X86_FEATURE_TSC CPU_FEATURE(CPUID_1_EDX, 4)
+#define X86_FEATURE_MSR CPU_FEATURE(CPUID_1_EDX, 5)
+#define X86_FEATURE_PAE CPU_FEATURE(CPUID_1_EDX, 6)
+#define X86_FEATURE_CX8 CPU_FEATURE(CPUID_1_EDX, 8)
+#define X86_FEATURE_APIC CPU_FEATURE(CPUID_1_EDX, 9)
+#define X86_FEATURE_SYSENTER CPU_FEATURE(CPUID_1_EDX, 11)
+#define X86_FEATURE_PGE CPU_FEATURE(CPUID_1_EDX, 13)
+#define X86_FEATURE_CMOV CPU_FEATURE(CPUID_1_EDX, 15)
+#define X86_FEATURE_PAT CPU_FEATURE(CPUID_1_EDX, 16)
+#define X86_FEATURE_PSE36 CPU_FEATURE(CPUID_1_EDX, 17)
+#define X86_FEATURE_CLFLUSH CPU_FEATURE(CPUID_1_EDX, 19)
+#define X86_FEATURE_MMX CPU_FEATURE(CPUID_1_EDX, 23)
+#define X86_FEATURE_FXSR CPU_FEATURE(CPUID_1_EDX, 24)
+#define X86_FEATURE_SSE CPU_FEATURE(CPUID_1_EDX, 25)
+#define X86_FEATURE_SSE2 CPU_FEATURE(CPUID_1_EDX, 26)
+#define X86_FEATURE_HTT CPU_FEATURE(CPUID_1_EDX, 28)
+
+// Leaf 1 (ecx)
+#define X86_FEATURE_SSE3 CPU_FEATURE(CPUID_1_ECX, 0)
+#define X86_FEATURE_PCLMUL CPU_FEATURE(CPUID_1_ECX, 1)
+#define X86_FEATURE_MONITOR CPU_FEATURE(CPUID_1_ECX, 3)
+#define X86_FEATURE_SSSE3 CPU_FEATURE(CPUID_1_ECX, 9)
+#define X86_FEATURE_FMA CPU_FEATURE(CPUID_1_ECX, 12)
+#define X86_FEATURE_CX16 CPU_FEATURE(CPUID_1_ECX, 13)
+#define X86_FEATURE_SSE4_1 CPU_FEATURE(CPUID_1_ECX, 19)
+#define X86_FEATURE_SSE4_2 CPU_FEATURE(CPUID_1_ECX, 20)
+#define X86_FEATURE_X2APIC CPU_FEATURE(CPUID_1_ECX, 21)
+#define X86_FEATURE_MOVBE CPU_FEATURE(CPUID_1_ECX, 22)
+#define X86_FEATURE_POPCNT CPU_FEATURE(CPUID_1_ECX, 23)
+#define X86_FEATURE_TSC_DEADLINE CPU_FEATURE(CPUID_1_ECX, 24)
+#define X86_FEATURE_AES CPU_FEATURE(CPUID_1_ECX, 25)
+#define X86_FEATURE_XSAVE CPU_FEATURE(CPUID_1_ECX, 26)
+#define X86_FEATURE_OSXSAVE CPU_FEATURE(CPUID_1_ECX, 27)
+#define X86_FEATURE_AVX CPU_FEATURE(CPUID_1_ECX, 28)
+#define X86_FEATURE_F16C CPU_FEATURE(CPUID_1_ECX, 29)
+#define X86_FEATURE_RDRAND CPU_FEATURE(CPUID_1_ECX, 30)
+#define X86_FEATURE_HYPERVISOR CPU_FEATURE(CPUID_1_ECX, 31)
+
+// Leaf 7, subleaf 0
+#define X86_FEATURE_FSGSBASE CPU_FEATURE(CPUID_7_EBX, 0)
+#define X86_FEATURE_BMI1 CPU_FEATURE(CPUID_7_EBX, 3)
+#define X86_FEATURE_AVX2 CPU_FEATURE(CPUID_7_EBX, 5)
+#define X86_FEATURE_SMEP CPU_FEATURE(CPUID_7_EBX, 7)
+#define X86_FEATURE_BMI2 CPU_FEATURE(CPUID_7_EBX, 8)
+#define X86_FEATURE_ERMS CPU_FEATURE(CPUID_7_EBX, 9)
+#define X86_FEATURE_INVPCID CPU_FEATURE(CPUID_7_EBX, 10)
+#define X86_FEATURE_AVX512F CPU_FEATURE(CPUID_7_EBX, 16)
+#define X86_FEATURE_RDSEED CPU_FEATURE(CPUID_7_EBX, 18)
+#define X86_FEATURE_SMAP CPU_FEATURE(CPUID_7_EBX, 20)
+#define X86_FEATURE_CLFLUSHOPT CPU_FEATURE(CPUID_7_EBX, 23)
+#define X86_FEATURE_SHA CPU_FEATURE(CPUID_7_EBX, 29)
+#define X86_FEATURE_UMIP CPU_FEATURE(CPUID_7_ECX, 2)
+#define X86_FEATURE_FSRM CPU_FEATURE(CPUID_7_EDX, 4)
+
+// Extended leaves
+#define X86_FEATURE_SYSCALL CPU_FEATURE(CPUID_EXT1_EDX, 11)
+#define X86_FEATURE_NX CPU_FEATURE(CPUID_EXT1_EDX, 20)
+#define X86_FEATURE_PDPE1GB CPU_FEATURE(CPUID_EXT1_EDX, 26)
+#define X86_FEATURE_RDTSCP CPU_FEATURE(CPUID_EXT1_EDX, 27)
+#define X86_FEATURE_LM CPU_FEATURE(CPUID_EXT1_EDX, 29)
+#define X86_FEATURE_LZCNT CPU_FEATURE(CPUID_EXT1_ECX, 5)
+#define X86_FEATURE_TOPOEXT CPU_FEATURE(CPUID_EXT1_ECX, 22)
+#define X86_FEATURE_INVARIANT_TSC CPU_FEATURE(CPUID_EXT7_EDX, 8)
+
+#define CPU_VENDOR_LEN 12
+#define CPU_VENDOR_INTEL "GenuineIntel"
+
+struct cpu_info {
+    char vendor[CPU_VENDOR_LEN + 1];
+    u32 max_leaf;
+    u32 max_ext_leaf;
+    u32 signature; /* leaf 1 eax: stepping, model, family */
+    u32 misc;      /* leaf 1 ebx: APIC id, logical count, clflush size */
+    u32 words[CPUID_NUM_WORDS];
+};
+
+extern struct cpu_info boot_cpu;
+
+static inline bool cpu_has(u32 feature) {
+    if (feature == CPU_FEATURE_NONE) return true;
+    return (boot_cpu.words[feature >> 5] & (1u << (feature & 31))) != 0;
+}
+
+#define CPUID_TEST(flag) \
+    static inline bool has_cpu_##flag() { return cpu_has(X86_FEATURE_##flag); }
+
+CPUID_TEST(PSE);
+CPUID_TEST(MSR);
+CPUID_TEST(PAE);
+CPUID_TEST(APIC);
+CPUID_TEST(SYSENTER);
+CPUID_TEST(PGE);
+CPUID_TEST(PAT);
+CPUID_TEST(PSE36);
+CPUID_TEST(SSE2);
+CPUID_TEST(NX);
+CPUID_TEST(ERMS);
+
+/*
+    Boot time dispatch: impls lists the implementations of one function
+    best first, cpu_select() returns the first the CPU can run. Callers
+    keep the result in a function pointer, so each call is one indirect
+    call & never tests features again
+    - Lists end with a CPU_FEATURE_NONE fallback
+    - fn has one typed member per dispatched kind, a list only sets (and
+      its caller only reads) its own
+*/
+struct string_ops;
+
+union cpu_impl_fn {
+    void (*clear_page)(void* page);
+    const struct string_ops* string_ops;
+};
+
+struct cpu_impl {
+    u32 feature;
+    const char* name;
+    union cpu_impl_fn fn;
+};
+
+const struct cpu_impl* cpu_select(const struct cpu_impl* impls);
+
+void cpuid_init();
 void get_cpu_vendor(char* str);
 u32 get_cpu_model();
-
-CPUID_TEST_HEAD(PSE);
-CPUID_TEST_HEAD(MSR);
-CPUID_TEST_HEAD(PAE);
-CPUID_TEST_HEAD(APIC);
-CPUID_TEST_HEAD(SYSENTER);
-CPUID_TEST_HEAD(PGE);
-CPUID_TEST_HEAD(PAT);
-CPUID_TEST_HEAD(PSE36);
+void cpu_print_features();
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Busy-wait delays & bounded polling in real time
+    - The TSC rate is measured once at boot against a fixed rate counter
+      (HPET or ACPI PM timer) when the firmware has one, else PIT channel
+      2 (the speaker channel, its output is readable in port 0x61), CPUID
+      leaf 0x16 is the last resort
+    - Delays spin on the TSC, without one (or before calibration) they
+      fall back to ~1 us io_wait() steps
+*/
+#define PIT_HZ 1193182
+#define PIT_CH2_DATA 0x42
+#define PIT_CMD 0x43
+#define PIT_CH2_ONESHOT 0xB0 /* channel 2, lo/hi byte, mode 0, binary */
+
+#define SYS_CTRL_PORT 0x61
+#define SYS_CTRL_CH2_GATE (1 << 0)
+#define SYS_CTRL_SPEAKER (1 << 1)
+#define SYS_CTRL_CH2_OUT (1 << 5)
+
+#define CPUID_FREQ_INFO 0x16 /* eax: base MHz */
+
+#define DELAY_CALIBRATE_MS 10
+#define DELAY_CALIBRATE_TICKS (PIT_HZ / 1000 * DELAY_CALIBRATE_MS)
+#define DELAY_CALIBRATE_RUNS 3 /* best of, SMIs & VM exits only add time */
+#define DELAY_CALIBRATE_MAX_CYCLES 0xFFFFFFFFu /* PIT never fired */
+#define DELAY_SHIFT 16 /* fixed point of the cycles per us/ns factors */
+
+struct clocksource;
+
+void delay_init(const struct clocksource* ref);
+u32 tsc_get_khz();
+u64 us_to_cycles(u32 us);
+u64 tsc_to_us(u64 cycles);
+
+void udelay(u32 us);
+void ndelay(u32 ns);
+bool poll_until(u16 port, u8 mask, u8 value, u32 timeout_us);
+bool poll_until_mmio(volatile u32* reg, u32 mask, u32 value, u32 timeout_us);
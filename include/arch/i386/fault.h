@@ -0,0 +1,13 @@
+#pragma once
+
+#include <arch/i386/irq.h>
+#include <common.h>
+
+// Page fault error code bits
+#define PF_PRESENT (1 << 0) /* protection violation, else not present */
+#define PF_WRITE (1 << 1)
+#define PF_USER (1 << 2)
+#define PF_RSVD (1 << 3) /* reserved bit set in a paging entry */
+#define PF_FETCH (1 << 4)
+
+void page_fault_handler(struct int_frame* frame, void* data);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+
+void cpu_idle(volatile bool* wake);
+bool cpu_halted(u32 cpu);
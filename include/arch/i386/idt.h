@@ -1,5 +1,10 @@
 #pragma once
 
+#include <common.h>
+
+#define NUM_VECTORS 256
+
+// Entry stubs generated in idt.S, one per vector
+extern const u32 isr_stub_table[NUM_VECTORS];
+
 void load_idt();
-void isr_keyboard_handler();
-void isr_gen_prot_handler();
\ No newline at end of file
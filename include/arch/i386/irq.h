@@ -0,0 +1,85 @@
+#pragma once
+
+#include <arch/i386/idt.h>
+#include <common.h>
+#include <stdbool.h>
+
+/*
+    Vector layout
+    - 0x00-0x1F: CPU exceptions
+    - 0x20 up: device IRQs, IRQ n (PIC line or I/O APIC pin) on 0x20 + n
+    - 0xF0-0xFF: delivered by the local APIC itself (IPIs, spurious)
+*/
+#define NUM_EXCEPTIONS 32
+#define NUM_LEGACY_IRQS 16
+#define IRQ_VECTOR_BASE 0x20
+#define MAX_IRQS 0xD0 /* up to the local APIC vectors */
+
+#define VEC_NMI 2
+#define VEC_DOUBLE_FAULT 8
+#define VEC_GEN_PROT 13
+#define VEC_PAGE_FAULT 14
+
+#define IRQ_VECTOR(irq) (IRQ_VECTOR_BASE + (irq))
+
+// Stack layout built by isr_common (pushal, vector & error code, CPU frame)
+struct int_frame {
+    u32 edi;
+    u32 esi;
+    u32 ebp;
+    u32 esp;
+    u32 ebx;
+    u32 edx;
+    u32 ecx;
+    u32 eax;
+    u32 vector;
+    u32 err_code; /* 0 if the CPU doesn't push one */
+    u32 eip;
+    u32 cs;
+    u32 eflags;
+};
+
+typedef void (*irq_handler_t)(struct int_frame* frame, void* data);
+
+/*
+    Interrupt controller the device IRQs go through, the 8259 pair until
+    apic_init() switches to the I/O APIC
+    - enable() unmasks irq & routes it to cpu, false if it can't target it
+    - eoi() is sent by the dispatcher after the handler
+    - spurious() (may be NULL) tells a phantom request from a real one
+*/
+struct irq_chip {
+    const char* name;
+    u32 num_irqs;
+    bool (*enable)(u8 irq, u32 cpu);
+    void (*disable)(u8 irq);
+    void (*eoi)(u8 irq);
+    bool (*spurious)(u8 irq);
+};
+
+extern const struct irq_chip pic_chip;
+extern struct irq_chip ioapic_chip;
+
+/*
+    Every vector goes through interrupt_dispatch(), which calls the handler
+    registered for it & keeps per CPU count/cycle statistics
+    - IRQs & IPIs get their EOI from the dispatcher, handlers must not send
+      one
+    - One handler per vector, request_*() fails if it's taken
+    - request_irq() spreads IRQs over the online CPUs round robin when the
+      controller can, irq_set_affinity() moves one later
+    - Input for the shell (keyboard, serial) stays on CPU 0 where it's
+      consumed, request_irq_on()
+*/
+bool request_vector(u8 vector, irq_handler_t handler, const char* name,
+                    void* data);
+void free_vector(u8 vector);
+bool request_irq(u8 irq, irq_handler_t handler, const char* name, void* data);
+bool request_irq_on(u8 irq, u32 cpu, irq_handler_t handler, const char* name,
+                    void* data);
+void free_irq(u8 irq);
+bool irq_set_affinity(u8 irq, u32 cpu);
+void irq_set_chip(const struct irq_chip* chip);
+
+void interrupt_dispatch(struct int_frame* frame);
+void irq_print_stats();
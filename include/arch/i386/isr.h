@@ -1,6 +1,5 @@
 #pragma once
 
-#include <arch/i386/ps2_keyboard.h>
 #include <common.h>
 #include <early_kprintf.h>
 #include <stdbool.h>
@@ -24,8 +23,7 @@ typedef enum gates {
     TRAP_32 = 0xF
 } GATE_TYPE;
 
-void gen_prot_handler();
-
+void idt_init();
 void enable_int();
 void disable_int();
 void register_idt_entry(u8 num, u32 addr, int priv_mode, GATE_TYPE type);
@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+    Physical memory layout of the kernel image (see linker.ld & entry.S)
+    NOTE: also included from assembly, keep C-only parts guarded
+*/
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+
+#define KRNL_START 0x100000
+#define KRNL_STACK_SIZE (8 * 1024)
+
+// Real mode entry of the other CPUs (see trampoline.S), a SIPI vector
+#define TRAMPOLINE_BASE 0x8000
+
+/*
+    Physical RAM below DIRECT_MAP_LIMIT is mapped at DIRECT_MAP_BASE
+    (identity for now), the rest of the address space is left for
+    dynamic kernel mappings
+*/
+#define DIRECT_MAP_BASE 0x0
+#define DIRECT_MAP_LIMIT 0xC0000000
+
+// Window for dynamic kernel mappings (see mm/vm.c)
+#define VMALLOC_START DIRECT_MAP_LIMIT
+#define VMALLOC_END 0xFF800000
+
+#define PAGE_ALIGN_DOWN(addr) ((addr) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_UP(addr) (((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#ifndef __ASSEMBLER__
+#include <common.h>
+#include <stddef.h>
+
+// 64 bits wide so PAE can address RAM above 4 GiB
+typedef u64 phys_addr_t;
+
+// Defined by linker.ld, page aligned (kernel stack sits right after it)
+extern char _krnl_end[];
+
+#define KRNL_END ((size_t)_krnl_end + KRNL_STACK_SIZE)
+
+#define PHYS_TO_VIRT(addr) ((void*)((size_t)(addr) + DIRECT_MAP_BASE))
+#define VIRT_TO_PHYS(ptr) ((phys_addr_t)((size_t)(ptr) - DIRECT_MAP_BASE))
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <common.h>
+
+// Model specific registers (Intel SDM vol. 4)
+#define MSR_PAT 0x277
+#define MSR_EFER 0xC0000080
+
+#define EFER_NXE (1 << 11) /* allow the NX bit in PAE paging entries */
+
+static inline u64 rdmsr(u32 msr) {
+    u32 lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((u64)hi << 32) | lo;
+}
+
+static inline void wrmsr(u32 msr, u64 val) {
+    asm volatile("wrmsr" ::"c"(msr), "a"((u32)val), "d"((u32)(val >> 32))
+                 : "memory");
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <arch/i386/memlayout.h>
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    https://wiki.osdev.org/Paging
+    32-bit 2-level paging: 1024 PDEs, each covering a 4 KiB page table
+    or (with PSE) a single 4 MiB page
+*/
+#define PT_ENTRIES 1024
+#define LARGE_PAGE_SHIFT 22
+#define LARGE_PAGE_SIZE (1 << LARGE_PAGE_SHIFT)
+
+#define PDE_INDEX(virt) ((virt) >> LARGE_PAGE_SHIFT)
+#define PTE_INDEX(virt) (((virt) >> PAGE_SHIFT) & (PT_ENTRIES - 1))
+#define PTE_ADDR_MASK 0xFFFFF000
+#define PDE_LARGE_ADDR_MASK 0xFFC00000
+#define LEGACY_PHYS_LIMIT (1ULL << 32)
+
+/*
+    https://wiki.osdev.org/Page_Tables#PAE
+    PAE 3-level paging (used when the CPU has it): 4 PDPTEs, each pointing
+    to a directory of 512 64-bit PDEs covering a page table or a 2 MiB page
+    - Physical addresses past 4 GiB & per page NX
+*/
+#define PAE_PDPT_ENTRIES 4
+#define PAE_PT_ENTRIES 512
+#define PAE_LARGE_PAGE_SHIFT 21
+#define PAE_LARGE_PAGE_SIZE (1 << PAE_LARGE_PAGE_SHIFT)
+
+#define PAE_PDPT_INDEX(virt) ((virt) >> 30)
+#define PAE_PDE_INDEX(virt) \
+    (((virt) >> PAE_LARGE_PAGE_SHIFT) & (PAE_PT_ENTRIES - 1))
+#define PAE_PTE_INDEX(virt) (((virt) >> PAGE_SHIFT) & (PAE_PT_ENTRIES - 1))
+#define PAE_ADDR_MASK 0x0000000FFFFFF000ULL
+#define PAE_LARGE_ADDR_MASK 0x0000000FFFE00000ULL
+#define PAE_NX (1ULL << 63)
+#define PAE_PHYS_LIMIT (1ULL << 36) /* 64 GiB */
+
+// Entry flags (shared by PDEs & PTEs unless noted)
+#define PTE_PRESENT (1 << 0)
+#define PTE_RW (1 << 1)
+#define PTE_USER (1 << 2)
+#define PTE_PWT (1 << 3)
+#define PTE_PCD (1 << 4)
+#define PTE_ACCESSED (1 << 5)
+#define PTE_DIRTY (1 << 6)
+#define PDE_LARGE (1 << 7) /* PDE only: 4 MiB page (2 MiB with PAE) */
+#define PTE_PAT (1 << 7)   /* PTE only: PAT entry bit 2 (see pat.h) */
+#define PTE_GLOBAL (1 << 8)
+#define PTE_NX (1 << 9) /* software bit, becomes PAE_NX (dropped w/o NX) */
+#define PDE_PAT (1 << 12) /* large PDE only: PAT entry bit 2 */
+
+#define PTE_KERNEL (PTE_PRESENT | PTE_RW)
+
+void paging_init();
+bool paging_has_large_pages();
+bool paging_has_global_pages();
+bool paging_has_pae();
+bool paging_has_nx();
+size_t paging_large_page_size();
+phys_addr_t paging_phys_limit();
+size_t get_direct_map_end();
+
+bool map_page(size_t virt, phys_addr_t phys, u32 flags);
+bool map_large_page(size_t virt, phys_addr_t phys, u32 flags);
+void unmap_page(size_t virt);
+size_t unmap_page_noflush(size_t virt);
+phys_addr_t virt_to_phys(size_t virt);
+bool is_mapped(size_t virt);
+
+void flush_tlb_page(size_t virt);
+void flush_tlb_all();
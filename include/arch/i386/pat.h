@@ -0,0 +1,35 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+
+/*
+    Memory types through the Page Attribute Table (Intel SDM 11.12)
+    - A mapping picks PAT entry (PAT << 2 | PCD << 1 | PWT)
+    - Entries 0-3 keep their power-on types so PWT/PCD alone mean the same
+      with or without PAT, WC & WP live in the upper half
+    - The enum values are the PAT entries
+*/
+enum mem_type {
+    MEM_WB,
+    MEM_WT,
+    MEM_UC_MINUS, /* UC unless an MTRR says WC */
+    MEM_UC,
+    MEM_WC,
+    MEM_WP,
+};
+
+// PAT MSR type encodings
+#define PAT_UC 0x00
+#define PAT_WC 0x01
+#define PAT_WT 0x04
+#define PAT_WP 0x05
+#define PAT_WB 0x06
+#define PAT_UC_MINUS 0x07
+
+#define PAT_ENTRY(idx, type) ((u64)(type) << ((idx) * 8))
+
+void pat_init();
+bool pat_enabled();
+u32 mem_type_flags(enum mem_type type);
+const char* mem_type_name(enum mem_type type);
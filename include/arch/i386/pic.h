@@ -2,6 +2,7 @@
 
 #include <common.h>
 #include <io.h>
+#include <stdbool.h>
 
 #define PIC_MASTER_COMMAND 0x20
 #define PIC_MASTER_DATA 0x21
@@ -17,6 +18,8 @@
 #define PIC_SLAVE_OFFSET 0x28
 
 #define PIC_EOI 0x20
+#define PIC_READ_ISR 0x0B /* OCW3 */
+#define PIC_ICW_DELAY_US 1
 
 #define PIC_CONNECT_IR(n) (1 << (n))
 
@@ -36,3 +39,4 @@ void pic_disable();
 void pic_eoi(u8 irq_num);
 void pic_disable_irq(u8 irq_num);
 void pic_enable_irq(u8 irq_num);
+bool pic_is_spurious(u8 irq_num);
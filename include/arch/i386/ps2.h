@@ -8,6 +8,14 @@
 #define PS2_DATA_PORT 0x60 /* reading Output & write input buffers */
 #define PS2_CMD_PORT 0x64  /* read status reg & write cmd register */
 
+// Status register bits
+#define PS2_STATUS_OUTPUT_FULL (1 << 0) /* data for us in PS2_DATA_PORT */
+#define PS2_STATUS_INPUT_FULL (1 << 1)  /* controller hasn't taken it yet */
+
+// Real time bounds on controller & device replies
+#define PS2_TIMEOUT_US 10000        /* 10 ms */
+#define PS2_RESET_TIMEOUT_US 750000 /* device self test after a reset */
+
 // PS2 Commands
 #define PS2_READ_CONFIG_BYTE 0x20 /* resp w/ the byte */
 #define PS2_WRITE_CONFIG_BYTE 0x60
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <arch/i386/idt.h>
+#include <arch/i386/irq.h>
 #include <io.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -29,6 +29,7 @@
 #define PS2_KEYBOARD_ERROR_2 0xFF
 
 #define PS2_MAX_CODE_LEN 8
+#define PS2_KEYBOARD_IRQ 1
 
 typedef void (*key_handler_t)(key_st);
 
@@ -166,5 +167,6 @@ key_st ps2_get_keyboard_char();
 
 bool ps2_keyboard_config();
 
-void keyboard_handler();
+void keyboard_handler(struct int_frame* frame, void* data);
+void dispatch_key(key_st key);
 bool register_key_handler(void (*handler)(key_st));
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    https://wiki.osdev.org/Serial_Ports
+    16550 UART on COM1, a console sink & shell input source
+    - Output goes into a TX ring drained by the THR-empty interrupt, 16
+      bytes (one FIFO) per IRQ, nobody spins on the line status register
+    - A full ring drops bytes (counted), logging never waits on the line
+*/
+#define COM1_PORT 0x3F8
+#define COM1_IRQ 4
+#define SERIAL_BAUD 115200
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_TX_RING 4096 /* power of 2 */
+
+// Register offsets from the base port
+#define UART_DATA 0 /* RX/TX, divisor low with DLAB */
+#define UART_IER 1  /* divisor high with DLAB */
+#define UART_IIR 2  /* read */
+#define UART_FCR 2  /* write */
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_MSR 6
+
+#define IER_RX_AVAIL (1 << 0)
+#define IER_TX_EMPTY (1 << 1)
+
+#define IIR_NO_INT (1 << 0)
+#define IIR_ID_MASK 0x0E
+#define IIR_MODEM 0x00
+#define IIR_TX_EMPTY 0x02
+#define IIR_RX_AVAIL 0x04
+#define IIR_LINE_STATUS 0x06
+#define IIR_RX_TIMEOUT 0x0C
+
+#define FCR_ENABLE (1 << 0)
+#define FCR_CLEAR_RX (1 << 1)
+#define FCR_CLEAR_TX (1 << 2)
+#define FCR_TRIGGER_14 (3 << 6)
+
+#define LCR_8N1 0x03
+#define LCR_DLAB (1 << 7)
+
+#define MCR_DTR (1 << 0)
+#define MCR_RTS (1 << 1)
+#define MCR_OUT1 (1 << 2)
+#define MCR_OUT2 (1 << 3) /* gates the IRQ line on PCs */
+#define MCR_LOOPBACK (1 << 4)
+
+#define LSR_DATA_READY (1 << 0)
+#define LSR_OVERRUN (1 << 1)
+#define LSR_TX_EMPTY (1 << 5)
+
+bool serial_init();
+bool serial_present();
+size_t serial_write(const char* str, size_t len);
+
+void serial_handler(struct int_frame* frame, void* data);
+void serial_print_stats();
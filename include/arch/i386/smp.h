@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+    Application processors (APs) are started by broadcasting INIT-SIPI-SIPI
+    to every CPU but the boot one, they run trampoline.S from
+    TRAMPOLINE_BASE into ap_main() & then only take interrupts
+    - CPU numbers are handed out in arrival order, the boot CPU is 0
+    - Only the boot CPU runs the kernel thread, work an IRQ leaves for it
+      on another CPU is signalled with a wake IPI
+    - The TSCs are checked against each other while the APs come up, the
+      clock stops using them if they aren't in step
+    - Page tables are shared, unmapping something other CPUs may have
+      cached goes through smp_flush_tlb_all()
+    NOTE: also included from assembly, keep C-only parts guarded
+*/
+#define MAX_CPUS 8
+#define MAX_APIC_IDS 256
+
+#define SMP_INIT_DELAY_US 10000
+#define SMP_SIPI_DELAY_US 200
+#define SMP_BOOT_TIMEOUT_US 100000
+#define CPU_NONE 0xFFFFFFFF /* e.g. the holder of a free lock */
+#define SMP_AP_CLOSED 0x40000000 /* ap_next once the boot window shut */
+#define TSC_WARP_CHECK_MS 2
+
+#ifndef __ASSEMBLER__
+#include <arch/i386/apic.h>
+#include <common.h>
+#include <stdbool.h>
+
+extern u8 apic_to_cpu[MAX_APIC_IDS];
+
+// One MMIO read, 0 until the local APIC is mapped
+static inline u32 smp_cpu_id() { return apic_to_cpu[lapic_id()]; }
+
+void smp_init();
+u32 smp_num_cpus();
+u32 smp_cpu_apic_id(u32 cpu);
+void smp_wake_cpu(u32 cpu);
+void smp_flush_tlb_all();
+void smp_print_info();
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <common.h>
+#include <lib/string.h>
+#include <stddef.h>
+
+/*
+    x86 string_ops (see lib/string.h)
+    - rep: rep movsd/stosd for bulk ops, repe cmpsb & repne scasb scans
+    - erms: rep movsb/stosb, which ERMS CPUs run as wide copies
+    - sse2: 16 B loads/stores & compares, non-temporal stores for copies
+      bigger than the caches
+    NOTE: interrupt entry doesn't save xmm registers, so SSE code runs with
+    interrupts off, at most STRING_SSE2_CHUNK bytes at a time. The kernel
+    is built without SSE, GCC never keeps anything in them itself
+*/
+#define STRING_SSE2_MIN 64      /* smaller ops (& string heads) stay scalar */
+#define STRING_SSE2_CHUNK 4096  /* most bytes per interrupts off window */
+#define STRING_SSE2_NT_MIN (256 * 1024)
+#define STRING_MAX_IMPLS 4
+
+extern const struct string_ops string_rep_ops;
+extern const struct string_ops string_erms_ops;
+extern const struct string_ops string_sse2_ops;
+
+void string_init();
+size_t string_get_impls(const struct string_ops** impls);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <common.h>
+#include <stddef.h>
+
+/*
+    In-kernel micro benchmarks, run from the shell with "bench <name>"
+    NOTE: results are in TSC cycles
+*/
+#define BENCH_ITERS 10000
+#define BENCH_OBJS 2048
+#define BENCH_MEM_BYTES (8 << 20) /* moved per op & size */
+#define BENCH_MEM_MAX (1 << 20)
+#define BENCH_CONV_VALUES 256
+#define BENCH_PIO_BYTES 512 /* one ATA sector */
+#define BENCH_PIO_SECTORS 64
+
+void bench_slab();
+void bench_mem();
+void bench_conv();
+void bench_pio();
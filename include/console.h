@@ -0,0 +1,22 @@
+#pragma once
+
+#include <common.h>
+#include <early_print.h>
+
+/*
+    Output sinks behind kputs() / kprintf(): every registered console gets
+    each chunk of text, fg is a colour hint (VGA colours)
+    - Writes must not block, a console that can't keep up drops text
+    - clear is optional (stream consoles have no screen)
+*/
+struct console {
+    const char* name;
+    void (*write)(const char* str, COLORS fg);
+    void (*clear)();
+    struct console* next;
+};
+
+void console_register(struct console* con);
+void console_unregister(const char* name);
+int console_write(const char* str, COLORS fg);
+void console_clear();
@@ -5,7 +5,11 @@
 #include <lib/string.h>
 #include <stdarg.h>
 
+// Stack buffer kprintf() formats into, flushed to the console when full
+#define KPRINTF_BUF 256
+
 int kputchar(char c);
 int kputs(const char* str);
-int kprintf(const char* format, ...);
-int kerror(const char* format, ...);
+int vkprintf(const char* format, va_list args);
+int kprintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+int kerror(const char* format, ...) __attribute__((format(printf, 1, 2)));
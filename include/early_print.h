@@ -7,6 +7,26 @@
 #define VGA_TEXT_MEM 0xB8000
 #define VGA_COLOR(fg, bg) (fg | (bg << 4))
 
+/*
+    Text output is drawn into a RAM shadow of the whole 32 KiB of text
+    memory & copied out a dirty row at a time once per print
+    - The screen is a window into it placed by the CRTC start address, so
+      scrolling moves the window & clears one row. Only when the window
+      hits the end of text memory are the visible rows copied back to
+      the top (once every VGA_BUF_ROWS - rows scrolls)
+    - The string & clear calls copy out on return, single chars &
+      tty_scroll_down() only touch the shadow until tty_flush()
+*/
+#define VGA_TEXT_MEM_SIZE 0x8000
+#define VGA_MAX_COLS 80
+#define VGA_BUF_ROWS (VGA_TEXT_MEM_SIZE / (VGA_MAX_COLS * 2))
+
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define CRTC_CURSOR_START 0x0A
+#define CRTC_START_HIGH 0x0C
+#define CRTC_START_LOW 0x0D
+
 typedef enum {
     BLACK = 0,
     BLUE,
@@ -33,10 +53,13 @@ struct vga_cell {
 
 struct vga_info {
     struct vga_cell* fb;
-    int x;
-    int y;
+    struct vga_cell* shadow;
+    int x; /* row */
+    int y; /* column */
     int cols;
     int rows;
+    int top;       /* buffer row at the top of the screen */
+    int shown_top; /* what the CRTC was last told */
     COLORS fg;
     COLORS bg;
 };
@@ -54,6 +77,7 @@ void tty_set_bg(COLORS bg);
 
 void tty_clear_screen();
 void tty_scroll_down();
+void tty_flush();
 
 COLORS tty_get_bg();
 COLORS tty_get_fg();
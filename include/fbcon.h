@@ -0,0 +1,54 @@
+#pragma once
+
+#include <common.h>
+#include <multiboot2_tbl.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Text console on a linear RGB framebuffer (UEFI has no 0xB8000)
+    - Glyphs are expanded to pixels once per foreground colour & kept, so
+      drawing a character is FONT_HEIGHT row copies, no bit testing
+    - Everything is drawn into a RAM back buffer, a ring of text rows:
+      scrolling moves the top row index & clears one row, nothing is
+      copied
+    - Each screen row keeps a dirty column span, a write ends by copying
+      out only the cells in it that differ from what the framebuffer
+      shows (a cell is its char & colour), so a scroll rewrites the rows
+      that changed, not the whole (write-combining) framebuffer
+*/
+#define FBCON_COLORS 16 /* VGA colours */
+#define FBCON_TAB 4
+#define FBCON_CELL(c, fg) ((u16)(u8)(c) | ((u16)(fg) << 8))
+#define FBCON_BLANK 0 /* space or cleared, the same pixels in any colour */
+
+struct fbcon_span {
+    u16 start; /* columns [start, end) */
+    u16 end;
+};
+
+struct fbcon {
+    u8* fb;
+    u8* back; /* rows * FONT_HEIGHT scanlines of width pixels, packed */
+    u32 pitch; /* framebuffer bytes per scanline */
+    u32 back_pitch;
+    u32 bytes_pp;
+    u32 glyph_size; /* bytes per expanded glyph */
+    int cols;
+    int rows;
+    int top; /* back buffer row shown as screen row 0 */
+    int row;
+    int col;
+    COLORS bg;
+    u32 palette[FBCON_COLORS];
+    u8* glyphs[FBCON_COLORS]; /* per fg colour, built on first use */
+    struct fbcon_span* dirty; /* per screen row */
+    u16* cells; /* back buffer contents, per back buffer row */
+    u16* shown; /* framebuffer contents, per screen row */
+
+    u32 scrolls;
+    u64 flushed; /* bytes copied to the framebuffer */
+};
+
+bool fbcon_init(void* fb, const fb_info_st* info);
+void fbcon_print_info();
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <common.h>
+
+/*
+    8x8 bitmap font for printable ASCII (IBM PC BIOS shapes)
+    - One byte per scanline, bit 0 is the leftmost pixel
+*/
+#define FONT_WIDTH 8
+#define FONT_HEIGHT 8
+#define FONT_FIRST ' '
+#define FONT_LAST '~'
+#define FONT_GLYPHS (FONT_LAST - FONT_FIRST + 1)
+
+extern const u8 font8x8[FONT_GLYPHS][FONT_HEIGHT];
@@ -1,12 +1,72 @@
 #pragma once
 #include <common.h>
+#include <stddef.h>
 
-void outb(u16 port, u8 data);
-void outw(u16 port, u16 data);
-void outl(u16 port, u32 data);
+/*
+    x86 port I/O
+    - The accessors are forced inline (the kernel builds without -O, a
+      plain inline would still be a call), a port access is one
+      instruction
+    - ins* / outs* move count items between a port & memory with one
+      rep ins/outs, for PIO data registers (ATA sectors, ...) instead of
+      an in/out per word
+*/
+#define IO_WAIT_PORT 0x80 /* POST code port, unused after boot */
 
-u8 inb(u16 port);
-u16 inw(u16 port);
-u32 inl(u16 port);
+#define IO_INLINE static inline __attribute__((always_inline))
 
-void io_wait();
+IO_INLINE void outb(u16 port, u8 data) {
+    asm volatile("outb %0, %1" ::"a"(data), "Nd"(port));
+}
+
+IO_INLINE void outw(u16 port, u16 data) {
+    asm volatile("outw %0, %1" ::"a"(data), "Nd"(port));
+}
+
+IO_INLINE void outl(u16 port, u32 data) {
+    asm volatile("outl %0, %1" ::"a"(data), "Nd"(port));
+}
+
+IO_INLINE u8 inb(u16 port) {
+    u8 res;
+    asm volatile("inb %1, %0" : "=a"(res) : "Nd"(port));
+    return res;
+}
+
+IO_INLINE u16 inw(u16 port) {
+    u16 res;
+    asm volatile("inw %1, %0" : "=a"(res) : "Nd"(port));
+    return res;
+}
+
+IO_INLINE u32 inl(u16 port) {
+    u32 res;
+    asm volatile("inl %1, %0" : "=a"(res) : "Nd"(port));
+    return res;
+}
+
+IO_INLINE void insb(u16 port, void* buf, size_t count) {
+    asm volatile("rep insb" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+IO_INLINE void insw(u16 port, void* buf, size_t count) {
+    asm volatile("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+IO_INLINE void insl(u16 port, void* buf, size_t count) {
+    asm volatile("rep insl" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+IO_INLINE void outsb(u16 port, const void* buf, size_t count) {
+    asm volatile("rep outsb" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+IO_INLINE void outsw(u16 port, const void* buf, size_t count) {
+    asm volatile("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+IO_INLINE void outsl(u16 port, const void* buf, size_t count) {
+    asm volatile("rep outsl" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+IO_INLINE void io_wait() { outb(IO_WAIT_PORT, 0); }
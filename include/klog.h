@@ -0,0 +1,45 @@
+#pragma once
+
+#include <common.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Kernel log: a ring of timestamped records, written without locks
+    - Producers (any context, IRQs included) claim a sequence number with
+      one atomic add & format straight into its slot, nothing touches
+      the screen
+    - klog_flush() (idle loop) prints new records up to the console level,
+      dmesg dumps whatever the ring still holds
+    - A slow console loses the oldest records, never blocks a producer
+*/
+#define KLOG_RECORDS 256 /* power of 2 */
+#define KLOG_MSG_MAX 120
+
+enum klog_level {
+    KLOG_EMERG,
+    KLOG_ALERT,
+    KLOG_CRIT,
+    KLOG_ERR,
+    KLOG_WARNING,
+    KLOG_NOTICE,
+    KLOG_INFO,
+    KLOG_DEBUG,
+    KLOG_NUM_LEVELS,
+};
+
+struct klog_record {
+    u32 seq; /* sequence + 1 once written, 0 while being written */
+    u8 level;
+    u64 time; /* ktime_get_ns() */
+    char msg[KLOG_MSG_MAX];
+};
+
+int vklog(enum klog_level level, const char* format, va_list args);
+int klog(enum klog_level level, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+bool klog_flush();
+void klog_set_console_level(enum klog_level level);
+void klog_dump();
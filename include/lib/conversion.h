@@ -6,6 +6,40 @@
 #define C_TO_INT(c) ((c) - 48)
 #define INT_TO_C(n) ((char)((n) + 48))
 
+// Longest u64 in base 2, plus the NUL
+#define U64_STR_MAX 65
+
+/*
+    value / divisor with the remainder in *rem, without libgcc's 64-bit
+    division: on i386 the high half is divided first, after which the
+    remainder:low pair fits one divl
+*/
+static inline u64 div_u64_rem(u64 value, u32 divisor, u32* rem) {
+#ifdef __i386__
+    u32 high = (u32)(value >> 32);
+    u32 low = (u32)value;
+    u32 quot_high = high / divisor;
+    high %= divisor;
+
+    asm("divl %4" : "=a"(low), "=d"(*rem) : "a"(low), "d"(high), "rm"(divisor));
+    return ((u64)quot_high << 32) | low;
+#else
+    *rem = (u32)(value % divisor);
+    return value / divisor;
+#endif
+}
+
+/*
+    (value * mult) >> shift without a 64x64 multiply, as two 32x32 halves
+    NOTE: shift <= 32, bits past 64 of the high half are lost
+*/
+static inline u64 mul_u64_u32_shr(u64 value, u32 mult, u32 shift) {
+    u32 high = (u32)(value >> 32);
+    u64 ret = ((u64)(u32)value * mult) >> shift;
+    if (high != 0) ret += ((u64)high * mult) << (32 - shift);
+    return ret;
+}
+
 char itoh(int n);
 int htoi(char c);
 char to_upper(char c);
@@ -22,6 +56,8 @@ char* to_hex(size_t value, char* str);
 
 char* itoa(int value, char* str, int base);
 char* utoa(unsigned int value, char* str, int base);
+char* i64toa(i64 value, char* str, int base);
+char* u64toa(u64 value, char* str, int base);
 size_t atoub(const char* str);
 int atoi(const char* str);
 long int atol(const char* str);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <common.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+/*
+    Single pass formatter behind kprintf() & friends
+    - Conversions: d i u x X c s p %, with flags (- 0 + space #), width &
+      precision (numbers or *) and the hh h l ll z length modifiers
+    - %p prints the full pointer width in hex
+    - Output gathers in buf & goes to flush() when buf fills up and once at
+      the end, NUL terminated. Without flush() output past the end of buf
+      is dropped but still counted (like snprintf)
+*/
+struct fmt_out {
+    char* buf;
+    size_t size;  /* of buf, including the NUL */
+    size_t len;   /* chars waiting in buf */
+    size_t total; /* chars produced so far */
+    void (*flush)(struct fmt_out* out);
+    void* data; /* for flush() */
+};
+
+int vformat(struct fmt_out* out, const char* format, va_list args);
+
+int vsnprintf(char* buf, size_t size, const char* format, va_list args);
+int snprintf(char* buf, size_t size, const char* format, ...);
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Intrusive red-black tree (CLRS 13)
+    - Nodes are embedded in the owning struct, rb_entry() gets it back
+    - Callers do their own search: descend to the NULL link the new node
+      goes in, rb_link_node() it there then rb_insert_fixup() to rebalance
+*/
+struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    bool red;
+};
+
+struct rb_root {
+    struct rb_node* node;
+};
+
+#define RB_ROOT_INIT {NULL}
+#define rb_entry(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+static inline void rb_link_node(struct rb_node* node, struct rb_node* parent,
+                                struct rb_node** link) {
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    *link = node;
+}
+
+void rb_insert_fixup(struct rb_root* root, struct rb_node* node);
+void rb_erase(struct rb_root* root, struct rb_node* node);
+
+struct rb_node* rb_first(const struct rb_root* root);
+struct rb_node* rb_next(const struct rb_node* node);
+struct rb_node* rb_prev(const struct rb_node* node);
@@ -8,7 +8,6 @@ bool isalnum(int c);
 bool isspace(int c);
 bool isnum(int c);
 
-size_t strlen(const char* str);
 char* strcpy(char* dest, const char* src);
 char* strncpy(char* dest, const char* src, size_t num);
 
@@ -18,4 +17,30 @@ char* strncat(char* dest, const char* src, size_t num);
 int strcmp(const char* str1, const char* str2);
 int strncmp(const char* str1, const char* str2, size_t num);
 
-void* memcpy(void* dest, const void* src, size_t count);
\ No newline at end of file
+/*
+    Bulk memory & string routines dispatch through a table of
+    implementations, string_init() (arch code) installs the fastest the
+    CPU supports at boot. Until then the portable word-wide ones run
+*/
+struct string_ops {
+    const char* name;
+    void* (*memcpy)(void* dest, const void* src, size_t count);
+    void* (*memmove)(void* dest, const void* src, size_t count);
+    void* (*memset)(void* dest, int c, size_t count);
+    int (*memcmp)(const void* ptr1, const void* ptr2, size_t count);
+    size_t (*strlen)(const char* str);
+    char* (*strchr)(const char* str, int c);
+};
+
+extern const struct string_ops string_word_ops;
+
+void string_set_ops(const struct string_ops* ops);
+const struct string_ops* string_get_ops();
+
+size_t strlen(const char* str);
+char* strchr(const char* str, int c);
+
+void* memcpy(void* dest, const void* src, size_t count);
+void* memmove(void* dest, const void* src, size_t count);
+void* memset(void* dest, int c, size_t count);
+int memcmp(const void* ptr1, const void* ptr2, size_t count);
@@ -8,15 +8,19 @@
 
 #define PARSE_CMD(cmd) void parse_##cmd##_cmd(size_t num_args, char** args)
 
-typedef struct {
-    int x;
-    int y;
-} char_pos_st;
-
 void early_terminal_kh(key_st key);
 void clear_buffer();
 void early_terminal();
 void parse_in_cmd(size_t num_args, char** args);
 void parse_out_cmd(size_t num_args, char** args);
+void parse_affinity_cmd(size_t num_args, char** args);
+void parse_bench_cmd(size_t num_args, char** args);
+void parse_dmesg_cmd(size_t num_args, char** args);
 void parse_command();
 void kmain();
+
+// Boot info printers (arch/*/early.c)
+void print_mmap();
+void print_fb();
+void print_kernel_info();
+void* get_fb_base();
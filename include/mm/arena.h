@@ -0,0 +1,40 @@
+#pragma once
+
+#include <arch/i386/memlayout.h>
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Bump (arena) allocator
+    - Allocation is an align + add, nothing is freed individually
+    - arena_mark/arena_reset roll back everything allocated after a mark
+
+    The boot arena starts past the kernel image, multiboot info & modules
+    and serves allocations made before the frame allocator is up.
+    The frame allocator trims it once its descriptors are placed, the
+    unused tail is handed back by boot_arena_release()
+*/
+#define BOOT_ARENA_SLACK (256 * 1024) /* room left after the pmm is up */
+
+struct arena {
+    size_t start;
+    size_t cur;
+    size_t end;
+};
+
+typedef size_t arena_mark_t;
+
+void arena_init(struct arena* arena, void* start, size_t size);
+void* arena_alloc(struct arena* arena, size_t size, size_t align);
+arena_mark_t arena_mark(struct arena* arena);
+void arena_reset(struct arena* arena, arena_mark_t mark);
+size_t arena_remaining(struct arena* arena);
+
+bool boot_arena_init();
+void boot_arena_trim(size_t slack);
+void boot_arena_release();
+bool boot_arena_active();
+void get_boot_arena_range(phys_addr_t* start, phys_addr_t* end);
+
+void* boot_alloc(size_t size, size_t align);
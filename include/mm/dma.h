@@ -0,0 +1,41 @@
+#pragma once
+
+#include <arch/i386/memlayout.h>
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    DMA buffers for device drivers
+    - A device is described by the addresses it reaches & the boundary a
+      transfer can't cross (ISA DMA: 16 MiB & 64 KiB, see the 8237 docs)
+    - Coherent buffers are physically contiguous, zeroed & used through
+      the direct map (x86 DMA snoops the caches, WB is coherent)
+    - Streaming mappings give the device the caller's own buffer when it
+      can reach it (zero-copy), else a bounce buffer synced on map/unmap
+*/
+struct dma_dev {
+    phys_addr_t limit; /* highest reachable address + 1 */
+    size_t boundary;   /* power of 2 a transfer can't cross, 0 if none */
+};
+
+enum dma_dir { DMA_TO_DEVICE, DMA_FROM_DEVICE, DMA_BIDIRECTIONAL };
+
+struct dma_bounce {
+    phys_addr_t phys; /* what the device sees */
+    void* buf;        /* the caller's buffer */
+    struct dma_bounce* next;
+};
+
+extern const struct dma_dev dma_isa_dev;
+extern const struct dma_dev dma_32bit_dev;
+
+void* dma_alloc_coherent(const struct dma_dev* dev, size_t size,
+                         phys_addr_t* phys);
+void dma_free_coherent(void* virt, size_t size);
+
+phys_addr_t dma_map_single(const struct dma_dev* dev, void* buf, size_t size,
+                           enum dma_dir dir);
+void dma_unmap_single(phys_addr_t addr, size_t size, enum dma_dir dir);
+
+void dma_print_stats();
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <arch/i386/memlayout.h>
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Physical frame allocator (binary buddy system)
+    - Blocks are 2^order contiguous frames, aligned to their own size
+    - Free lists are indexed by order, free_mask caches which are non-empty
+      so finding a block is a single bit scan + at most MAX_ORDER splits
+    - Frames are split in zones, each with its own buddy lists:
+      ZONE_DMA (below 16 MiB) for ISA DMA, ZONE_NORMAL is reachable
+      through the direct map, ZONE_HIGH (past DIRECT_MAP_LIMIT, up to
+      paging_phys_limit()) only through map_page()
+*/
+#define PMM_MAX_ORDER 11 /* largest block: 2^10 frames (4 MiB) */
+#define PMM_MAX_RESERVED 32
+#define ZONE_DMA_LIMIT 0x1000000 /* 24-bit ISA DMA addresses */
+
+#define PFN_NONE 0xFFFFFFFF
+#define PHYS_TO_PFN(addr) ((u32)((addr) >> PAGE_SHIFT))
+#define PFN_TO_PHYS(pfn) ((phys_addr_t)(pfn) << PAGE_SHIFT)
+
+// Page flags
+#define PG_RESERVED (1 << 0) /* never handed out (firmware, kernel, ...) */
+#define PG_FREE (1 << 1)     /* head of a free block of size 2^order */
+#define PG_SLAB (1 << 2)     /* owned by a slab, priv points to it */
+
+// Frame descriptor, linked by pfn so it stays valid without paging
+struct page {
+    u32 next;
+    u32 prev;
+    u8 order;
+    u8 flags;
+    u16 reserved;
+    void* priv;
+};
+
+struct free_area {
+    u32 head;
+    u32 count;
+};
+
+// Allocations from a zone fall back to the zones below it
+enum zone_type { ZONE_DMA, ZONE_NORMAL, ZONE_HIGH, NUM_ZONES };
+
+struct zone {
+    const char* name;
+    u32 start_pfn;
+    u32 end_pfn;
+    struct free_area free_area[PMM_MAX_ORDER];
+    u32 free_mask;
+    size_t free_frames;
+    size_t total_frames;
+};
+
+struct mem_range {
+    phys_addr_t start;
+    phys_addr_t end;
+};
+
+void pmm_init();
+
+phys_addr_t pmm_alloc_frames(u8 order);
+phys_addr_t pmm_alloc_frames_zone(u8 order, enum zone_type zone);
+void pmm_free_frames(phys_addr_t addr, u8 order);
+phys_addr_t pmm_alloc_frame();
+void pmm_free_frame(phys_addr_t addr);
+void pmm_free_range(phys_addr_t start, phys_addr_t end);
+bool pmm_lock_held();
+
+struct page* pfn_to_page(u32 pfn);
+struct page* virt_to_page(const void* ptr);
+u32 pmm_get_max_pfn();
+size_t pmm_get_free_frames();
+size_t pmm_get_total_frames();
+void pmm_print_stats();
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <arch/i386/cpu_topology.h>
+#include <arch/i386/smp.h>
+#include <common.h>
+#include <spinlock.h>
+#include <stddef.h>
+
+/*
+    Slab allocator (Bonwick) with a per-CPU magazine layer
+    - Each cache hands out fixed size objects carved from slabs of
+      2^order frames, the slab header sits at the start of the slab
+    - Every CPU keeps a loaded & a previous magazine of object pointers.
+      Alloc/free only touch those with interrupts off, the cache lock is
+      taken only to refill or flush a whole magazine
+    - Each CPU's part sits on its own cache lines, past the shared ones
+      holding the lock, so the lock-free path never writes a line another
+      CPU uses
+    - kmalloc uses power of two size classes, larger requests go
+      straight to the frame allocator
+    - kmalloc objects are aligned to their size class up to
+      KMALLOC_MAX_ALIGN, frames to their size
+*/
+#define KMALLOC_MIN_SHIFT 4  /* 16 B */
+#define KMALLOC_MAX_SHIFT 12 /* 4 KiB */
+#define KMALLOC_NUM_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMALLOC_MAX_ALIGN 64
+
+#define SLAB_MAG_SIZE 32 /* upper bound, scaled down for large objects */
+#define SLAB_MIN_MAG_SIZE 8
+#define SLAB_MAX_ORDER 3
+#define SLAB_NAME_LEN 16
+#define SLAB_CPU_ALIGN CACHE_DEFAULT_LINE
+
+struct slab {
+    struct slab* next;
+    struct slab* prev;
+    struct kmem_cache* cache;
+    void* free_list;
+    u16 in_use;
+    u16 total;
+};
+
+struct kmem_magazine {
+    u32 count;
+    void* objs[SLAB_MAG_SIZE];
+};
+
+struct kmem_cpu_cache {
+    struct kmem_magazine* loaded;
+    struct kmem_magazine* prev; /* always full or empty */
+    struct kmem_magazine mags[2];
+    u32 allocs;
+    u32 frees;
+    u32 misses; /* times the cache lock was taken */
+} __attribute__((aligned(SLAB_CPU_ALIGN)));
+
+struct kmem_cache {
+    char name[SLAB_NAME_LEN];
+    size_t obj_size;
+    size_t align;
+    size_t obj_offset;
+    u16 objs_per_slab;
+    u16 mag_size;
+    u8 order;
+
+    spinlock_t lock;
+    struct slab* partial;
+    struct slab* full;
+    struct slab* empty;
+    size_t num_slabs;
+    size_t num_active; /* objects out of slabs, including magazines */
+
+    struct kmem_cache* next;
+    struct kmem_cpu_cache cpu[MAX_CPUS];
+};
+
+void slab_init();
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size,
+                                     size_t align);
+void kmem_cache_destroy(struct kmem_cache* cache);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+void kmem_cache_flush(struct kmem_cache* cache);
+
+void* kmalloc(size_t size);
+void kfree(void* ptr);
+
+void slab_print_stats();
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <arch/i386/memlayout.h>
+#include <arch/i386/pat.h>
+#include <common.h>
+#include <lib/rbtree.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Kernel virtual address space in [VMALLOC_START, VMALLOC_END)
+    - Regions in use sit in a red-black tree by address (fault & free
+      lookups), each followed by an unmapped guard page
+    - Free ranges sit in a tree by address (to merge with neighbours) and
+      in power of two size buckets: any range from a non-empty bucket
+      above the request fits, found with a single bit scan (like the PMM)
+    - Unmapping is lazy, freed regions are parked until VM_PURGE_PAGES
+      pile up then all of them are torn down behind one TLB shootdown
+      (every CPU), run without the lock held
+*/
+#define VM_NUM_BUCKETS 20   /* 2^19 pages covers the whole window */
+#define VM_PURGE_PAGES 8192 /* 32 MiB */
+
+// Region flags
+#define VM_LAZY (1 << 0)    /* demand-zero, frames mapped on first touch */
+#define VM_ALLOC (1 << 1)   /* vmalloc, frames owned by the region */
+#define VM_IOREMAP (1 << 2) /* device memory, frames aren't ours */
+
+struct vm_region {
+    struct rb_node node;
+    size_t start;
+    size_t end; /* excludes the guard page */
+    u32 flags;
+
+    // Size bucket (free ranges) or purge list (freed regions)
+    struct vm_region* next;
+    struct vm_region* prev;
+};
+
+void vm_init();
+
+void* vm_reserve_lazy(size_t size);
+void* vmalloc(size_t size);
+void vfree(void* ptr);
+void* ioremap(phys_addr_t phys, size_t size, enum mem_type type);
+void iounmap(void* ptr);
+void vm_release(void* ptr);
+void vm_purge();
+
+bool vm_handle_fault(size_t addr);
+
+void vm_print_regions();
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <arch/i386/memlayout.h>
+#include <common.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Pool of pre-zeroed ZONE_NORMAL frames
+    - Refilled one frame at a time from the idle loop (see cpu_idle)
+    - Frames are cleared with non-temporal stores (movnti) when the CPU
+      has SSE2, so zeroing doesn't evict the working set from the caches
+*/
+#define ZERO_POOL_SIZE 64
+#define ZERO_POOL_MIN_FREE 1024 /* don't refill below this many free frames */
+
+void zero_pool_init();
+bool zero_pool_refill();
+phys_addr_t zero_pool_get();
+void zero_pool_print_stats();
+
+extern void (*clear_page)(void* page);
@@ -18,3 +18,10 @@
 #define MB2_EFI_I386_TYPE 8
 #define MB2_EFI_AMD64_TYPE 9
 #define MB2_RELOC_TYPE 10
+
+#define MB2_TAG_OPTIONAL 1
+
+// Preferred framebuffer mode, 0 leaves the choice to the bootloader
+#define MB2_FB_WIDTH 1024
+#define MB2_FB_HEIGHT 768
+#define MB2_FB_DEPTH 32
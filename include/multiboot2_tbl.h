@@ -3,7 +3,6 @@
 #include <stddef.h>
 
 #define NUM_MB2_ENTRIES 21
-#define NUM_MB2_MODS 10
 #define TAG_ALIGN(ptr) (((ptr) + 7) & (~7))
 
 struct mb2_tbl_hdr {
@@ -11,6 +10,7 @@ struct mb2_tbl_hdr {
     u32 reserved;
 };
 
+#define MB2_TAG_END_TYPE 0
 struct mb2_tag_hdr {
     u32 type;
     u32 size;
@@ -179,14 +179,17 @@ struct mb2_fb_info {
     u32 height;
     u8 bpp;
     u8 type;
-    u8 reserved;
+    u16 reserved;
+    // Followed by mb2_fb_idx_clr or mb2_fb_rgb_clr depending on type
 };
 typedef struct {
-    size_t addr;
+    u64 addr;
     u32 pitch;
     u32 width;
     u32 height;
     u8 bpp;
+    u8 type; /* MB2_FB_IDX_CLR, MB2_FB_RGB_CLR or MB2_FB_EGA */
+    struct mb2_fb_rgb_clr rgb; /* MB2_FB_RGB_CLR only */
 } fb_info_st;
 
 // Also contains SMBIOS tables after
@@ -252,9 +255,11 @@ struct mb2_efi64_img {
 };
 
 void mb2_tbl_init(const void* ptr);
+void mb2_mods_init();
+void get_mb2_tbl_range(size_t* start, size_t* end);
 
 // Memory info -- might change later
-size_t get_total_mem_kb();
+u64 get_total_mem_kb();
 void get_mmap(mmap_tbl_st* map);
 void* get_loadaddr();
 
@@ -271,4 +276,6 @@ void get_apm_info(apm_info_st* ptr);
 int get_acpi_version();
 void* get_rsdp();
 
-mod_info_st** get_modules();
\ No newline at end of file
+mod_info_st** get_modules();
+size_t get_num_modules();
+size_t get_modules_end();
\ No newline at end of file
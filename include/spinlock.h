@@ -0,0 +1,37 @@
+#pragma once
+
+#include <arch/i386/cpu.h>
+#include <common.h>
+#include <stdbool.h>
+
+typedef struct {
+    volatile u32 locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+        while (lock->locked) cpu_relax();
+}
+
+// Returns false if the lock is held
+static inline bool spin_trylock(spinlock_t* lock) {
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+// For data also touched from interrupt handlers
+static inline u32 spin_lock_irqsave(spinlock_t* lock) {
+    u32 flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, u32 flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
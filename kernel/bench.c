@@ -0,0 +1,308 @@
+#include <arch/i386/cpu.h>
+#include <arch/i386/delay.h>
+#include <arch/i386/string_ops.h>
+#include <bench.h>
+#include <early_kprintf.h>
+#include <io.h>
+#include <lib/conversion.h>
+#include <lib/string.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <mm/vm.h>
+
+static void* bench_ptrs[BENCH_OBJS];
+static size_t bench_sizes[BENCH_OBJS];
+static u32 bench_seed = 1;
+
+static u32 _bench_rand() {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 16;
+}
+
+// Mostly small objects, like a real kernel workload
+static size_t _bench_rand_size() {
+    u32 shift = 4 + (_bench_rand() % 9);
+    if (_bench_rand() % 4 != 0 && shift > 8) shift -= 4;
+    return (_bench_rand() % (1 << shift)) + 1;
+}
+
+static void _bench_slab_fill(size_t* requested) {
+    for (size_t i = 0; i < BENCH_OBJS; i++) {
+        if (bench_ptrs[i] != NULL) continue;
+
+        bench_sizes[i] = _bench_rand_size();
+        bench_ptrs[i] = kmalloc(bench_sizes[i]);
+        if (bench_ptrs[i] != NULL) *requested += bench_sizes[i];
+    }
+}
+
+// ops done in cycles as a rate, 0 if the TSC rate isn't known
+static u64 _ops_per_sec(u32 ops, u32 cycles) {
+    u32 khz = tsc_get_khz();
+    if (khz == 0) return 0;
+    if (cycles == 0) cycles = 1;
+
+    u32 rem;
+    return div_u64_rem((u64)ops * khz * 1000, cycles, &rem);
+}
+
+static void _bench_slab_report(const char* name, u32 ops, u32 cycles) {
+    if (ops == 0) ops = 1;
+    u64 rate = _ops_per_sec(ops, cycles);
+    if (rate != 0)
+        kprintf("  %s: %u ops, %u cycles/op, %llu ops/s\n", name, ops,
+                cycles / ops, rate);
+    else
+        kprintf("  %s: %u ops, %u cycles/op\n", name, ops, cycles / ops);
+}
+
+void bench_slab() {
+    kputs("kmalloc+kfree pairs (magazine hot path):\n");
+    for (size_t size = 16; size <= 4096; size <<= 1) {
+        u64 start = rdtsc();
+        for (u32 i = 0; i < BENCH_ITERS; i++) kfree(kmalloc(size));
+        u32 cycles = (u32)(rdtsc() - start);
+
+        u64 rate = _ops_per_sec(BENCH_ITERS, cycles);
+        if (rate != 0)
+            kprintf("  %u B: %u cycles/pair, %llu pairs/s\n", size,
+                    cycles / BENCH_ITERS, rate);
+        else
+            kprintf("  %u B: %u cycles/pair\n", size, cycles / BENCH_ITERS);
+    }
+
+    kputs("Random sizes, half freed then refilled:\n");
+    size_t free_before = pmm_get_free_frames();
+    size_t requested = 0;
+    bench_seed = 1;
+
+    u64 start = rdtsc();
+    _bench_slab_fill(&requested);
+    _bench_slab_report("alloc", BENCH_OBJS, (u32)(rdtsc() - start));
+
+    start = rdtsc();
+    u32 freed = 0;
+    for (size_t i = 0; i < BENCH_OBJS; i++) {
+        if (_bench_rand() % 2 == 0 || bench_ptrs[i] == NULL) continue;
+
+        kfree(bench_ptrs[i]);
+        bench_ptrs[i] = NULL;
+        requested -= bench_sizes[i];
+        freed++;
+    }
+    _bench_slab_report("free", freed, (u32)(rdtsc() - start));
+
+    start = rdtsc();
+    _bench_slab_fill(&requested);
+    _bench_slab_report("refill", freed, (u32)(rdtsc() - start));
+
+    // Fragmentation: live bytes vs frames the allocator had to take
+    size_t used = (free_before - pmm_get_free_frames()) * PAGE_SIZE;
+    u32 frag = (used == 0 || requested > used)
+                   ? 0
+                   : 100 - (u32)(requested * 100 / used);
+    kprintf("  live %u B in %u B of frames, fragmentation %u%%\n", requested,
+            used, frag);
+
+    for (size_t i = 0; i < BENCH_OBJS; i++) {
+        kfree(bench_ptrs[i]);
+        bench_ptrs[i] = NULL;
+    }
+}
+
+enum bench_mem_op { BENCH_MEMCPY, BENCH_MEMSET, BENCH_MEMCMP, BENCH_STRLEN };
+
+static const char* bench_mem_ops[] = {"memcpy", "memset", "memcmp", "strlen"};
+static const size_t bench_mem_sizes[] = {16, 256, 4096, BENCH_MEM_MAX};
+
+// Returns cycles for BENCH_MEM_BYTES worth of op on size byte buffers
+static u32 _bench_mem_run(const struct string_ops* ops, enum bench_mem_op op,
+                          u8* src, u8* dst, size_t size) {
+    memset(src, 'a', size);
+    memset(dst, 'a', size);
+    if (op == BENCH_STRLEN) src[size - 1] = '\0';
+
+    u32 iters = BENCH_MEM_BYTES / size;
+    u64 start = rdtsc();
+    for (u32 i = 0; i < iters; i++) {
+        switch (op) {
+            case BENCH_MEMCPY:
+                ops->memcpy(dst, src, size);
+                break;
+            case BENCH_MEMSET:
+                ops->memset(dst, 0, size);
+                break;
+            case BENCH_MEMCMP:
+                ops->memcmp(dst, src, size);
+                break;
+            case BENCH_STRLEN:
+                ops->strlen((const char*)src);
+                break;
+        }
+    }
+
+    return (u32)(rdtsc() - start);
+}
+
+void bench_mem() {
+    u8* src = vmalloc(BENCH_MEM_MAX);
+    u8* dst = vmalloc(BENCH_MEM_MAX);
+    if (src == NULL || dst == NULL) {
+        kputs("Out of memory!\n");
+        vfree(src);
+        vfree(dst);
+        return;
+    }
+
+    const struct string_ops* impls[STRING_MAX_IMPLS];
+    size_t num_impls = string_get_impls(impls);
+    kprintf("Active: %s\n", string_get_ops()->name);
+    kputs("Bytes per 1000 cycles at 16 B, 256 B, 4 KiB, 1 MiB:\n");
+
+    for (u32 op = BENCH_MEMCPY; op <= BENCH_STRLEN; op++) {
+        kprintf("%s\n", bench_mem_ops[op]);
+        for (size_t i = 0; i < num_impls; i++) {
+            kprintf("  %s:", impls[i]->name);
+            for (size_t j = 0; j < 4; j++) {
+                u32 cycles = _bench_mem_run(impls[i], op, src, dst,
+                                            bench_mem_sizes[j]);
+                u32 kcycles = cycles / 1000;
+                if (kcycles == 0) kcycles = 1;
+
+                kprintf(" %u", BENCH_MEM_BYTES / kcycles);
+            }
+            kputchar('\n');
+        }
+    }
+
+    vfree(src);
+    vfree(dst);
+}
+
+/*
+    Baseline for bench_conv(): the conversions lib/conversion.c had before
+    the lookup table versions (divide per digit, switch per digit, reverse)
+*/
+static char _bench_old_itoh(int n) {
+    if (n >= 0 && n <= 9) return INT_TO_C(n);
+
+    switch (n) {
+        case 0xA:
+            return 'A';
+        case 0xB:
+            return 'B';
+        case 0xC:
+            return 'C';
+        case 0xD:
+            return 'D';
+        case 0xE:
+            return 'E';
+        case 0xF:
+            return 'F';
+        default:
+            return (char)n;
+    }
+}
+
+static char* _bench_old_utoa(unsigned int value, char* str, int base) {
+    if (value == 0) {
+        str[0] = '0';
+        str[1] = '\0';
+        return str;
+    }
+
+    size_t i = 0;
+    while (value > 0) {
+        str[i++] = _bench_old_itoh(value % base);
+        value /= base;
+    }
+    str[i] = '\0';
+
+    for (size_t j = 0; j <= (i - 1) / 2; j++) {
+        char cpy = str[j];
+        str[j] = str[i - 1 - j];
+        str[i - 1 - j] = cpy;
+    }
+
+    return str;
+}
+
+static void _bench_conv_report(const char* name, u32 cycles) {
+    kprintf("  %s: %u cycles/call\n", name,
+            cycles / (BENCH_ITERS / BENCH_CONV_VALUES * BENCH_CONV_VALUES));
+}
+
+#define BENCH_CONV(name, call)                                        \
+    do {                                                              \
+        u64 start = rdtsc();                                          \
+        for (u32 i = 0; i < BENCH_ITERS / BENCH_CONV_VALUES; i++)     \
+            for (u32 j = 0; j < BENCH_CONV_VALUES; j++) call;         \
+        _bench_conv_report(name, (u32)(rdtsc() - start));             \
+    } while (0)
+
+void bench_conv() {
+    // All digit counts show up, like the sizes & addresses kprintf prints
+    static u64 values[BENCH_CONV_VALUES];
+    bench_seed = 1;
+    for (u32 i = 0; i < BENCH_CONV_VALUES; i++) {
+        u64 val = ((u64)_bench_rand() << 48) | ((u64)_bench_rand() << 32) |
+                  (_bench_rand() << 16) | _bench_rand();
+        values[i] = val >> (i % 64);
+    }
+
+    char str[U64_STR_MAX];
+    kputs("u32 base 10:\n");
+    BENCH_CONV("old utoa", _bench_old_utoa((u32)values[j], str, 10));
+    BENCH_CONV("utoa", utoa((u32)values[j], str, 10));
+
+    kputs("u32 base 16:\n");
+    BENCH_CONV("old utoa", _bench_old_utoa((u32)values[j], str, 16));
+    BENCH_CONV("utoa", utoa((u32)values[j], str, 16));
+
+    kputs("u64 (had no direct conversion):\n");
+    BENCH_CONV("u64toa 10", u64toa(values[j], str, 10));
+    BENCH_CONV("u64toa 16", u64toa(values[j], str, 16));
+    BENCH_CONV("to_hex_u64", to_hex_u64(values[j], str));
+}
+
+static void _bench_pio_report(const char* name, u32 cycles) {
+    kprintf("  %s: %u cycles/byte\n", name,
+            cycles / (BENCH_PIO_SECTORS * BENCH_PIO_BYTES));
+}
+
+/*
+    Sector sized transfers through the POST code port, an in/out per byte
+    against a single rep insb/outsb
+    NOTE: byte wide only, a word access to 0x80 also hits 0x81 (the DMA
+    channel 2 page register). Each access is a bus cycle (a VM exit under
+    a hypervisor), rep saves the loop & lets the hypervisor batch the
+    string op
+*/
+void bench_pio() {
+    static u8 sector[BENCH_PIO_BYTES];
+    u64 start;
+
+    kputs("Port reads:\n");
+    start = rdtsc();
+    for (u32 i = 0; i < BENCH_PIO_SECTORS; i++)
+        for (u32 j = 0; j < BENCH_PIO_BYTES; j++)
+            sector[j] = inb(IO_WAIT_PORT);
+    _bench_pio_report("inb loop", (u32)(rdtsc() - start));
+
+    start = rdtsc();
+    for (u32 i = 0; i < BENCH_PIO_SECTORS; i++)
+        insb(IO_WAIT_PORT, sector, BENCH_PIO_BYTES);
+    _bench_pio_report("rep insb", (u32)(rdtsc() - start));
+
+    kputs("Port writes:\n");
+    start = rdtsc();
+    for (u32 i = 0; i < BENCH_PIO_SECTORS; i++)
+        for (u32 j = 0; j < BENCH_PIO_BYTES; j++)
+            outb(IO_WAIT_PORT, sector[j]);
+    _bench_pio_report("outb loop", (u32)(rdtsc() - start));
+
+    start = rdtsc();
+    for (u32 i = 0; i < BENCH_PIO_SECTORS; i++)
+        outsb(IO_WAIT_PORT, sector, BENCH_PIO_BYTES);
+    _bench_pio_report("rep outsb", (u32)(rdtsc() - start));
+}
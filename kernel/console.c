@@ -0,0 +1,54 @@
+#include <console.h>
+#include <lib/string.h>
+#include <spinlock.h>
+
+static void _vga_write(const char* str, COLORS fg) {
+    tty_print_color_string(str, fg);
+}
+
+static struct console vga_console = {"vga", _vga_write, tty_clear_screen,
+                                     NULL};
+
+static struct console* consoles = &vga_console;
+static spinlock_t console_lock = SPINLOCK_INIT;
+
+void console_register(struct console* con) {
+    u32 flags = spin_lock_irqsave(&console_lock);
+    con->next = consoles;
+    consoles = con;
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_unregister(const char* name) {
+    u32 flags = spin_lock_irqsave(&console_lock);
+    for (struct console** con = &consoles; *con != NULL;
+         con = &(*con)->next) {
+        if (strcmp((*con)->name, name) == 0) {
+            *con = (*con)->next;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+/*
+    Hands str to every console
+    NOTE: console_lock is held across the walk, so text from different
+    CPUs never interleaves & the sinks (VGA cursor & shadow rows) see one
+    writer at a time. A sink must not print itself
+*/
+int console_write(const char* str, COLORS fg) {
+    u32 flags = spin_lock_irqsave(&console_lock);
+    for (struct console* con = consoles; con != NULL; con = con->next)
+        con->write(str, fg);
+    spin_unlock_irqrestore(&console_lock, flags);
+
+    return strlen(str);
+}
+
+void console_clear() {
+    u32 flags = spin_lock_irqsave(&console_lock);
+    for (struct console* con = consoles; con != NULL; con = con->next)
+        if (con->clear != NULL) con->clear();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
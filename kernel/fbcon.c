@@ -0,0 +1,284 @@
+#include <console.h>
+#include <early_kprintf.h>
+#include <fbcon.h>
+#include <font8x8.h>
+#include <lib/string.h>
+#include <mm/slab.h>
+#include <mm/vm.h>
+#include <spinlock.h>
+
+static struct fbcon con = {};
+static bool active = false;
+static spinlock_t fbcon_lock = SPINLOCK_INIT;
+
+// Standard VGA palette (0xRRGGBB) indexed by COLORS
+static const u32 vga_rgb[FBCON_COLORS] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA,
+    0xAA5500, 0xAAAAAA, 0x555555, 0x5555FF, 0x55FF55, 0x55FFFF,
+    0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF};
+
+static inline u32 _channel(u32 val, u8 pos, u8 size) {
+    if (size == 0) return 0;
+    return (size >= 8) ? val << pos : (val >> (8 - size)) << pos;
+}
+
+// 0xRRGGBB to the framebuffer's pixel layout
+static u32 _pack(u32 rgb, const struct mb2_fb_rgb_clr* fmt) {
+    return _channel((rgb >> 16) & 0xFF, fmt->red_pos, fmt->red_mask_size) |
+           _channel((rgb >> 8) & 0xFF, fmt->green_pos,
+                    fmt->green_mask_size) |
+           _channel(rgb & 0xFF, fmt->blue_pos, fmt->blue_mask_size);
+}
+
+// Expands the whole font to fg on bg pixels
+static u8* _build_glyphs(COLORS fg) {
+    u8* cache = kmalloc(FONT_GLYPHS * con.glyph_size);
+    if (cache == NULL) return NULL;
+
+    u8* dst = cache;
+    for (int glyph = 0; glyph < FONT_GLYPHS; glyph++) {
+        for (int line = 0; line < FONT_HEIGHT; line++) {
+            u8 bits = font8x8[glyph][line];
+            for (int x = 0; x < FONT_WIDTH; x++) {
+                u32 pixel = (bits & (1 << x)) ? con.palette[fg]
+                                              : con.palette[con.bg];
+                memcpy(dst, &pixel, con.bytes_pp);
+                dst += con.bytes_pp;
+            }
+        }
+    }
+
+    return cache;
+}
+
+// Back buffer row of screen row row
+static inline int _ring_row(int row) {
+    int ring = con.top + row;
+    return (ring >= con.rows) ? ring - con.rows : ring;
+}
+
+static inline u8* _back_cell(int row, int col) {
+    return con.back + _ring_row(row) * FONT_HEIGHT * con.back_pitch +
+           col * FONT_WIDTH * con.bytes_pp;
+}
+
+static inline u16* _cells(int row) {
+    return con.cells + _ring_row(row) * con.cols;
+}
+
+static void _mark_dirty(int row, int start, int end) {
+    struct fbcon_span* span = &con.dirty[row];
+    if (span->start >= span->end) {
+        span->start = start;
+        span->end = end;
+        return;
+    }
+
+    if (start < span->start) span->start = start;
+    if (end > span->end) span->end = end;
+}
+
+// NOTE: the glyphs for fg are built before the lock is taken
+static void _draw_char(char c, COLORS fg) {
+    if (con.glyphs[fg] == NULL) return;
+
+    if (c < FONT_FIRST || c > FONT_LAST) c = '?';
+    _cells(con.row)[con.col] = (c == ' ') ? FBCON_BLANK : FBCON_CELL(c, fg);
+    const u8* src = con.glyphs[fg] + (c - FONT_FIRST) * con.glyph_size;
+    u8* dst = _back_cell(con.row, con.col);
+    size_t line_bytes = FONT_WIDTH * con.bytes_pp;
+    for (int line = 0; line < FONT_HEIGHT; line++) {
+        memcpy(dst, src, line_bytes);
+        src += line_bytes;
+        dst += con.back_pitch;
+    }
+
+    _mark_dirty(con.row, con.col, con.col + 1);
+}
+
+// Fills the first scanline with bg, then copies it down the text row
+static void _clear_row(int row) {
+    u8* line = _back_cell(row, 0);
+    u32 pixel = con.palette[con.bg];
+    for (u32 offset = 0; offset < con.back_pitch; offset += con.bytes_pp)
+        memcpy(line + offset, &pixel, con.bytes_pp);
+
+    for (int i = 1; i < FONT_HEIGHT; i++)
+        memcpy(line + i * con.back_pitch, line, con.back_pitch);
+
+    memset(_cells(row), FBCON_BLANK, con.cols * sizeof(u16));
+    _mark_dirty(row, 0, con.cols);
+}
+
+// Every screen row now shows the next back buffer row, flushed by diff
+static void _scroll() {
+    con.top = _ring_row(1);
+    _clear_row(con.rows - 1);
+
+    for (int row = 0; row < con.rows - 1; row++)
+        _mark_dirty(row, 0, con.cols);
+    con.scrolls++;
+}
+
+/*
+    Copies the dirty spans out to the framebuffer, line by line, each
+    narrowed to the cells that differ from what's shown
+*/
+static void _flush() {
+    size_t cell_bytes = FONT_WIDTH * con.bytes_pp;
+    for (int row = 0; row < con.rows; row++) {
+        struct fbcon_span* span = &con.dirty[row];
+        if (span->start >= span->end) continue;
+
+        const u16* cells = _cells(row);
+        u16* shown = con.shown + row * con.cols;
+        int start = span->start, end = span->end;
+        span->start = span->end = 0;
+        while (start < end && cells[start] == shown[start]) start++;
+        while (end > start && cells[end - 1] == shown[end - 1]) end--;
+        if (start == end) continue;
+
+        memcpy(shown + start, cells + start, (end - start) * sizeof(u16));
+        size_t offset = start * cell_bytes;
+        size_t bytes = (end - start) * cell_bytes;
+        const u8* src = _back_cell(row, start);
+        u8* dst = con.fb + row * FONT_HEIGHT * con.pitch + offset;
+        for (int line = 0; line < FONT_HEIGHT; line++) {
+            memcpy(dst, src, bytes);
+            src += con.back_pitch;
+            dst += con.pitch;
+        }
+
+        con.flushed += bytes * FONT_HEIGHT;
+    }
+}
+
+// Builds fg's glyphs if missing, kmalloc outside fbcon_lock
+static void _prepare_glyphs(COLORS fg) {
+    if (con.glyphs[fg] != NULL) return;
+
+    u8* cache = _build_glyphs(fg);
+    u32 flags = spin_lock_irqsave(&fbcon_lock);
+    if (con.glyphs[fg] == NULL) {
+        con.glyphs[fg] = cache;
+        cache = NULL;
+    }
+    spin_unlock_irqrestore(&fbcon_lock, flags);
+    kfree(cache);
+}
+
+static void _fbcon_write(const char* str, COLORS fg) {
+    fg %= FBCON_COLORS;
+    _prepare_glyphs(fg);
+
+    u32 flags = spin_lock_irqsave(&fbcon_lock);
+    for (; *str != '\0'; str++) {
+        switch (*str) {
+            case '\r':
+            case '\n':
+                con.col = 0;
+                con.row++;
+                break;
+            case '\t':
+                con.col = (con.col + FBCON_TAB) & ~(FBCON_TAB - 1);
+                break;
+            case '\b':
+                if (con.col > 0) con.col--;
+                break;
+
+            default:
+                _draw_char(*str, fg);
+                con.col++;
+        }
+
+        if (con.col >= con.cols) {
+            con.col = 0;
+            con.row++;
+        }
+        if (con.row >= con.rows) {
+            _scroll();
+            con.row = con.rows - 1;
+        }
+    }
+
+    _flush();
+    spin_unlock_irqrestore(&fbcon_lock, flags);
+}
+
+static void _fbcon_clear() {
+    u32 flags = spin_lock_irqsave(&fbcon_lock);
+    for (int row = 0; row < con.rows; row++) _clear_row(row);
+    con.row = con.col = 0;
+
+    _flush();
+    spin_unlock_irqrestore(&fbcon_lock, flags);
+}
+
+static struct console fb_console = {"fb", _fbcon_write, _fbcon_clear, NULL};
+
+/*
+    Takes over the screen from the VGA text console when booted with an
+    RGB framebuffer (fb is its mapping)
+    - Indexed colour & odd pixel sizes stay on VGA text (if any)
+*/
+bool fbcon_init(void* fb, const fb_info_st* info) {
+    u32 bytes_pp = (info->bpp + 7) / 8;
+    if (fb == NULL || info->type != MB2_FB_RGB_CLR) return false;
+    if (bytes_pp < 2 || bytes_pp > 4) {
+        kerror("FB: unsupported %u bpp framebuffer!\n", info->bpp);
+        return false;
+    }
+
+    con.fb = fb;
+    con.pitch = info->pitch;
+    con.bytes_pp = bytes_pp;
+    con.cols = info->width / FONT_WIDTH;
+    con.rows = info->height / FONT_HEIGHT;
+    con.back_pitch = con.cols * FONT_WIDTH * bytes_pp;
+    con.glyph_size = FONT_WIDTH * FONT_HEIGHT * bytes_pp;
+    con.bg = BLACK;
+    for (int i = 0; i < FBCON_COLORS; i++)
+        con.palette[i] = _pack(vga_rgb[i], &info->rgb);
+
+    size_t cells = con.rows * con.cols * sizeof(u16);
+    con.back = vmalloc(con.rows * FONT_HEIGHT * con.back_pitch);
+    con.dirty = kmalloc(con.rows * sizeof(struct fbcon_span));
+    con.cells = kmalloc(cells);
+    con.shown = kmalloc(cells);
+    if (con.back == NULL || con.dirty == NULL || con.cells == NULL ||
+        con.shown == NULL) {
+        kerror("FB: no memory for the console back buffer!\n");
+        vfree(con.back);
+        kfree(con.dirty);
+        kfree(con.cells);
+        kfree(con.shown);
+        return false;
+    }
+    memset(con.dirty, 0, con.rows * sizeof(struct fbcon_span));
+    // Nothing matches, so the first flush paints the whole screen
+    memset(con.shown, 0xFF, cells);
+
+    _fbcon_clear();
+    console_register(&fb_console);
+    console_unregister("vga");
+    active = true;
+    return true;
+}
+
+void fbcon_print_info() {
+    if (!active) {
+        kputs("FB console: inactive\n");
+        return;
+    }
+
+    int cached = 0;
+    for (int i = 0; i < FBCON_COLORS; i++)
+        if (con.glyphs[i] != NULL) cached++;
+
+    kprintf("FB console: %dx%d cells, %u bytes/pixel, back buffer %u KiB\n",
+            con.cols, con.rows, con.bytes_pp,
+            (con.rows * FONT_HEIGHT * con.back_pitch) >> 10);
+    kprintf("Glyph cache: %d colours (%u KiB), %u scrolls, %llu KiB flushed\n",
+            cached, (cached * FONT_GLYPHS * con.glyph_size) >> 10,
+            con.scrolls, con.flushed >> 10);
+}
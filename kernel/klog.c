@@ -0,0 +1,128 @@
+#include <arch/i386/clocksource.h>
+#include <console.h>
+#include <early_kprintf.h>
+#include <klog.h>
+#include <lib/conversion.h>
+#include <lib/printf.h>
+
+static struct klog_record records[KLOG_RECORDS];
+static u32 klog_head = 0; /* next sequence to hand out */
+static u32 klog_tail = 0; /* next sequence for the console */
+static u32 klog_lost = 0;
+static u32 klog_flushing = 0;
+static enum klog_level console_level = KLOG_INFO;
+
+static const char* level_names[KLOG_NUM_LEVELS] = {
+    "emerg", "alert", "crit", "err", "warn", "notice", "info", "debug"};
+
+int vklog(enum klog_level level, const char* format, va_list args) {
+    u32 seq = __atomic_fetch_add(&klog_head, 1, __ATOMIC_RELAXED);
+    struct klog_record* rec = &records[seq % KLOG_RECORDS];
+
+    // Readers skip the slot until the new sequence is published
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec->level = level;
+    rec->time = ktime_get_ns();
+    int len = vsnprintf(rec->msg, KLOG_MSG_MAX, format, args);
+
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+    return len;
+}
+
+int klog(enum klog_level level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vklog(level, format, args);
+    va_end(args);
+
+    return len;
+}
+
+/*
+    Copies record seq to out
+    Returns false if it isn't written yet or was overwritten while copied
+*/
+static bool _read_record(u32 seq, struct klog_record* out) {
+    struct klog_record* rec = &records[seq % KLOG_RECORDS];
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != seq + 1) return false;
+
+    *out = *rec;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq + 1;
+}
+
+static void _print_record(struct klog_record* rec) {
+    if (rec->level <= KLOG_ERR) {
+        console_write(rec->msg, RED);
+    } else if (rec->level == KLOG_WARNING) {
+        console_write(rec->msg, YELLOW);
+    } else {
+        kputs(rec->msg);
+    }
+}
+
+/*
+    Prints records the console hasn't seen yet (up to the console level)
+    - One flusher at a time, anyone else finding it busy just returns
+    Returns true if anything was printed
+*/
+bool klog_flush() {
+    if (__atomic_exchange_n(&klog_flushing, 1, __ATOMIC_ACQUIRE)) return false;
+
+    bool printed = false;
+    struct klog_record rec;
+    for (;;) {
+        u32 head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+        if (klog_tail == head) break;
+
+        // Producers lapped the console, the oldest records are gone
+        if (head - klog_tail > KLOG_RECORDS) {
+            klog_lost += head - KLOG_RECORDS - klog_tail;
+            klog_tail = head - KLOG_RECORDS;
+            continue;
+        }
+
+        if (!_read_record(klog_tail, &rec)) {
+            // Overwritten mid-copy: lapped, else still being written
+            if (__atomic_load_n(&klog_head, __ATOMIC_ACQUIRE) - klog_tail >
+                KLOG_RECORDS)
+                continue;
+            break;
+        }
+
+        if (klog_lost != 0) {
+            kprintf("klog: %u messages lost\n", klog_lost);
+            klog_lost = 0;
+        }
+        if (rec.level <= console_level) {
+            _print_record(&rec);
+            printed = true;
+        }
+        klog_tail++;
+    }
+
+    __atomic_store_n(&klog_flushing, 0, __ATOMIC_RELEASE);
+    return printed;
+}
+
+void klog_set_console_level(enum klog_level level) {
+    console_level = (level < KLOG_NUM_LEVELS) ? level : KLOG_DEBUG;
+}
+
+// Everything still in the ring, oldest first
+void klog_dump() {
+    u32 head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+    u32 seq = (head > KLOG_RECORDS) ? head - KLOG_RECORDS : 0;
+
+    struct klog_record rec;
+    for (; seq != head; seq++) {
+        if (!_read_record(seq, &rec)) continue;
+
+        u32 ns;
+        u64 sec = div_u64_rem(rec.time, NSEC_PER_SEC, &ns);
+        kprintf("[%5llu.%06u] %-6s %s", sec, ns / NSEC_PER_USEC,
+                level_names[rec.level], rec.msg);
+    }
+}
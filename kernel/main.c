@@ -1,31 +1,54 @@
+#include <arch/i386/acpi.h>
+#include <arch/i386/clocksource.h>
+#include <arch/i386/cpu_topology.h>
+#include <arch/i386/cpuid_info.h>
+#include <arch/i386/idle.h>
+#include <arch/i386/irq.h>
 #include <arch/i386/ps2_keyboard.h>
+#include <arch/i386/serial.h>
+#include <arch/i386/smp.h>
+#include <bench.h>
+#include <console.h>
 #include <early_print.h>
 #include <io.h>
+#include <klog.h>
 #include <lib/conversion.h>
 #include <lib/string.h>
 #include <main.h>
+#include <mm/dma.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <mm/vm.h>
+#include <mm/zero_pool.h>
 #include <multiboot2_tbl.h>
-
+#include <spinlock.h>
+
+/*
+    The line buffer belongs to the key handlers until returned is set, then
+    to the shell until it clears it: keys typed while a command runs are
+    dropped. input_lock keeps two input IRQs (keyboard & serial, if one was
+    moved off CPU 0) from editing it at once
+*/
 static char buff[MAX_BUFF_SIZE] = {0};
-static char_pos_st pos[MAX_BUFF_SIZE] = {0};
 static size_t len = 0;
-static bool returned = false;
+static volatile bool returned = false;
+static spinlock_t input_lock = SPINLOCK_INIT;
 
-void early_terminal_kh(key_st key) {
+static void _edit_line(key_st key) {
     if (key.pressedDown && key.cmd == NOT_CMD) {
         char c = key.data;
         if (c == '\n') {
-            returned = true;
+            __atomic_store_n(&returned, true, __ATOMIC_RELEASE);
+            if (smp_cpu_id() != 0) smp_wake_cpu(0);
             return;
         }
 
         if (c == '\b') {
             if (len == 0) return;
 
-            // clear last char, move tty pos to last char, update buffer info
+            // step back over the last char on every console & blank it
             len--;
-            set_pos(pos[len].x, pos[len].y);
-            tty_put_char('\0');
+            kputs("\b \b");
             buff[len] = 0;
             return;
         }
@@ -33,18 +56,19 @@ void early_terminal_kh(key_st key) {
         if (len == MAX_BUFF_SIZE) return;
 
         buff[len] = c;
-        pos[len].x = get_x_pos();
-        pos[len].y = get_y_pos();
         kputchar(c);
         len++;
     }
 }
 
+void early_terminal_kh(key_st key) {
+    u32 flags = spin_lock_irqsave(&input_lock);
+    if (!__atomic_load_n(&returned, __ATOMIC_ACQUIRE)) _edit_line(key);
+    spin_unlock_irqrestore(&input_lock, flags);
+}
+
 void clear_buffer() {
-    for (size_t i = 0; i < len; i++) {
-        pos[i].x = pos[i].y = 0;
-        buff[i] = '\0';
-    }
+    for (size_t i = 0; i < len; i++) buff[i] = '\0';
     len = 0;
 }
 
@@ -53,11 +77,11 @@ void early_terminal() {
     while (true) {
         kprintf("root> ");
 
-        while (!returned);
+        while (!returned) cpu_idle(&returned);
         kputchar('\n');
         parse_command();
         clear_buffer();
-        returned = false;
+        __atomic_store_n(&returned, false, __ATOMIC_RELEASE);
     }
 }
 
@@ -229,6 +253,57 @@ PARSE_CMD(x) {
     kputchar('\n');
 }
 
+PARSE_CMD(dmesg) {
+    if (num_args == 1) {
+        klog_dump();
+        return;
+    }
+
+    if (num_args == 3 && strcmp(args[1], "-n") == 0) {
+        klog_set_console_level(atoi(args[2]));
+        return;
+    }
+
+    kprintf("dmesg [-n level]\n");
+}
+
+PARSE_CMD(affinity) {
+    if (num_args != 3 || strcmp(args[1], "--help") == 0 ||
+        strcmp(args[1], "-h") == 0) {
+        kprintf("affinity irq cpu\n");
+        return;
+    }
+
+    u32 irq = atoi(args[1]);
+    u32 cpu = atoi(args[2]);
+    if (irq >= MAX_IRQS || !irq_set_affinity(irq, cpu)) {
+        kprintf("Can't route IRQ %u to CPU %u!\n", irq, cpu);
+        return;
+    }
+
+    kprintf("IRQ %u -> CPU %u\n", irq, cpu);
+}
+
+PARSE_CMD(bench) {
+    if (num_args != 2 || strcmp(args[1], "--help") == 0 ||
+        strcmp(args[1], "-h") == 0) {
+        kprintf("bench [slab|mem|conv|pio]\n");
+        return;
+    }
+
+    if (strcmp(args[1], "slab") == 0) {
+        bench_slab();
+    } else if (strcmp(args[1], "mem") == 0) {
+        bench_mem();
+    } else if (strcmp(args[1], "conv") == 0) {
+        bench_conv();
+    } else if (strcmp(args[1], "pio") == 0) {
+        bench_pio();
+    } else {
+        kprintf("Unknown benchmark!\n");
+    }
+}
+
 void parse_command() {
     if (len == 0) return;
 
@@ -253,7 +328,7 @@ void parse_command() {
 
     // Find correct parsing for function
     if (strcmp(args[0], "clear") == 0) {
-        tty_clear_screen();
+        console_clear();
     } else if (strcmp(args[0], "in") == 0) {
         parse_in_cmd(i, args);
     } else if (strcmp(args[0], "out") == 0) {
@@ -263,22 +338,47 @@ void parse_command() {
     } else if (strcmp(args[0], "regs") == 0) {
         // no args
     } else if (strcmp(args[0], "cpuid") == 0) {
-        // "cpuid flag"
+        cpu_print_features();
+        cpu_print_topology();
+        smp_print_info();
     } else if (strcmp(args[0], "memmap") == 0) {
-        // no args
+        print_mmap();
+        pmm_print_stats();
+        vm_print_regions();
+        zero_pool_print_stats();
+        dma_print_stats();
     } else if (strcmp(args[0], "fb_info") == 0) {
-        // no args
+        print_fb();
+    } else if (strcmp(args[0], "slabinfo") == 0) {
+        slab_print_stats();
+    } else if (strcmp(args[0], "bench") == 0) {
+        parse_bench_cmd(i, args);
+    } else if (strcmp(args[0], "dmesg") == 0) {
+        parse_dmesg_cmd(i, args);
+    } else if (strcmp(args[0], "serial") == 0) {
+        serial_print_stats();
+    } else if (strcmp(args[0], "irqstat") == 0) {
+        irq_print_stats();
+    } else if (strcmp(args[0], "affinity") == 0) {
+        parse_affinity_cmd(i, args);
+    } else if (strcmp(args[0], "acpi") == 0) {
+        acpi_print_info();
+    } else if (strcmp(args[0], "clock") == 0) {
+        clocksource_print_info();
+    } else if (strcmp(args[0], "shutdown") == 0) {
+        if (!acpi_shutdown()) kprintf("ACPI soft off failed!\n");
     } else if (strcmp(args[0], "help") == 0) {
         kprintf(
-            "Commands:\nclear, in, out, x, regs, cpuid, memmap, fb_"
-            "info, help\n");
+            "Commands:\nclear, in, out, x, regs, cpuid, memmap, fb_info, "
+            "slabinfo, bench, dmesg, serial, irqstat, affinity, acpi, "
+            "clock, shutdown, help\n");
     } else {
         kprintf("Unknown command!\n");
     }
 }
 
 void kmain() {
-    tty_clear_screen();
+    console_clear();
 
     kprintf("  _____                               _      ____   _____ \n");
     kprintf(" |  __ \\                             | |    / __ \\ / ____|\n");
@@ -288,6 +388,7 @@ void kmain() {
     kprintf(" | | \\ \\  __/\\__ \\  __/ (_| | | | (__| | | | |__| |____) |\n");
     kprintf(
         " |_|  \\_\\___||___/\\___|\\__,_|_|  \\___|_| |_|\\____/|_____/ \n\n");
+    klog_flush();
 
     early_terminal();
 }
@@ -2,26 +2,28 @@
 #include <lib/string.h>
 #include <stdbool.h>
 
-char itoh(int n) {
-    if (n >= 0 && n <= 9) return INT_TO_C(n);
-
-    switch (n) {
-        case 0xA:
-            return 'A';
-        case 0xB:
-            return 'B';
-        case 0xC:
-            return 'C';
-        case 0xD:
-            return 'D';
-        case 0xE:
-            return 'E';
-        case 0xF:
-            return 'F';
-        default:
-            return (char)n;
-    }
-}
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// "00" "01" ... "99", decimal conversions write two digits per step
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const u32 pow10[] = {1,      10,      100,      1000,      10000,
+                            100000, 1000000, 10000000, 100000000, 1000000000};
+
+#define DEC_CHUNK 100000000 /* 8 digits, u64 values are split into these */
+#define DEC_CHUNK_DIGITS 8
+
+char itoh(int n) { return (n >= 0 && n <= 0xF) ? hex_digits[n] : (char)n; }
 
 int htoi(char c) {
     if (c >= '0' && c <= '9') return C_TO_INT(c);
@@ -63,92 +65,145 @@ char* to_hex_u16(u16 value, char* str) { return to_string(value, str, 16, 4); }
 
 char* to_hex_u32(u32 value, char* str) { return to_string(value, str, 16, 8); }
 
-char* to_hex_u64(u64 value, char* str) { return to_string(value, str, 16, 16); }
+char* to_hex_u64(u64 value, char* str) {
+    str[16] = '\0';
+    for (int i = 15; i >= 0; i--) {
+        str[i] = hex_digits[value & 0xF];
+        value >>= 4;
+    }
+
+    return str;
+}
 
 char* to_hex(size_t value, char* str) {
     return to_string(value, str, 16, sizeof(size_t) * 2);
 }
 
-char* itoa(int value, char* str, int base) {
-    if (base <= 1 || base > 16) return str;
-    if (value == 0) {
-        str[0] = '0';
-        str[1] = '\0';
-        return str;
-    }
+// log2(base) for power of 2 bases (digits come from shifts), else 0
+static int _base_shift(int base) {
+    return ((base & (base - 1)) == 0) ? __builtin_ctz(base) : 0;
+}
 
-    size_t i = 0;
-    if (value < 0) {
-        if (base == 10) str[i++] = '-';
-        value *= -1;
+static int _dec_len(u32 value) {
+    int len = 1;
+    while (len < 10 && value >= pow10[len]) len++;
+    return len;
+}
+
+/*
+    Writes the last len decimal digits of value right to left, ending
+    just before end
+    - value / 100 as a multiply & shift, exact for every u32
+*/
+static void _write_dec(u32 value, char* end, int len) {
+    for (; len >= 2; len -= 2) {
+        u32 quot = (u32)(((u64)value * 0x51EB851F) >> 37);
+        u32 pair = (value - quot * 100) * 2;
+        value = quot;
+
+        end -= 2;
+        end[0] = digit_pairs[pair];
+        end[1] = digit_pairs[pair + 1];
     }
+    if (len == 1) end[-1] = INT_TO_C(value % 10);
+}
 
-    size_t oldPos = i;
-    while (value > 0) {
-        str[i++] = itoh(value % base);
-        value /= base;
+// Base 10: 32-bit values directly, bigger ones in 8 digit chunks
+static char* _u64_to_dec(u64 value, char* str) {
+    u32 chunks[2];
+    int num_chunks = 0;
+    while (value >> 32 != 0) {
+        value = div_u64_rem(value, DEC_CHUNK, &chunks[num_chunks]);
+        num_chunks++;
     }
-    str[i] = '\0';
 
-    for (size_t j = oldPos; j <= (i - 1 - oldPos) / 2; j++) {
-        char cpy = str[j];
-        str[j] = str[i - 1 - j + oldPos];
-        str[i - 1 - j + oldPos] = cpy;
+    int len = _dec_len((u32)value);
+    char* end = str + len;
+    _write_dec((u32)value, end, len);
+    while (num_chunks > 0) {
+        end += DEC_CHUNK_DIGITS;
+        _write_dec(chunks[--num_chunks], end, DEC_CHUNK_DIGITS);
     }
 
+    *end = '\0';
     return str;
 }
 
-char* utoa(unsigned int value, char* str, int base) {
-    if (base <= 1 || base > 16) return str;
-    if (value == 0) {
-        str[0] = '0';
-        str[1] = '\0';
-        return str;
-    }
+// Power of 2 bases: the digit count is known from the top set bit
+static char* _u64_to_pow2(u64 value, char* str, int shift) {
+    int bits = (value == 0) ? 1 : 64 - __builtin_clzll(value);
+    int len = (bits + shift - 1) / shift;
+    u32 mask = (1 << shift) - 1;
 
-    size_t i = 0;
-    while (value > 0) {
-        str[i++] = itoh(value % base);
-        value /= base;
+    str[len] = '\0';
+    while (len > 0) {
+        str[--len] = hex_digits[value & mask];
+        value >>= shift;
     }
-    str[i] = '\0';
 
-    for (size_t j = 0; j <= (i - 1) / 2; j++) {
-        char cpy = str[j];
-        str[j] = str[i - 1 - j];
-        str[i - 1 - j] = cpy;
+    return str;
+}
+
+static char* _u64_to_base(u64 value, char* str, int base) {
+    int len = 0;
+    u32 rem;
+    for (u64 val = value; val != 0 || len == 0;
+         val = div_u64_rem(val, base, &rem))
+        len++;
+
+    str[len] = '\0';
+    while (len > 0) {
+        value = div_u64_rem(value, base, &rem);
+        str[--len] = hex_digits[rem];
     }
 
     return str;
 }
 
-char* to_string(size_t value, char* str, int base, int width) {
-    if (base <= 1 || width <= 0 || base > 16) return str;
-    if (value == 0) {
-        for (int i = 0; i < width; i++) str[i] = '0';
-        str[width] = '\0';
-        return str;
-    }
+/*
+    Digits of value in base (2 to 16, upper case), no reversal pass:
+    the length is worked out first & digits go in right to left
+*/
+char* u64toa(u64 value, char* str, int base) {
+    if (base <= 1 || base > 16) return str;
+    if (base == 10) return _u64_to_dec(value, str);
 
-    int i = 0;
-    while (value > 0 && width > 0) {
-        str[i++] = itoh(value % base);
-        value /= base;
-        width--;
-    }
+    int shift = _base_shift(base);
+    return (shift != 0) ? _u64_to_pow2(value, str, shift)
+                        : _u64_to_base(value, str, base);
+}
 
-    while (width > 0) {
-        str[i++] = '0';
-        width--;
-    }
+// Only base 10 gets a sign, other bases print the magnitude
+char* i64toa(i64 value, char* str, int base) {
+    if (base <= 1 || base > 16) return str;
+    if (value >= 0) return u64toa(value, str, base);
 
-    str[i] = '\0';
+    char* digits = str;
+    if (base == 10) *digits++ = '-';
+    u64toa(-(u64)value, digits, base);
+    return str;
+}
+
+char* itoa(int value, char* str, int base) { return i64toa(value, str, base); }
+
+char* utoa(unsigned int value, char* str, int base) {
+    return u64toa(value, str, base);
+}
 
-    for (int j = 0; j <= (i - 1) / 2; j++) {
-        char cpy = str[j];
-        str[j] = str[i - 1 - j];
-        str[i - 1 - j] = cpy;
+// Exactly width digits: zero padded, higher digits dropped
+char* to_string(size_t value, char* str, int base, int width) {
+    if (base <= 1 || width <= 0 || base > 16) return str;
+
+    int shift = _base_shift(base);
+    str[width] = '\0';
+    for (int i = width - 1; i >= 0; i--) {
+        if (shift != 0) {
+            str[i] = hex_digits[value & (base - 1)];
+            value >>= shift;
+        } else {
+            str[i] = hex_digits[value % base];
+            value /= base;
+        }
     }
 
     return str;
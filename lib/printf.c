@@ -0,0 +1,295 @@
+#include <lib/conversion.h>
+#include <lib/printf.h>
+#include <lib/string.h>
+#include <stdbool.h>
+
+#define FMT_LEFT (1 << 0)
+#define FMT_ZERO (1 << 1)
+#define FMT_PLUS (1 << 2)
+#define FMT_SPACE (1 << 3)
+#define FMT_ALT (1 << 4)
+#define FMT_UPPER (1 << 5)
+
+#define FMT_NUM_MAX 24 /* digits of a u64 in base 8 + sign & prefix */
+
+enum fmt_len {
+    FMT_LEN_HH,
+    FMT_LEN_H,
+    FMT_LEN_INT,
+    FMT_LEN_L,
+    FMT_LEN_LL,
+    FMT_LEN_Z,
+};
+
+struct fmt_spec {
+    u32 flags;
+    int width;
+    int precision; /* -1 if not given */
+};
+
+static void _flush(struct fmt_out* out) {
+    out->buf[out->len] = '\0';
+    if (out->flush != NULL && out->len > 0) out->flush(out);
+    out->len = 0;
+}
+
+static void _put(struct fmt_out* out, char c) {
+    out->total++;
+    if (out->len + 1 >= out->size) {
+        if (out->flush == NULL) return;
+        _flush(out);
+    }
+
+    out->buf[out->len++] = c;
+}
+
+static void _put_str(struct fmt_out* out, const char* str, size_t len) {
+    for (size_t i = 0; i < len; i++) _put(out, str[i]);
+}
+
+static void _pad(struct fmt_out* out, char c, int count) {
+    for (; count > 0; count--) _put(out, c);
+}
+
+static void _format_num(struct fmt_out* out, u64 value, bool neg, u32 base,
+                        struct fmt_spec* spec) {
+    const char* digits =
+        (spec->flags & FMT_UPPER) ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    // Digits in reverse, plain 32-bit division once the value fits
+    char num[FMT_NUM_MAX];
+    int len = 0;
+    while (value >> 32 != 0) {
+        u32 rem;
+        value = div_u64_rem(value, base, &rem);
+        num[len++] = digits[rem];
+    }
+    for (u32 val = (u32)value; val != 0; val /= base)
+        num[len++] = digits[val % base];
+
+    // Precision is the minimum digit count, an explicit 0 prints 0 as ""
+    int precision = (spec->precision < 0) ? 1 : spec->precision;
+    int zeros = (precision > len) ? precision - len : 0;
+
+    char prefix[2];
+    int prefix_len = 0;
+    if (neg) {
+        prefix[prefix_len++] = '-';
+    } else if (spec->flags & FMT_PLUS) {
+        prefix[prefix_len++] = '+';
+    } else if (spec->flags & FMT_SPACE) {
+        prefix[prefix_len++] = ' ';
+    } else if ((spec->flags & FMT_ALT) && base == 16 && len > 0) {
+        prefix[prefix_len++] = '0';
+        prefix[prefix_len++] = (spec->flags & FMT_UPPER) ? 'X' : 'x';
+    }
+
+    // '0' pads between the prefix & the digits, a precision turns it off
+    int pad = spec->width - (prefix_len + zeros + len);
+    bool zero_pad = (spec->flags & (FMT_ZERO | FMT_LEFT)) == FMT_ZERO &&
+                    spec->precision < 0;
+
+    if (!(spec->flags & FMT_LEFT) && !zero_pad) _pad(out, ' ', pad);
+    _put_str(out, prefix, prefix_len);
+    if (zero_pad) _pad(out, '0', pad);
+    _pad(out, '0', zeros);
+    while (len > 0) _put(out, num[--len]);
+    if (spec->flags & FMT_LEFT) _pad(out, ' ', pad);
+}
+
+static void _format_str(struct fmt_out* out, const char* str,
+                        struct fmt_spec* spec) {
+    if (str == NULL) str = "(null)";
+
+    // Precision caps the length, str may not be terminated past it
+    int len = 0;
+    while (str[len] != '\0' && (spec->precision < 0 || len < spec->precision))
+        len++;
+
+    int pad = spec->width - len;
+    if (!(spec->flags & FMT_LEFT)) _pad(out, ' ', pad);
+    _put_str(out, str, len);
+    if (spec->flags & FMT_LEFT) _pad(out, ' ', pad);
+}
+
+static i64 _arg_signed(va_list* args, enum fmt_len len) {
+    switch (len) {
+        case FMT_LEN_HH:
+            return (i8)va_arg(*args, int);
+        case FMT_LEN_H:
+            return (i16)va_arg(*args, int);
+        case FMT_LEN_L:
+            return va_arg(*args, long);
+        case FMT_LEN_LL:
+            return va_arg(*args, long long);
+        case FMT_LEN_Z:
+            return (long)va_arg(*args, size_t);
+        default:
+            return va_arg(*args, int);
+    }
+}
+
+static u64 _arg_unsigned(va_list* args, enum fmt_len len) {
+    switch (len) {
+        case FMT_LEN_HH:
+            return (u8)va_arg(*args, unsigned int);
+        case FMT_LEN_H:
+            return (u16)va_arg(*args, unsigned int);
+        case FMT_LEN_L:
+            return va_arg(*args, unsigned long);
+        case FMT_LEN_LL:
+            return va_arg(*args, unsigned long long);
+        case FMT_LEN_Z:
+            return va_arg(*args, size_t);
+        default:
+            return va_arg(*args, unsigned int);
+    }
+}
+
+static int _parse_int(const char** ptr) {
+    int val = 0;
+    while (isnum(**ptr)) val = val * 10 + (*(*ptr)++ - '0');
+    return val;
+}
+
+// Formats into out, returns the number of chars produced
+int vformat(struct fmt_out* out, const char* format, va_list args) {
+    va_list ap;
+    va_copy(ap, args);
+
+    for (const char* ptr = format; *ptr != '\0'; ptr++) {
+        if (*ptr != '%') {
+            _put(out, *ptr);
+            continue;
+        }
+
+        const char* start = ptr++;
+        struct fmt_spec spec = {0, 0, -1};
+
+        for (;; ptr++) {
+            if (*ptr == '-') {
+                spec.flags |= FMT_LEFT;
+            } else if (*ptr == '0') {
+                spec.flags |= FMT_ZERO;
+            } else if (*ptr == '+') {
+                spec.flags |= FMT_PLUS;
+            } else if (*ptr == ' ') {
+                spec.flags |= FMT_SPACE;
+            } else if (*ptr == '#') {
+                spec.flags |= FMT_ALT;
+            } else {
+                break;
+            }
+        }
+
+        if (*ptr == '*') {
+            spec.width = va_arg(ap, int);
+            if (spec.width < 0) {
+                spec.flags |= FMT_LEFT;
+                spec.width = -spec.width;
+            }
+            ptr++;
+        } else {
+            spec.width = _parse_int(&ptr);
+        }
+
+        if (*ptr == '.') {
+            ptr++;
+            if (*ptr == '*') {
+                spec.precision = va_arg(ap, int);
+                if (spec.precision < 0) spec.precision = -1;
+                ptr++;
+            } else {
+                spec.precision = _parse_int(&ptr);
+            }
+        }
+
+        enum fmt_len len = FMT_LEN_INT;
+        if (*ptr == 'h') {
+            len = (*++ptr == 'h') ? FMT_LEN_HH : FMT_LEN_H;
+            if (len == FMT_LEN_HH) ptr++;
+        } else if (*ptr == 'l') {
+            len = (*++ptr == 'l') ? FMT_LEN_LL : FMT_LEN_L;
+            if (len == FMT_LEN_LL) ptr++;
+        } else if (*ptr == 'z') {
+            len = FMT_LEN_Z;
+            ptr++;
+        }
+
+        // Upper case d, i, u, c, s & p are kept for older callers
+        switch (*ptr) {
+            case 'D':
+            case 'd':
+            case 'I':
+            case 'i': {
+                i64 val = _arg_signed(&ap, len);
+                _format_num(out, (val < 0) ? -(u64)val : (u64)val, val < 0,
+                            10, &spec);
+                break;
+            }
+            case 'U':
+            case 'u':
+                _format_num(out, _arg_unsigned(&ap, len), false, 10, &spec);
+                break;
+            case 'X':
+                spec.flags |= FMT_UPPER;
+                // fall through
+            case 'x':
+                _format_num(out, _arg_unsigned(&ap, len), false, 16, &spec);
+                break;
+            case 'C':
+            case 'c': {
+                char str[] = {(char)va_arg(ap, int), '\0'};
+                spec.precision = 1;
+                _format_str(out, str, &spec);
+                break;
+            }
+            case 'S':
+            case 's':
+                _format_str(out, va_arg(ap, const char*), &spec);
+                break;
+            case 'P':
+            case 'p':
+                spec.flags |= FMT_UPPER | FMT_ZERO;
+                if (spec.width == 0) spec.width = sizeof(void*) * 2;
+                _format_num(out, (size_t)va_arg(ap, void*), false, 16, &spec);
+                break;
+            case '%':
+                _put(out, '%');
+                break;
+            case '\0':
+                // Lone % at the end, print what was there
+                _put_str(out, start, ptr - start);
+                ptr--;
+                break;
+            default:
+                _put_str(out, start, ptr - start + 1);
+                break;
+        }
+    }
+
+    va_end(ap);
+    _flush(out);
+    return (int)out->total;
+}
+
+// Like the C library's, returns the length the full output would have
+int vsnprintf(char* buf, size_t size, const char* format, va_list args) {
+    char empty[1];
+    struct fmt_out out = {buf, size, 0, 0, NULL, NULL};
+    if (size == 0) {
+        out.buf = empty;
+        out.size = 1;
+    }
+
+    return vformat(&out, format, args);
+}
+
+int snprintf(char* buf, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, size, format, args);
+    va_end(args);
+
+    return len;
+}
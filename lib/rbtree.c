@@ -0,0 +1,232 @@
+#include <lib/rbtree.h>
+
+// Points whatever referenced old (parent link or root) to new
+static inline void _set_child(struct rb_root* root, struct rb_node* parent,
+                              struct rb_node* old, struct rb_node* new) {
+    if (parent == NULL) {
+        root->node = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static void _rotate_left(struct rb_root* root, struct rb_node* x) {
+    struct rb_node* y = x->right;
+
+    x->right = y->left;
+    if (y->left != NULL) y->left->parent = x;
+
+    y->parent = x->parent;
+    _set_child(root, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static void _rotate_right(struct rb_root* root, struct rb_node* x) {
+    struct rb_node* y = x->left;
+
+    x->left = y->right;
+    if (y->right != NULL) y->right->parent = x;
+
+    y->parent = x->parent;
+    _set_child(root, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+static inline bool _is_red(const struct rb_node* node) {
+    return node != NULL && node->red;
+}
+
+void rb_insert_fixup(struct rb_root* root, struct rb_node* node) {
+    struct rb_node* parent;
+
+    while ((parent = node->parent) != NULL && parent->red) {
+        // A red parent is never the root, so the grandparent exists
+        struct rb_node* gparent = parent->parent;
+
+        if (parent == gparent->left) {
+            struct rb_node* uncle = gparent->right;
+            if (_is_red(uncle)) {
+                parent->red = uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                _rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->red = false;
+            gparent->red = true;
+            _rotate_right(root, gparent);
+        } else {
+            struct rb_node* uncle = gparent->left;
+            if (_is_red(uncle)) {
+                parent->red = uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                _rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->red = false;
+            gparent->red = true;
+            _rotate_left(root, gparent);
+        }
+    }
+
+    root->node->red = false;
+}
+
+/*
+    node (possibly NULL) sits under parent & is one black short
+    NOTE: a black node was removed, so the sibling always exists
+*/
+static void _erase_fixup(struct rb_root* root, struct rb_node* node,
+                         struct rb_node* parent) {
+    while (node != root->node && !_is_red(node)) {
+        if (node == parent->left) {
+            struct rb_node* sibling = parent->right;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                _rotate_left(root, parent);
+                sibling = parent->right;
+            }
+
+            if (!_is_red(sibling->left) && !_is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!_is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                _rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            _rotate_left(root, parent);
+            node = root->node;
+        } else {
+            struct rb_node* sibling = parent->left;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                _rotate_right(root, parent);
+                sibling = parent->left;
+            }
+
+            if (!_is_red(sibling->left) && !_is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!_is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                _rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            _rotate_right(root, parent);
+            node = root->node;
+        }
+    }
+
+    if (node != NULL) node->red = false;
+}
+
+void rb_erase(struct rb_root* root, struct rb_node* node) {
+    struct rb_node* child;
+    struct rb_node* parent;
+    bool removed_red;
+
+    if (node->left == NULL || node->right == NULL) {
+        child = (node->left != NULL) ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+
+        if (child != NULL) child->parent = parent;
+        _set_child(root, parent, node, child);
+    } else {
+        // The in-order successor takes node's place (and colour)
+        struct rb_node* next = node->right;
+        while (next->left != NULL) next = next->left;
+
+        removed_red = next->red;
+        child = next->right;
+
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            parent->left = child;
+            if (child != NULL) child->parent = parent;
+
+            next->right = node->right;
+            node->right->parent = next;
+        }
+
+        next->left = node->left;
+        node->left->parent = next;
+        next->parent = node->parent;
+        next->red = node->red;
+        _set_child(root, node->parent, node, next);
+    }
+
+    if (!removed_red) _erase_fixup(root, child, parent);
+}
+
+struct rb_node* rb_first(const struct rb_root* root) {
+    struct rb_node* node = root->node;
+    if (node == NULL) return NULL;
+
+    while (node->left != NULL) node = node->left;
+    return node;
+}
+
+struct rb_node* rb_next(const struct rb_node* node) {
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) node = node->left;
+        return (struct rb_node*)node;
+    }
+
+    while (node->parent != NULL && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
+
+struct rb_node* rb_prev(const struct rb_node* node) {
+    if (node->left != NULL) {
+        node = node->left;
+        while (node->right != NULL) node = node->right;
+        return (struct rb_node*)node;
+    }
+
+    while (node->parent != NULL && node == node->parent->left)
+        node = node->parent;
+    return node->parent;
+}
@@ -14,12 +14,6 @@ bool isspace(int c) {
 
 bool isnum(int c) { return (c >= '0' && c <= '9'); }
 
-size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len] != '\0') len++;
-    return len;
-}
-
 char* strcpy(char* dest, const char* src) {
     size_t i = 0;
     while (src[i] != '\0') {
@@ -82,12 +76,156 @@ int strncmp(const char* str1, const char* str2, size_t num) {
     return 0;
 }
 
-void* memcpy(void* dest, const void* src, size_t count) {
-    u8* destArr = (u8*)dest;
-    const u8* srcArr = (const u8*)src;
+/*
+    Portable implementations, a 32-bit word at a time where alignment
+    allows it
+    - Word reads of strings stay aligned so they never cross into the
+      next (possibly unmapped) page
+*/
+typedef u32 __attribute__((may_alias)) word_t;
+
+#define WORD_MASK (sizeof(word_t) - 1)
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+static void* _word_memcpy(void* dest, const void* src, size_t count) {
+    u8* d = (u8*)dest;
+    const u8* s = (const u8*)src;
+
+    if ((((size_t)d ^ (size_t)s) & WORD_MASK) == 0) {
+        while (count > 0 && ((size_t)d & WORD_MASK) != 0) {
+            *d++ = *s++;
+            count--;
+        }
+        for (; count >= sizeof(word_t); count -= sizeof(word_t)) {
+            *(word_t*)d = *(const word_t*)s;
+            d += sizeof(word_t);
+            s += sizeof(word_t);
+        }
+    }
+    while (count-- > 0) *d++ = *s++;
 
-    size_t i = 0;
-    for (; i < count; i++) destArr[i] = srcArr[i];
+    return dest;
+}
+
+static void* _word_memmove(void* dest, const void* src, size_t count) {
+    u8* d = (u8*)dest;
+    const u8* s = (const u8*)src;
+
+    // Forward copies only ever overwrite bytes already read
+    if (d <= s || d >= s + count) return _word_memcpy(dest, src, count);
+
+    d += count;
+    s += count;
+    if ((((size_t)d ^ (size_t)s) & WORD_MASK) == 0) {
+        while (count > 0 && ((size_t)d & WORD_MASK) != 0) {
+            *--d = *--s;
+            count--;
+        }
+        for (; count >= sizeof(word_t); count -= sizeof(word_t)) {
+            d -= sizeof(word_t);
+            s -= sizeof(word_t);
+            *(word_t*)d = *(const word_t*)s;
+        }
+    }
+    while (count-- > 0) *--d = *--s;
 
     return dest;
 }
+
+static void* _word_memset(void* dest, int c, size_t count) {
+    u8* d = (u8*)dest;
+    word_t pattern = (u8)c * ONES;
+
+    while (count > 0 && ((size_t)d & WORD_MASK) != 0) {
+        *d++ = (u8)c;
+        count--;
+    }
+    for (; count >= sizeof(word_t); count -= sizeof(word_t)) {
+        *(word_t*)d = pattern;
+        d += sizeof(word_t);
+    }
+    while (count-- > 0) *d++ = (u8)c;
+
+    return dest;
+}
+
+static int _word_memcmp(const void* ptr1, const void* ptr2, size_t count) {
+    const u8* a = (const u8*)ptr1;
+    const u8* b = (const u8*)ptr2;
+
+    // Skip equal words, the bytes decide the order
+    for (; count >= sizeof(word_t); count -= sizeof(word_t)) {
+        if (*(const word_t*)a != *(const word_t*)b) break;
+        a += sizeof(word_t);
+        b += sizeof(word_t);
+    }
+    for (; count > 0; count--, a++, b++) {
+        if (*a != *b) return (*a < *b) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static size_t _word_strlen(const char* str) {
+    const char* ptr = str;
+    for (; ((size_t)ptr & WORD_MASK) != 0; ptr++) {
+        if (*ptr == '\0') return ptr - str;
+    }
+
+    const word_t* word = (const word_t*)ptr;
+    while (!HAS_ZERO(*word)) word++;
+
+    ptr = (const char*)word;
+    while (*ptr != '\0') ptr++;
+    return ptr - str;
+}
+
+static char* _word_strchr(const char* str, int c) {
+    char ch = (char)c;
+    for (; ((size_t)str & WORD_MASK) != 0; str++) {
+        if (*str == ch) return (char*)str;
+        if (*str == '\0') return NULL;
+    }
+
+    word_t pattern = (u8)ch * ONES;
+    const word_t* word = (const word_t*)str;
+    while (!HAS_ZERO(*word) && !HAS_ZERO(*word ^ pattern)) word++;
+
+    for (str = (const char*)word; *str != ch; str++) {
+        if (*str == '\0') return NULL;
+    }
+    return (char*)str;
+}
+
+const struct string_ops string_word_ops = {
+    "word",       _word_memcpy, _word_memmove, _word_memset,
+    _word_memcmp, _word_strlen, _word_strchr,
+};
+
+static const struct string_ops* string_ops = &string_word_ops;
+
+void string_set_ops(const struct string_ops* ops) { string_ops = ops; }
+
+const struct string_ops* string_get_ops() { return string_ops; }
+
+size_t strlen(const char* str) { return string_ops->strlen(str); }
+
+char* strchr(const char* str, int c) { return string_ops->strchr(str, c); }
+
+void* memcpy(void* dest, const void* src, size_t count) {
+    return string_ops->memcpy(dest, src, count);
+}
+
+void* memmove(void* dest, const void* src, size_t count) {
+    return string_ops->memmove(dest, src, count);
+}
+
+void* memset(void* dest, int c, size_t count) {
+    return string_ops->memset(dest, c, count);
+}
+
+int memcmp(const void* ptr1, const void* ptr2, size_t count) {
+    return string_ops->memcmp(ptr1, ptr2, count);
+}
@@ -0,0 +1,136 @@
+#include <early_kprintf.h>
+#include <mm/arena.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <multiboot2_tbl.h>
+
+static struct arena boot_arena = {0};
+static bool boot_active = false;
+
+void arena_init(struct arena* arena, void* start, size_t size) {
+    arena->start = arena->cur = (size_t)start;
+    arena->end = arena->start + size;
+}
+
+/*
+    Carve size bytes aligned to align (power of 2)
+    Returns NULL if the arena is exhausted
+*/
+void* arena_alloc(struct arena* arena, size_t size, size_t align) {
+    if (align == 0) align = 1;
+
+    size_t addr = (arena->cur + align - 1) & ~(align - 1);
+    if (addr < arena->cur || size > arena->end - addr) return NULL;
+
+    arena->cur = addr + size;
+    return (void*)addr;
+}
+
+arena_mark_t arena_mark(struct arena* arena) { return arena->cur; }
+
+void arena_reset(struct arena* arena, arena_mark_t mark) {
+    if (mark >= arena->start && mark <= arena->cur) arena->cur = mark;
+}
+
+size_t arena_remaining(struct arena* arena) { return arena->end - arena->cur; }
+
+/*
+    =====================
+        Boot arena
+    =====================
+*/
+
+/*
+    Places the boot arena in the first available RAM past the kernel,
+    the multiboot info and modules, up to the end of that region
+*/
+bool boot_arena_init() {
+    size_t mb2_start, mb2_end;
+    get_mb2_tbl_range(&mb2_start, &mb2_end);
+
+    u64 above = KRNL_END;
+    if (mb2_end > above) above = mb2_end;
+    if (get_modules_end() > above) above = get_modules_end();
+    above = PAGE_ALIGN_UP(above);
+
+    mmap_tbl_st map;
+    get_mmap(&map);
+
+    for (size_t i = 0; i < map.num_entries; i++) {
+        mmap_entry_st* entry = &map.tbl[i];
+        if (entry->type != MEM_AVAIL_TYPE) continue;
+
+        u64 start = PAGE_ALIGN_UP(entry->addr);
+        u64 end = PAGE_ALIGN_DOWN(entry->addr + entry->len);
+        if (end > DIRECT_MAP_LIMIT) end = DIRECT_MAP_LIMIT;
+        if (start < above) start = above;
+        if (start >= end) continue;
+
+        arena_init(&boot_arena, PHYS_TO_VIRT(start), (size_t)(end - start));
+        boot_active = true;
+        return true;
+    }
+
+    kerror("Boot arena: no available memory past the kernel!\n");
+    return false;
+}
+
+// Caps the arena at slack bytes past what is already allocated
+void boot_arena_trim(size_t slack) {
+    size_t end = PAGE_ALIGN_UP(boot_arena.cur + slack);
+    if (end < boot_arena.end) boot_arena.end = end;
+}
+
+// Returns the unused tail to the frame allocator, later boot_alloc()s
+// are served by kmalloc
+void boot_arena_release() {
+    if (!boot_active) return;
+
+    phys_addr_t start = PAGE_ALIGN_UP(VIRT_TO_PHYS(boot_arena.cur));
+    phys_addr_t end = VIRT_TO_PHYS(boot_arena.end);
+    boot_active = false;
+
+    size_t released = 0;
+    if (start < end) {
+        pmm_free_range(start, end);
+        released = end - start;
+    }
+
+    kprintf("Boot arena: used %u KB, released %u KB\n",
+            (boot_arena.cur - boot_arena.start) / 1024, released / 1024);
+}
+
+bool boot_arena_active() { return boot_active; }
+
+void get_boot_arena_range(phys_addr_t* start, phys_addr_t* end) {
+    *start = VIRT_TO_PHYS(boot_arena.start);
+    *end = VIRT_TO_PHYS(boot_arena.end);
+}
+
+/*
+    Past the arena, align is met by asking kmalloc for at least align
+    bytes (a size class that aligned), or whole frames beyond what the
+    classes guarantee
+*/
+static void* _late_alloc(size_t size, size_t align) {
+    if (size < align) size = align;
+    if (align <= KMALLOC_MAX_ALIGN) return kmalloc(size);
+
+    size_t pages = PAGE_ALIGN_UP(size) >> PAGE_SHIFT;
+    u8 order = (pages > 1) ? 32 - __builtin_clz(pages - 1) : 0;
+    phys_addr_t frames = pmm_alloc_frames(order);
+    return (frames == 0) ? NULL : PHYS_TO_VIRT(frames);
+}
+
+/*
+    Permanent boot time allocation, aligned to align (power of 2)
+    NOTE: memory from the boot arena can never be freed
+*/
+void* boot_alloc(size_t size, size_t align) {
+    if (!boot_active) return _late_alloc(size, align);
+
+    void* ptr = arena_alloc(&boot_arena, size, align);
+    if (ptr == NULL) kerror("Boot arena: out of memory (%u B)!\n", size);
+
+    return ptr;
+}
@@ -0,0 +1,162 @@
+#include <arch/i386/paging.h>
+#include <early_kprintf.h>
+#include <lib/string.h>
+#include <mm/dma.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <mm/zero_pool.h>
+#include <spinlock.h>
+
+const struct dma_dev dma_isa_dev = {ZONE_DMA_LIMIT, 0x10000};
+const struct dma_dev dma_32bit_dev = {0x100000000ULL, 0};
+
+static struct dma_bounce* bounces = NULL;
+static spinlock_t dma_lock = SPINLOCK_INIT;
+
+static u32 direct_maps = 0;
+static u32 bounce_maps = 0;
+static u32 failed_maps = 0;
+
+static u8 _order(size_t size) {
+    size_t pages = PAGE_ALIGN_UP(size) >> PAGE_SHIFT;
+    u8 order = 0;
+    while ((1u << order) < pages) order++;
+
+    return order;
+}
+
+// Can dev do [phys, phys + size) in one transfer
+static bool _reachable(const struct dma_dev* dev, phys_addr_t phys,
+                       size_t size) {
+    if (phys + size > dev->limit) return false;
+    if (dev->boundary == 0) return true;
+
+    u64 mask = ~(u64)(dev->boundary - 1);
+    return (phys & mask) == ((phys + size - 1) & mask);
+}
+
+/*
+    Physical address of buf if [buf, buf + size) is physically contiguous
+    Returns 0 if it isn't (or isn't mapped)
+*/
+static phys_addr_t _contiguous_phys(void* buf, size_t size) {
+    size_t addr = (size_t)buf;
+    phys_addr_t phys = virt_to_phys(addr);
+    if (phys == 0) return 0;
+
+    for (size_t page = PAGE_ALIGN_DOWN(addr) + PAGE_SIZE; page < addr + size;
+         page += PAGE_SIZE) {
+        if (virt_to_phys(page) != phys + (page - addr)) return 0;
+    }
+
+    return phys;
+}
+
+/*
+    Contiguous frames dev can reach, ZONE_NORMAL first
+    - Buddy blocks are aligned to their size, so one no larger than the
+      boundary never crosses it
+    Returns 0 on failure
+*/
+static phys_addr_t _alloc_frames(const struct dma_dev* dev, size_t size) {
+    if (size == 0 || (dev->boundary != 0 && size > dev->boundary)) return 0;
+
+    u8 order = _order(size);
+    enum zone_type zone =
+        (dev->limit <= ZONE_DMA_LIMIT) ? ZONE_DMA : ZONE_NORMAL;
+
+    phys_addr_t frames = pmm_alloc_frames_zone(order, zone);
+    if (frames != 0 && !_reachable(dev, frames, size)) {
+        pmm_free_frames(frames, order);
+        frames = (zone != ZONE_DMA) ? pmm_alloc_frames_zone(order, ZONE_DMA)
+                                    : 0;
+    }
+
+    return frames;
+}
+
+/*
+    Allocates size bytes of zeroed, physically contiguous memory dev can
+    reach
+    Returns the virtual address (physical one in *phys), NULL on failure
+*/
+void* dma_alloc_coherent(const struct dma_dev* dev, size_t size,
+                         phys_addr_t* phys) {
+    phys_addr_t frames = _alloc_frames(dev, size);
+    if (frames == 0) return NULL;
+
+    for (size_t off = 0; off < PAGE_ALIGN_UP(size); off += PAGE_SIZE)
+        clear_page(PHYS_TO_VIRT(frames + off));
+
+    *phys = frames;
+    return PHYS_TO_VIRT(frames);
+}
+
+void dma_free_coherent(void* virt, size_t size) {
+    if (virt != NULL) pmm_free_frames(VIRT_TO_PHYS(virt), _order(size));
+}
+
+/*
+    Hands [buf, buf + size) to dev for a transfer in direction dir
+    - buf itself if it is contiguous & reachable, else a bounce buffer
+      (filled from buf unless the device only writes)
+    Returns the address for the device, 0 on failure
+*/
+phys_addr_t dma_map_single(const struct dma_dev* dev, void* buf, size_t size,
+                           enum dma_dir dir) {
+    phys_addr_t phys = _contiguous_phys(buf, size);
+    if (phys != 0 && _reachable(dev, phys, size)) {
+        u32 flags = spin_lock_irqsave(&dma_lock);
+        direct_maps++;
+        spin_unlock_irqrestore(&dma_lock, flags);
+        return phys;
+    }
+
+    struct dma_bounce* bounce = kmalloc(sizeof(struct dma_bounce));
+    phys_addr_t frames = (bounce != NULL) ? _alloc_frames(dev, size) : 0;
+    if (frames == 0) {
+        kfree(bounce);
+
+        u32 flags = spin_lock_irqsave(&dma_lock);
+        failed_maps++;
+        spin_unlock_irqrestore(&dma_lock, flags);
+        return 0;
+    }
+
+    if (dir != DMA_FROM_DEVICE) memcpy(PHYS_TO_VIRT(frames), buf, size);
+
+    bounce->phys = frames;
+    bounce->buf = buf;
+
+    u32 flags = spin_lock_irqsave(&dma_lock);
+    bounce->next = bounces;
+    bounces = bounce;
+    bounce_maps++;
+    spin_unlock_irqrestore(&dma_lock, flags);
+
+    return frames;
+}
+
+// Ends a transfer, data the device wrote to a bounce buffer is copied back
+void dma_unmap_single(phys_addr_t addr, size_t size, enum dma_dir dir) {
+    u32 flags = spin_lock_irqsave(&dma_lock);
+    struct dma_bounce** link = &bounces;
+    while (*link != NULL && (*link)->phys != addr) link = &(*link)->next;
+
+    struct dma_bounce* bounce = *link;
+    if (bounce != NULL) *link = bounce->next;
+    spin_unlock_irqrestore(&dma_lock, flags);
+
+    // Zero-copy mapping, nothing to undo
+    if (bounce == NULL) return;
+
+    if (dir != DMA_TO_DEVICE) memcpy(bounce->buf, PHYS_TO_VIRT(addr), size);
+
+    pmm_free_frames(addr, _order(size));
+    kfree(bounce);
+}
+
+void dma_print_stats() {
+    kprintf("DMA: %u zero-copy, %u bounced, %u failed mappings\n",
+            direct_maps, bounce_maps, failed_maps);
+}
@@ -0,0 +1,369 @@
+#include <arch/i386/paging.h>
+#include <arch/i386/smp.h>
+#include <early_kprintf.h>
+#include <mm/arena.h>
+#include <mm/pmm.h>
+#include <multiboot2_tbl.h>
+#include <spinlock.h>
+
+static struct page* mem_map = NULL;
+static u32 max_pfn = 0;
+
+static struct zone zones[NUM_ZONES] = {
+    [ZONE_DMA] = {.name = "DMA"},
+    [ZONE_NORMAL] = {.name = "Normal"},
+    [ZONE_HIGH] = {.name = "HighMem"},
+};
+
+// Zone ends, aligned to the largest block so buddies never cross them
+static const u32 zone_limits[NUM_ZONES] = {
+    [ZONE_DMA] = PHYS_TO_PFN(ZONE_DMA_LIMIT),
+    [ZONE_NORMAL] = PHYS_TO_PFN(DIRECT_MAP_LIMIT),
+    [ZONE_HIGH] = PFN_NONE,
+};
+
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+static volatile u32 pmm_lock_cpu = CPU_NONE;
+
+static u32 _pmm_lock() {
+    u32 flags = spin_lock_irqsave(&pmm_lock);
+    pmm_lock_cpu = smp_cpu_id();
+    return flags;
+}
+
+static void _pmm_unlock(u32 flags) {
+    pmm_lock_cpu = CPU_NONE;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+static struct mem_range reserved[PMM_MAX_RESERVED];
+static size_t num_reserved = 0;
+
+/*
+    =====================
+        Free lists
+    =====================
+*/
+static inline struct zone* _pfn_zone(u32 pfn) {
+    u8 z = 0;
+    while (pfn >= zone_limits[z]) z++;
+    return &zones[z];
+}
+
+static inline void _list_push(struct zone* zone, u32 pfn, u8 order) {
+    struct free_area* area = &zone->free_area[order];
+    struct page* page = &mem_map[pfn];
+
+    page->order = order;
+    page->flags |= PG_FREE;
+    page->prev = PFN_NONE;
+    page->next = area->head;
+    if (area->head != PFN_NONE) mem_map[area->head].prev = pfn;
+
+    area->head = pfn;
+    area->count++;
+    zone->free_mask |= (1 << order);
+}
+
+static inline void _list_remove(struct zone* zone, u32 pfn, u8 order) {
+    struct free_area* area = &zone->free_area[order];
+    struct page* page = &mem_map[pfn];
+
+    if (page->prev != PFN_NONE) {
+        mem_map[page->prev].next = page->next;
+    } else {
+        area->head = page->next;
+    }
+    if (page->next != PFN_NONE) mem_map[page->next].prev = page->prev;
+
+    page->flags &= ~PG_FREE;
+    if (--area->count == 0) zone->free_mask &= ~(1 << order);
+}
+
+// Insert block & merge with its buddy while the buddy is a free block too
+static void _free_block(struct zone* zone, u32 pfn, u8 order) {
+    while (order < PMM_MAX_ORDER - 1) {
+        u32 buddy = pfn ^ (1 << order);
+        if (buddy < zone->start_pfn || buddy >= zone->end_pfn) break;
+
+        struct page* page = &mem_map[buddy];
+        if (!(page->flags & PG_FREE) || page->order != order) break;
+
+        _list_remove(zone, buddy, order);
+        pfn &= ~(1 << order);
+        order++;
+    }
+
+    _list_push(zone, pfn, order);
+}
+
+/*
+    Adds [start, end) to the free & total counts of its zones, as the
+    largest naturally aligned blocks that fit
+*/
+static void _free_range(u32 start, u32 end) {
+    while (start < end) {
+        struct zone* zone = _pfn_zone(start);
+        u8 order = (start == 0) ? PMM_MAX_ORDER - 1 : __builtin_ctz(start);
+        if (order > PMM_MAX_ORDER - 1) order = PMM_MAX_ORDER - 1;
+        while (start + (1 << order) > end) order--;
+
+        _free_block(zone, start, order);
+        zone->free_frames += (1 << order);
+        zone->total_frames += (1 << order);
+        start += (1 << order);
+    }
+}
+
+/*
+    =====================
+        Boot setup
+    =====================
+*/
+static void _add_reserved(phys_addr_t start, phys_addr_t end) {
+    if (num_reserved == PMM_MAX_RESERVED) {
+        kerror("PMM: too many reserved ranges!\n");
+        return;
+    }
+
+    reserved[num_reserved].start = PAGE_ALIGN_DOWN(start);
+    reserved[num_reserved].end = PAGE_ALIGN_UP(end);
+    num_reserved++;
+}
+
+static bool _is_available(mmap_entry_st* entry, u64* start, u64* end) {
+    if (entry->type != MEM_AVAIL_TYPE) return false;
+
+    *start = PAGE_ALIGN_UP(entry->addr);
+    *end = PAGE_ALIGN_DOWN(entry->addr + entry->len);
+    if (*end > paging_phys_limit()) *end = paging_phys_limit();
+
+    return *start < *end;
+}
+
+static void _mark_reserved(phys_addr_t start, phys_addr_t end) {
+    u32 last = PHYS_TO_PFN(end);
+    if (last > max_pfn) last = max_pfn;
+
+    for (u32 pfn = PHYS_TO_PFN(start); pfn < last; pfn++)
+        mem_map[pfn].flags = PG_RESERVED;
+}
+
+void pmm_init() {
+    mmap_tbl_st map;
+    get_mmap(&map);
+
+    // Highest usable frame decides the size of the frame descriptors
+    for (size_t i = 0; i < map.num_entries; i++) {
+        u64 start, end;
+        if (!_is_available(&map.tbl[i], &start, &end)) continue;
+        if (PHYS_TO_PFN(end) > max_pfn) max_pfn = PHYS_TO_PFN(end);
+    }
+
+    u32 zone_start = 0;
+    for (u8 z = 0; z < NUM_ZONES; z++) {
+        u32 end = (max_pfn < zone_limits[z]) ? max_pfn : zone_limits[z];
+        zones[z].start_pfn = zone_start;
+        zones[z].end_pfn = (end > zone_start) ? end : zone_start;
+        zone_start = zones[z].end_pfn;
+
+        for (u8 i = 0; i < PMM_MAX_ORDER; i++) {
+            zones[z].free_area[i].head = PFN_NONE;
+            zones[z].free_area[i].count = 0;
+        }
+    }
+
+    // Frame 0 doubles as the allocation failure value
+    _add_reserved(0, PAGE_SIZE);
+    _add_reserved(TRAMPOLINE_BASE, TRAMPOLINE_BASE + PAGE_SIZE);
+    _add_reserved(KRNL_START, KRNL_END);
+
+    size_t mb2_start, mb2_end;
+    get_mb2_tbl_range(&mb2_start, &mb2_end);
+    _add_reserved(mb2_start, mb2_end);
+
+    mod_info_st** mods = get_modules();
+    for (size_t i = 0; mods[i] != NULL; i++)
+        _add_reserved(mods[i]->mod_start, mods[i]->mod_end);
+
+    // Descriptors come from the boot arena, which is then capped & reserved
+    size_t map_size = PAGE_ALIGN_UP(max_pfn * sizeof(struct page));
+    if (boot_arena_active()) mem_map = boot_alloc(map_size, PAGE_SIZE);
+    if (mem_map == NULL) {
+        kerror("PMM: no room for %d frame descriptors!\n", max_pfn);
+        max_pfn = 0;
+        return;
+    }
+
+    boot_arena_trim(BOOT_ARENA_SLACK);
+
+    phys_addr_t arena_start, arena_end;
+    get_boot_arena_range(&arena_start, &arena_end);
+    _add_reserved(arena_start, arena_end);
+
+    // Everything starts reserved, available RAM minus reservations is freed
+    for (u32 pfn = 0; pfn < max_pfn; pfn++) {
+        mem_map[pfn].flags = PG_RESERVED;
+        mem_map[pfn].order = 0;
+        mem_map[pfn].priv = NULL;
+    }
+
+    for (size_t i = 0; i < map.num_entries; i++) {
+        u64 start, end;
+        if (!_is_available(&map.tbl[i], &start, &end)) continue;
+
+        for (u32 pfn = PHYS_TO_PFN(start); pfn < PHYS_TO_PFN(end); pfn++)
+            mem_map[pfn].flags = 0;
+    }
+
+    for (size_t r = 0; r < num_reserved; r++)
+        _mark_reserved(reserved[r].start, reserved[r].end);
+
+    u32 pfn = 0;
+    while (pfn < max_pfn) {
+        if (mem_map[pfn].flags & PG_RESERVED) {
+            pfn++;
+            continue;
+        }
+
+        u32 run_end = pfn;
+        while (run_end < max_pfn && !(mem_map[run_end].flags & PG_RESERVED))
+            run_end++;
+
+        _free_range(pfn, run_end);
+        pfn = run_end;
+    }
+}
+
+/*
+    =====================
+        Allocation
+    =====================
+*/
+
+// Returns the first pfn of a 2^order block, PFN_NONE if zone has none
+static u32 _alloc_from(struct zone* zone, u8 order) {
+    u32 avail = zone->free_mask & ~((1 << order) - 1);
+    if (avail == 0) return PFN_NONE;
+
+    u8 cur = __builtin_ctz(avail);
+    u32 pfn = zone->free_area[cur].head;
+    _list_remove(zone, pfn, cur);
+
+    // Split down, returning the upper halves to the free lists
+    while (cur > order) {
+        cur--;
+        _list_push(zone, pfn + (1 << cur), cur);
+    }
+
+    mem_map[pfn].order = order;
+    zone->free_frames -= (1 << order);
+    return pfn;
+}
+
+/*
+    Allocate 2^order contiguous frames from zone, or a lower zone if it
+    is exhausted
+    Returns the physical address of the first frame, 0 on failure
+*/
+phys_addr_t pmm_alloc_frames_zone(u8 order, enum zone_type zone) {
+    if (order >= PMM_MAX_ORDER || zone >= NUM_ZONES) return 0;
+
+    u32 flags = _pmm_lock();
+    u32 pfn = PFN_NONE;
+    for (int z = zone; z >= 0 && pfn == PFN_NONE; z--)
+        pfn = _alloc_from(&zones[z], order);
+    _pmm_unlock(flags);
+
+    return (pfn == PFN_NONE) ? 0 : PFN_TO_PHYS(pfn);
+}
+
+// Frames from ZONE_NORMAL, usable through PHYS_TO_VIRT()
+phys_addr_t pmm_alloc_frames(u8 order) {
+    return pmm_alloc_frames_zone(order, ZONE_NORMAL);
+}
+
+void pmm_free_frames(phys_addr_t addr, u8 order) {
+    u32 pfn = PHYS_TO_PFN(addr);
+    if (addr == 0 || pfn >= max_pfn || order >= PMM_MAX_ORDER) return;
+
+    // Checked under the lock, two racing frees of one pfn can't both pass
+    struct page* page = &mem_map[pfn];
+    struct zone* zone = _pfn_zone(pfn);
+    u32 flags = _pmm_lock();
+    if (page->flags & (PG_RESERVED | PG_FREE)) {
+        _pmm_unlock(flags);
+        kerror("PMM: bad free of pfn %x\n", pfn);
+        return;
+    }
+
+    zone->free_frames += (1 << order);
+    _free_block(zone, pfn, order);
+    _pmm_unlock(flags);
+}
+
+phys_addr_t pmm_alloc_frame() { return pmm_alloc_frames(0); }
+
+void pmm_free_frame(phys_addr_t addr) { pmm_free_frames(addr, 0); }
+
+/*
+    For the page fault path, which allocates & can't if this CPU faulted
+    with the lock held
+*/
+bool pmm_lock_held() { return pmm_lock_cpu == smp_cpu_id(); }
+
+/*
+    Hands a reserved range (ie. the unused boot arena) to the allocator
+*/
+void pmm_free_range(phys_addr_t start, phys_addr_t end) {
+    u32 first = PHYS_TO_PFN(PAGE_ALIGN_UP(start));
+    u32 last = PHYS_TO_PFN(PAGE_ALIGN_DOWN(end));
+    if (last > max_pfn) last = max_pfn;
+    if (first >= last) return;
+
+    u32 flags = _pmm_lock();
+    for (u32 pfn = first; pfn < last; pfn++) mem_map[pfn].flags = 0;
+
+    _free_range(first, last);
+    _pmm_unlock(flags);
+}
+
+struct page* pfn_to_page(u32 pfn) {
+    return (pfn < max_pfn) ? &mem_map[pfn] : NULL;
+}
+
+struct page* virt_to_page(const void* ptr) {
+    return pfn_to_page(PHYS_TO_PFN(VIRT_TO_PHYS(ptr)));
+}
+
+u32 pmm_get_max_pfn() { return max_pfn; }
+
+size_t pmm_get_free_frames() {
+    size_t free = 0;
+    for (u8 z = 0; z < NUM_ZONES; z++) free += zones[z].free_frames;
+    return free;
+}
+
+size_t pmm_get_total_frames() {
+    size_t total = 0;
+    for (u8 z = 0; z < NUM_ZONES; z++) total += zones[z].total_frames;
+    return total;
+}
+
+void pmm_print_stats() {
+    kprintf("Descriptors: %u at %p\n", max_pfn, mem_map);
+
+    for (u8 z = 0; z < NUM_ZONES; z++) {
+        struct zone* zone = &zones[z];
+        if (zone->total_frames == 0) continue;
+
+        kprintf("Zone %s: %u free / %u total frames (%u KB free)\n",
+                zone->name, zone->free_frames, zone->total_frames,
+                zone->free_frames * (PAGE_SIZE / 1024));
+
+        kputs("  free blocks per order:");
+        for (u8 i = 0; i < PMM_MAX_ORDER; i++)
+            kprintf(" %u", zone->free_area[i].count);
+        kputchar('\n');
+    }
+}
@@ -0,0 +1,364 @@
+#include <early_kprintf.h>
+#include <lib/string.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+
+static struct kmem_cache cache_cache;
+static struct kmem_cache kmalloc_caches[KMALLOC_NUM_CLASSES];
+static const char* kmalloc_names[KMALLOC_NUM_CLASSES] = {
+    "kmalloc-16",  "kmalloc-32",   "kmalloc-64",   "kmalloc-128", "kmalloc-256",
+    "kmalloc-512", "kmalloc-1024", "kmalloc-2048", "kmalloc-4096"};
+
+static struct kmem_cache* cache_list = NULL;
+static spinlock_t cache_list_lock = SPINLOCK_INIT;
+
+/*
+    =====================
+        Slab lists
+    =====================
+*/
+static void _slab_list_add(struct slab** head, struct slab* slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void _slab_list_remove(struct slab** head, struct slab* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) slab->next->prev = slab->prev;
+}
+
+/*
+    =====================
+        Slab layer
+        (cache lock held)
+    =====================
+*/
+static struct slab* _slab_grow(struct kmem_cache* cache) {
+    phys_addr_t frames = pmm_alloc_frames(cache->order);
+    if (frames == 0) return NULL;
+
+    struct slab* slab = (struct slab*)PHYS_TO_VIRT(frames);
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->total = cache->objs_per_slab;
+    slab->free_list = NULL;
+
+    // Link objects back to front so the first one is handed out first
+    u8* base = (u8*)slab + cache->obj_offset;
+    for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+        void** obj = (void**)(base + i * cache->obj_size);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    for (u32 i = 0; i < (1u << cache->order); i++) {
+        struct page* page = pfn_to_page(PHYS_TO_PFN(frames) + i);
+        page->flags |= PG_SLAB;
+        page->priv = slab;
+    }
+
+    cache->num_slabs++;
+    return slab;
+}
+
+static void _slab_release(struct kmem_cache* cache, struct slab* slab) {
+    phys_addr_t frames = VIRT_TO_PHYS(slab);
+    for (u32 i = 0; i < (1u << cache->order); i++) {
+        struct page* page = pfn_to_page(PHYS_TO_PFN(frames) + i);
+        page->flags &= ~PG_SLAB;
+        page->priv = NULL;
+    }
+
+    cache->num_slabs--;
+    pmm_free_frames(frames, cache->order);
+}
+
+// Fill an empty magazine, partial slabs first to keep slabs dense
+static void _magazine_refill(struct kmem_cache* cache,
+                             struct kmem_magazine* mag) {
+    while (mag->count < cache->mag_size) {
+        struct slab* slab = cache->partial;
+        if (slab == NULL) {
+            slab = cache->empty;
+            if (slab != NULL) {
+                _slab_list_remove(&cache->empty, slab);
+            } else {
+                slab = _slab_grow(cache);
+                if (slab == NULL) return;
+            }
+            _slab_list_add(&cache->partial, slab);
+        }
+
+        while (slab->free_list != NULL && mag->count < cache->mag_size) {
+            void** obj = (void**)slab->free_list;
+            slab->free_list = *obj;
+            slab->in_use++;
+            cache->num_active++;
+            mag->objs[mag->count++] = obj;
+        }
+
+        if (slab->free_list == NULL) {
+            _slab_list_remove(&cache->partial, slab);
+            _slab_list_add(&cache->full, slab);
+        }
+    }
+}
+
+// Return every object of a magazine to its slab, keep one empty slab around
+static void _magazine_flush(struct kmem_cache* cache,
+                            struct kmem_magazine* mag) {
+    while (mag->count > 0) {
+        void** obj = (void**)mag->objs[--mag->count];
+        struct slab* slab = (struct slab*)virt_to_page(obj)->priv;
+
+        if (slab->free_list == NULL) {
+            _slab_list_remove(&cache->full, slab);
+            _slab_list_add(&cache->partial, slab);
+        }
+
+        *obj = slab->free_list;
+        slab->free_list = obj;
+        slab->in_use--;
+        cache->num_active--;
+
+        if (slab->in_use == 0) {
+            _slab_list_remove(&cache->partial, slab);
+            if (cache->empty == NULL) {
+                _slab_list_add(&cache->empty, slab);
+            } else {
+                _slab_release(cache, slab);
+            }
+        }
+    }
+}
+
+/*
+    =====================
+        Caches
+    =====================
+*/
+
+// Smallest slab order wasting at most 1/8 of the slab
+static u8 _pick_order(size_t offset, size_t obj_size) {
+    for (u8 order = 0; order < SLAB_MAX_ORDER; order++) {
+        size_t slab_size = PAGE_SIZE << order;
+        if (slab_size < offset + obj_size) continue;
+
+        size_t waste = (slab_size - offset) % obj_size + offset;
+        if (waste * 8 <= slab_size) return order;
+    }
+
+    return SLAB_MAX_ORDER;
+}
+
+static void _cache_setup(struct kmem_cache* cache, const char* name,
+                         size_t size, size_t align) {
+    if (align < sizeof(void*)) align = sizeof(void*);
+    if (size < sizeof(void*)) size = sizeof(void*);
+
+    strncpy(cache->name, name, SLAB_NAME_LEN - 1);
+    cache->name[SLAB_NAME_LEN - 1] = '\0';
+    cache->align = align;
+    cache->obj_size = (size + align - 1) & ~(align - 1);
+    cache->obj_offset = (sizeof(struct slab) + align - 1) & ~(align - 1);
+    cache->order = _pick_order(cache->obj_offset, cache->obj_size);
+    cache->objs_per_slab =
+        ((PAGE_SIZE << cache->order) - cache->obj_offset) / cache->obj_size;
+
+    // About a slab's worth per magazine so big objects don't pin many slabs
+    cache->mag_size = cache->objs_per_slab;
+    if (cache->mag_size < SLAB_MIN_MAG_SIZE)
+        cache->mag_size = SLAB_MIN_MAG_SIZE;
+    if (cache->mag_size > SLAB_MAG_SIZE) cache->mag_size = SLAB_MAG_SIZE;
+
+    cache->lock = (spinlock_t)SPINLOCK_INIT;
+    cache->partial = cache->full = cache->empty = NULL;
+    cache->num_slabs = cache->num_active = 0;
+
+    for (int i = 0; i < MAX_CPUS; i++) {
+        struct kmem_cpu_cache* cc = &cache->cpu[i];
+        cc->mags[0].count = cc->mags[1].count = 0;
+        cc->loaded = &cc->mags[0];
+        cc->prev = &cc->mags[1];
+        cc->allocs = cc->frees = cc->misses = 0;
+    }
+
+    u32 flags = spin_lock_irqsave(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+}
+
+void slab_init() {
+    // Keeps cpu[] on its own lines in caches made by kmem_cache_create()
+    _cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache),
+                 __alignof__(struct kmem_cache));
+    if (cpu_topo.cache_line > SLAB_CPU_ALIGN)
+        kprintf("SLAB: %u B cache lines, per-CPU caches may share them\n",
+                cpu_topo.cache_line);
+
+    for (int i = 0; i < KMALLOC_NUM_CLASSES; i++) {
+        size_t size = 1 << (KMALLOC_MIN_SHIFT + i);
+        size_t align = (size < KMALLOC_MAX_ALIGN) ? size : KMALLOC_MAX_ALIGN;
+        _cache_setup(&kmalloc_caches[i], kmalloc_names[i], size, align);
+    }
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size,
+                                     size_t align) {
+    if (size == 0 || size > (PAGE_SIZE << SLAB_MAX_ORDER) / 2) return NULL;
+    if (align & (align - 1)) return NULL;
+
+    struct kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+    if (cache == NULL) return NULL;
+
+    _cache_setup(cache, name, size, align);
+    return cache;
+}
+
+// Drains this CPU's magazines back into the slabs
+void kmem_cache_flush(struct kmem_cache* cache) {
+    u32 flags = spin_lock_irqsave(&cache->lock);
+    struct kmem_cpu_cache* cc = &cache->cpu[smp_cpu_id()];
+    _magazine_flush(cache, cc->loaded);
+    _magazine_flush(cache, cc->prev);
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/*
+    Destroys a cache, every object must have been freed
+    NOTE: only this CPU's magazines are drained
+*/
+void kmem_cache_destroy(struct kmem_cache* cache) {
+    kmem_cache_flush(cache);
+
+    u32 flags = spin_lock_irqsave(&cache->lock);
+    if (cache->num_active != 0) {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        kerror("SLAB: destroying %s with %u live objects!\n", cache->name,
+               cache->num_active);
+        return;
+    }
+
+    if (cache->empty != NULL) _slab_release(cache, cache->empty);
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    flags = spin_lock_irqsave(&cache_list_lock);
+    struct kmem_cache** link = &cache_list;
+    while (*link != NULL && *link != cache) link = &(*link)->next;
+    if (*link != NULL) *link = cache->next;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+
+    kmem_cache_free(&cache_cache, cache);
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    u32 flags = local_irq_save();
+    struct kmem_cpu_cache* cc = &cache->cpu[smp_cpu_id()];
+
+    if (cc->loaded->count == 0) {
+        struct kmem_magazine* tmp = cc->loaded;
+        cc->loaded = cc->prev;
+        cc->prev = tmp;
+
+        if (cc->loaded->count == 0) {
+            spin_lock(&cache->lock);
+            _magazine_refill(cache, cc->loaded);
+            spin_unlock(&cache->lock);
+            cc->misses++;
+        }
+    }
+
+    void* obj = NULL;
+    if (cc->loaded->count > 0) {
+        obj = cc->loaded->objs[--cc->loaded->count];
+        cc->allocs++;
+    }
+
+    local_irq_restore(flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    if (obj == NULL) return;
+
+    u32 flags = local_irq_save();
+    struct kmem_cpu_cache* cc = &cache->cpu[smp_cpu_id()];
+
+    if (cc->loaded->count == cache->mag_size) {
+        if (cc->prev->count != 0) {
+            spin_lock(&cache->lock);
+            _magazine_flush(cache, cc->prev);
+            spin_unlock(&cache->lock);
+            cc->misses++;
+        }
+
+        struct kmem_magazine* tmp = cc->loaded;
+        cc->loaded = cc->prev;
+        cc->prev = tmp;
+    }
+
+    cc->loaded->objs[cc->loaded->count++] = obj;
+    cc->frees++;
+    local_irq_restore(flags);
+}
+
+/*
+    =====================
+        kmalloc
+    =====================
+*/
+static inline int _size_class(size_t size) {
+    if (size <= (1 << KMALLOC_MIN_SHIFT)) return 0;
+    return 32 - __builtin_clz(size - 1) - KMALLOC_MIN_SHIFT;
+}
+
+void* kmalloc(size_t size) {
+    if (size == 0) return NULL;
+    if (size <= (1 << KMALLOC_MAX_SHIFT))
+        return kmem_cache_alloc(&kmalloc_caches[_size_class(size)]);
+
+    // Large allocation: whole frames, order is kept in the page descriptor
+    u8 order = 32 - __builtin_clz((PAGE_ALIGN_UP(size) >> PAGE_SHIFT) - 1);
+    phys_addr_t frames = pmm_alloc_frames(order);
+    return (frames == 0) ? NULL : PHYS_TO_VIRT(frames);
+}
+
+void kfree(void* ptr) {
+    if (ptr == NULL) return;
+
+    struct page* page = virt_to_page(ptr);
+    if (page == NULL) {
+        kerror("SLAB: kfree of unknown pointer %p\n", ptr);
+        return;
+    }
+
+    if (page->flags & PG_SLAB) {
+        kmem_cache_free(((struct slab*)page->priv)->cache, ptr);
+    } else {
+        pmm_free_frames(VIRT_TO_PHYS(ptr), page->order);
+    }
+}
+
+void slab_print_stats() {
+    kputs("cache: obj_size order slabs active hits misses\n");
+
+    u32 flags = spin_lock_irqsave(&cache_list_lock);
+    for (struct kmem_cache* c = cache_list; c != NULL; c = c->next) {
+        u32 hits = 0, misses = 0;
+        for (int i = 0; i < MAX_CPUS; i++) {
+            hits += c->cpu[i].allocs + c->cpu[i].frees;
+            misses += c->cpu[i].misses;
+        }
+
+        kprintf("%s: %u %u %u %u %u %u\n", c->name, c->obj_size, c->order,
+                c->num_slabs, c->num_active, hits - misses, misses);
+    }
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+}
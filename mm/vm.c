@@ -0,0 +1,534 @@
+#include <arch/i386/paging.h>
+#include <arch/i386/smp.h>
+#include <early_kprintf.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <mm/vm.h>
+#include <mm/zero_pool.h>
+#include <multiboot2_tbl.h>
+#include <spinlock.h>
+
+static struct rb_root busy_tree = RB_ROOT_INIT;
+static struct rb_root free_tree = RB_ROOT_INIT;
+static struct vm_region* buckets[VM_NUM_BUCKETS];
+static u32 bucket_mask = 0;
+
+static struct vm_region* purge_list = NULL;
+static size_t purge_pages = 0;
+
+static spinlock_t vm_lock = SPINLOCK_INIT;
+static volatile u32 vm_lock_cpu = CPU_NONE; /* see vm_handle_fault() */
+
+static u32 _vm_lock() {
+    u32 flags = spin_lock_irqsave(&vm_lock);
+    vm_lock_cpu = smp_cpu_id();
+    return flags;
+}
+
+static void _vm_unlock(u32 flags) {
+    vm_lock_cpu = CPU_NONE;
+    spin_unlock_irqrestore(&vm_lock, flags);
+}
+
+/*
+    =====================
+        Range index
+    =====================
+*/
+
+// Bucket b holds ranges of [2^b, 2^(b+1)) pages
+static inline u8 _bucket(size_t size) {
+    u8 b = 31 - __builtin_clz(size >> PAGE_SHIFT);
+    return (b < VM_NUM_BUCKETS) ? b : VM_NUM_BUCKETS - 1;
+}
+
+static void _bucket_add(struct vm_region* range) {
+    u8 b = _bucket(range->end - range->start);
+
+    range->prev = NULL;
+    range->next = buckets[b];
+    if (buckets[b] != NULL) buckets[b]->prev = range;
+
+    buckets[b] = range;
+    bucket_mask |= (1 << b);
+}
+
+// Must run before the range is resized
+static void _bucket_remove(struct vm_region* range) {
+    u8 b = _bucket(range->end - range->start);
+
+    if (range->prev != NULL) {
+        range->prev->next = range->next;
+    } else {
+        buckets[b] = range->next;
+    }
+    if (range->next != NULL) range->next->prev = range->prev;
+
+    if (buckets[b] == NULL) bucket_mask &= ~(1 << b);
+}
+
+static void _tree_insert(struct rb_root* root, struct vm_region* region) {
+    struct rb_node** link = &root->node;
+    struct rb_node* parent = NULL;
+
+    while (*link != NULL) {
+        parent = *link;
+        struct vm_region* cur = rb_entry(parent, struct vm_region, node);
+        link = (region->start < cur->start) ? &parent->left : &parent->right;
+    }
+
+    rb_link_node(&region->node, parent, link);
+    rb_insert_fixup(root, &region->node);
+}
+
+// Region in use containing addr (guard page excluded), NULL if none
+static struct vm_region* _find_busy(size_t addr) {
+    struct rb_node* node = busy_tree.node;
+
+    while (node != NULL) {
+        struct vm_region* region = rb_entry(node, struct vm_region, node);
+        if (addr < region->start) {
+            node = node->left;
+        } else if (addr >= region->end) {
+            node = node->right;
+        } else {
+            return region;
+        }
+    }
+
+    return NULL;
+}
+
+// Adds a range to the free index, merging it with adjacent free ranges
+static void _free_insert(struct vm_region* range) {
+    _tree_insert(&free_tree, range);
+
+    struct rb_node* node = rb_prev(&range->node);
+    if (node != NULL) {
+        struct vm_region* prev = rb_entry(node, struct vm_region, node);
+        if (prev->end == range->start) {
+            _bucket_remove(prev);
+            rb_erase(&free_tree, &range->node);
+            prev->end = range->end;
+            kfree(range);
+            range = prev;
+        }
+    }
+
+    node = rb_next(&range->node);
+    if (node != NULL) {
+        struct vm_region* next = rb_entry(node, struct vm_region, node);
+        if (range->end == next->start) {
+            _bucket_remove(next);
+            rb_erase(&free_tree, node);
+            range->end = next->end;
+            kfree(next);
+        }
+    }
+
+    _bucket_add(range);
+}
+
+/*
+    Carves size bytes starting at color modulo align out of a free range
+    (align is a power of 2 >= PAGE_SIZE, color < align)
+    - *spare is used (& cleared) if the range has to be split in three
+    Returns the start address, 0 if nothing fits
+*/
+static size_t _alloc_range(size_t size, size_t align, size_t color,
+                           struct vm_region** spare) {
+    // Any range of at least need bytes fits, whatever its alignment
+    size_t need = size + align - PAGE_SIZE;
+    u8 b = _bucket(need);
+
+    struct vm_region* range = NULL;
+    u32 above = (b + 1 < VM_NUM_BUCKETS) ? bucket_mask & ~((2 << b) - 1) : 0;
+    if (above != 0) {
+        range = buckets[__builtin_ctz(above)];
+    } else {
+        for (range = buckets[b]; range != NULL; range = range->next)
+            if (range->end - range->start >= need) break;
+    }
+    if (range == NULL) return 0;
+
+    size_t start = range->start + ((color - range->start) & (align - 1));
+    size_t end = start + size;
+    size_t range_end = range->end;
+
+    // The head stays in the tree under the same key, else range is reused
+    _bucket_remove(range);
+    if (start > range->start) {
+        range->end = start;
+        _bucket_add(range);
+        range = NULL;
+    } else {
+        rb_erase(&free_tree, &range->node);
+    }
+
+    if (end < range_end) {
+        struct vm_region* tail = range;
+        if (tail == NULL) {
+            tail = *spare;
+            *spare = NULL;
+        }
+
+        tail->start = end;
+        tail->end = range_end;
+        _tree_insert(&free_tree, tail);
+        _bucket_add(tail);
+    } else if (range != NULL) {
+        kfree(range);
+    }
+
+    return start;
+}
+
+/*
+    Takes every parked region off the purge list & unmaps it, without a
+    TLB flush (lock held)
+    - Frames may only be reused after the flush, until then they are
+      chained through their (otherwise unused) struct page next links
+    Returns the regions, their frames in *frames
+*/
+static struct vm_region* _purge_detach(u32* frames) {
+    *frames = PFN_NONE;
+    for (struct vm_region* region = purge_list; region != NULL;
+         region = region->next) {
+        size_t addr = region->start;
+        while (addr < region->end) {
+            phys_addr_t phys = virt_to_phys(addr);
+            size_t size = unmap_page_noflush(addr);
+            if (size == 0) {
+                addr += PAGE_SIZE;
+                continue;
+            }
+
+            if (region->flags & (VM_LAZY | VM_ALLOC)) {
+                pfn_to_page(PHYS_TO_PFN(phys))->next = *frames;
+                *frames = PHYS_TO_PFN(phys);
+            }
+            addr += size;
+        }
+    }
+
+    struct vm_region* list = purge_list;
+    purge_list = NULL;
+    purge_pages = 0;
+    return list;
+}
+
+/*
+    Flushes the detached regions out of every CPU's TLB behind a single
+    shootdown, then frees their frames & address ranges
+    NOTE: lock not held, the shootdown waits for the other CPUs
+*/
+static void _purge_finish(struct vm_region* list, u32 frames) {
+    if (list == NULL) return;
+
+    smp_flush_tlb_all();
+
+    while (frames != PFN_NONE) {
+        u32 next = pfn_to_page(frames)->next;
+        pmm_free_frame(PFN_TO_PHYS(frames));
+        frames = next;
+    }
+
+    u32 flags = _vm_lock();
+    while (list != NULL) {
+        struct vm_region* region = list;
+        list = region->next;
+
+        region->end += PAGE_SIZE;
+        _free_insert(region);
+    }
+    _vm_unlock(flags);
+}
+
+/*
+    Reserves size (page aligned) bytes + a guard page at color modulo align
+    Returns the new region, NULL if out of address space
+*/
+static struct vm_region* _reserve(size_t size, size_t align, size_t color,
+                                  u32 region_flags) {
+    struct vm_region* region = kmalloc(sizeof(struct vm_region));
+    struct vm_region* spare = kmalloc(sizeof(struct vm_region));
+    if (region == NULL || spare == NULL) {
+        kfree(region);
+        kfree(spare);
+        return NULL;
+    }
+
+    u32 flags = _vm_lock();
+    size_t start = _alloc_range(size + PAGE_SIZE, align, color, &spare);
+    if (start == 0 && purge_list != NULL) {
+        u32 frames;
+        struct vm_region* purged = _purge_detach(&frames);
+        _vm_unlock(flags);
+        _purge_finish(purged, frames);
+
+        flags = _vm_lock();
+        start = _alloc_range(size + PAGE_SIZE, align, color, &spare);
+    }
+
+    if (start != 0) {
+        region->start = start;
+        region->end = start + size;
+        region->flags = region_flags;
+        _tree_insert(&busy_tree, region);
+    }
+    _vm_unlock(flags);
+
+    kfree(spare);
+    if (start == 0) {
+        kfree(region);
+        return NULL;
+    }
+
+    return region;
+}
+
+/*
+    =====================
+        Public API
+    =====================
+*/
+void vm_init() {
+    struct vm_region* range = kmalloc(sizeof(struct vm_region));
+    if (range == NULL) {
+        kerror("VM: no memory for the address space index!\n");
+        return;
+    }
+
+    range->start = VMALLOC_START;
+    range->end = VMALLOC_END;
+    _free_insert(range);
+}
+
+/*
+    Reserves size bytes (rounded to pages) of demand-zero kernel memory
+    Returns NULL if out of address space
+*/
+void* vm_reserve_lazy(size_t size) {
+    if (size == 0) return NULL;
+
+    struct vm_region* region =
+        _reserve(PAGE_ALIGN_UP(size), PAGE_SIZE, 0, VM_LAZY);
+    return (region != NULL) ? (void*)region->start : NULL;
+}
+
+/*
+    Maps size bytes (rounded to pages) of frames that don't have to be
+    contiguous, highmem first
+    NOTE: not zeroed, see vm_reserve_lazy()
+    Returns NULL on failure
+*/
+void* vmalloc(size_t size) {
+    if (size == 0) return NULL;
+    size = PAGE_ALIGN_UP(size);
+
+    struct vm_region* region = _reserve(size, PAGE_SIZE, 0, VM_ALLOC);
+    if (region == NULL) return NULL;
+
+    for (size_t addr = region->start; addr < region->end; addr += PAGE_SIZE) {
+        phys_addr_t frame = pmm_alloc_frames_zone(0, ZONE_HIGH);
+        if (frame == 0 || !map_page(addr, frame, PTE_KERNEL | PTE_NX)) {
+            if (frame != 0) pmm_free_frame(frame);
+            vm_release((void*)region->start);
+            return NULL;
+        }
+    }
+
+    return (void*)region->start;
+}
+
+void vfree(void* ptr) {
+    if (ptr != NULL) vm_release(ptr);
+}
+
+// True if [phys, end) has RAM in it that the direct map covers (as WB)
+static bool _in_direct_ram(phys_addr_t phys, phys_addr_t end) {
+    if (end > get_direct_map_end()) end = get_direct_map_end();
+    if (phys >= end) return false;
+
+    mmap_tbl_st map;
+    get_mmap(&map);
+    for (size_t i = 0; i < map.num_entries; i++) {
+        const mmap_entry_st* entry = &map.tbl[i];
+        if (entry->type != MEM_AVAIL_TYPE && entry->type != MEM_ACPI_TYPE)
+            continue;
+        if (entry->addr < end && entry->addr + entry->len > phys) return true;
+    }
+
+    return false;
+}
+
+/*
+    Maps the physical range [phys, phys + size) (framebuffer, ACPI tables,
+    PCI BARs...) with memory type type
+    - WB RAM already in the direct map is returned as is, a second mapping
+      would only alias it
+    - Direct mapped RAM is refused for any other type: the two mappings
+      would disagree on the type of the same frames, which the CPU leaves
+      undefined
+    - Large ranges get the same offset into a large page as phys so the
+      aligned middle can use large pages
+    Returns the virtual address of phys, NULL on failure
+*/
+void* ioremap(phys_addr_t phys, size_t size, enum mem_type type) {
+    if (size == 0) return NULL;
+    if (type == MEM_WB && phys + size <= get_direct_map_end())
+        return PHYS_TO_VIRT(phys);
+    if (type != MEM_WB && _in_direct_ram(phys, phys + size)) {
+        kerror("VM: RAM at 0x%llx is direct mapped WB, not remapped\n",
+               phys);
+        return NULL;
+    }
+
+    size_t offset = phys & (PAGE_SIZE - 1);
+    phys -= offset;
+    size = PAGE_ALIGN_UP(size + offset);
+
+    size_t large = paging_large_page_size();
+    size_t align = PAGE_SIZE;
+    size_t color = 0;
+    if (paging_has_large_pages() && size >= large) {
+        align = large;
+        color = phys & (large - 1);
+    }
+
+    struct vm_region* region = _reserve(size, align, color, VM_IOREMAP);
+    if (region == NULL) return NULL;
+
+    u32 flags = PTE_KERNEL | PTE_NX | mem_type_flags(type);
+    size_t virt = region->start;
+    size_t off = 0;
+    while (off < size) {
+        bool fits = align == large && !((virt + off) & (large - 1)) &&
+                    size - off >= large;
+        if (fits && map_large_page(virt + off, phys + off, flags)) {
+            off += large;
+            continue;
+        }
+
+        if (!map_page(virt + off, phys + off, flags)) {
+            vm_release((void*)virt);
+            return NULL;
+        }
+        off += PAGE_SIZE;
+    }
+
+    return (void*)(virt + offset);
+}
+
+void iounmap(void* ptr) {
+    size_t addr = (size_t)ptr;
+    if (addr < VMALLOC_START || addr >= VMALLOC_END) return; /* direct map */
+
+    vm_release((void*)PAGE_ALIGN_DOWN(addr));
+}
+
+/*
+    Frees a region, its mappings (& frames if it owns them) stay until the
+    next purge
+    NOTE: a purge waits for every CPU, see smp_flush_tlb_all()
+*/
+void vm_release(void* ptr) {
+    u32 flags = _vm_lock();
+    struct vm_region* region = _find_busy((size_t)ptr);
+    if (region == NULL || region->start != (size_t)ptr) {
+        _vm_unlock(flags);
+        kerror("VM: release of unknown region %p\n", ptr);
+        return;
+    }
+
+    rb_erase(&busy_tree, &region->node);
+    region->next = purge_list;
+    purge_list = region;
+    purge_pages += (region->end - region->start) >> PAGE_SHIFT;
+
+    u32 frames = PFN_NONE;
+    struct vm_region* purged = NULL;
+    if (purge_pages >= VM_PURGE_PAGES) purged = _purge_detach(&frames);
+    _vm_unlock(flags);
+    _purge_finish(purged, frames);
+}
+
+void vm_purge() {
+    u32 frames;
+    u32 flags = _vm_lock();
+    struct vm_region* purged = _purge_detach(&frames);
+    _vm_unlock(flags);
+    _purge_finish(purged, frames);
+}
+
+/*
+    Called by the page fault handler for not-present pages
+    NOTE: the VM & PMM locks are plain spinlocks, a lazy page touched by
+    code holding either on this CPU would spin on itself here: refused &
+    reported instead (the fault is then fatal)
+    Returns true if the fault was resolved
+*/
+bool vm_handle_fault(size_t addr) {
+    if (vm_lock_cpu == smp_cpu_id() || pmm_lock_held()) {
+        kerror("VM: fault at %p with the %s lock held\n", (void*)addr,
+               pmm_lock_held() ? "PMM" : "VM");
+        return false;
+    }
+
+    u32 flags = _vm_lock();
+    struct vm_region* region = _find_busy(addr);
+    bool handled = false;
+
+    if (region != NULL && (region->flags & VM_LAZY)) {
+        size_t page = PAGE_ALIGN_DOWN(addr);
+        if (is_mapped(page)) {
+            // Another CPU faulted on it first & mapped it while we waited
+            _vm_unlock(flags);
+            return true;
+        }
+
+        phys_addr_t frame = zero_pool_get();
+        bool zeroed = frame != 0;
+        if (!zeroed) frame = pmm_alloc_frames_zone(0, ZONE_HIGH);
+
+        // Highmem has no direct mapping, zero through the new one
+        handled = frame != 0 && map_page(page, frame, PTE_KERNEL | PTE_NX);
+        if (handled && !zeroed) {
+            clear_page((void*)page);
+        } else if (!handled && frame != 0) {
+            pmm_free_frame(frame);
+        }
+    }
+
+    _vm_unlock(flags);
+    return handled;
+}
+
+void vm_print_regions() {
+    static const char* types[] = {"lazy", "vmalloc", "ioremap"};
+
+    u32 flags = _vm_lock();
+    for (struct rb_node* node = rb_first(&busy_tree); node != NULL;
+         node = rb_next(node)) {
+        struct vm_region* r = rb_entry(node, struct vm_region, node);
+        size_t mapped = 0;
+        for (size_t addr = r->start; addr < r->end; addr += PAGE_SIZE)
+            if (is_mapped(addr)) mapped++;
+
+        kprintf("%p-%p %s %u/%u pages mapped\n", (void*)r->start,
+                (void*)r->end, types[__builtin_ctz(r->flags)], mapped,
+                (r->end - r->start) / PAGE_SIZE);
+    }
+
+    size_t free_kb = 0, ranges = 0;
+    for (struct rb_node* node = rb_first(&free_tree); node != NULL;
+         node = rb_next(node)) {
+        struct vm_region* r = rb_entry(node, struct vm_region, node);
+        free_kb += (r->end - r->start) / 1024;
+        ranges++;
+    }
+
+    kprintf("VM: %u KB free in %u ranges, %u pages waiting for a purge\n",
+            free_kb, ranges, purge_pages);
+    _vm_unlock(flags);
+}
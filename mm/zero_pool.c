@@ -0,0 +1,104 @@
+#include <arch/i386/cpuid_info.h>
+#include <early_kprintf.h>
+#include <mm/pmm.h>
+#include <mm/zero_pool.h>
+#include <spinlock.h>
+
+static phys_addr_t pool[ZERO_POOL_SIZE];
+static size_t pool_count = 0;
+static spinlock_t pool_lock = SPINLOCK_INIT;
+
+static u32 hits = 0;
+static u32 misses = 0;
+
+static void _clear_page_nt(void* page) {
+    size_t count = PAGE_SIZE / 32;
+    asm volatile(
+        "1:\n\t"
+        "movnti %%eax, (%0)\n\t"
+        "movnti %%eax, 4(%0)\n\t"
+        "movnti %%eax, 8(%0)\n\t"
+        "movnti %%eax, 12(%0)\n\t"
+        "movnti %%eax, 16(%0)\n\t"
+        "movnti %%eax, 20(%0)\n\t"
+        "movnti %%eax, 24(%0)\n\t"
+        "movnti %%eax, 28(%0)\n\t"
+        "addl $32, %0\n\t"
+        "decl %1\n\t"
+        "jnz 1b\n\t"
+        // NT stores are weakly ordered, publish them before the frame is
+        "sfence"
+        : "+r"(page), "+r"(count)
+        : "a"(0)
+        : "memory");
+}
+
+static void _clear_page_rep(void* page) {
+    size_t count = PAGE_SIZE / sizeof(u32);
+    asm volatile("rep stosl" : "+D"(page), "+c"(count) : "a"(0) : "memory");
+}
+
+static const struct cpu_impl clear_page_impls[] = {
+    {X86_FEATURE_SSE2, "movnti", {.clear_page = _clear_page_nt}},
+    {CPU_FEATURE_NONE, "rep stosl", {.clear_page = _clear_page_rep}},
+};
+
+static const char* clear_page_name = "rep stosl";
+
+// page must be mapped & page aligned, rep until zero_pool_init()
+void (*clear_page)(void* page) = _clear_page_rep;
+
+void zero_pool_init() {
+    const struct cpu_impl* impl = cpu_select(clear_page_impls);
+    clear_page = impl->fn.clear_page;
+    clear_page_name = impl->name;
+}
+
+/*
+    Zeroes one more frame into the pool
+    Returns false if there was nothing to do (pool full or memory low)
+*/
+bool zero_pool_refill() {
+    if (pool_count >= ZERO_POOL_SIZE) return false;
+    if (pmm_get_free_frames() < ZERO_POOL_MIN_FREE) return false;
+
+    phys_addr_t frame = pmm_alloc_frame();
+    if (frame == 0) return false;
+
+    clear_page(PHYS_TO_VIRT(frame));
+
+    u32 flags = spin_lock_irqsave(&pool_lock);
+    if (pool_count < ZERO_POOL_SIZE) {
+        pool[pool_count++] = frame;
+        frame = 0;
+    }
+    spin_unlock_irqrestore(&pool_lock, flags);
+
+    // Lost a race with another refill
+    if (frame != 0) pmm_free_frame(frame);
+    return frame == 0;
+}
+
+/*
+    Returns a zeroed ZONE_NORMAL frame, 0 if the pool is empty
+    (callers then zero a frame of their own)
+*/
+phys_addr_t zero_pool_get() {
+    phys_addr_t frame = 0;
+
+    u32 flags = spin_lock_irqsave(&pool_lock);
+    if (pool_count > 0) {
+        frame = pool[--pool_count];
+        hits++;
+    } else {
+        misses++;
+    }
+    spin_unlock_irqrestore(&pool_lock, flags);
+
+    return frame;
+}
+
+void zero_pool_print_stats() {
+    kprintf("Zero pool: %u/%u frames, %u hits, %u misses (%s)\n",
+            pool_count, ZERO_POOL_SIZE, hits, misses, clear_page_name);
+}